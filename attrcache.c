@@ -0,0 +1,265 @@
+/*
+ * attrcache.c, the in-memory attribute cache for the s3fs project.  See
+ * attrcache.h.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "attrcache.h"
+
+#define ATTRCACHE_BUCKETS 65536
+
+typedef struct attrcache_entry
+{
+    char *path;
+    struct stat st;
+    int absent;                       // cached as not existing; st unused
+    time_t cached;                    // when put
+    struct attrcache_entry *hashNext; // next entry in the hash bucket
+    struct attrcache_entry *lruPrev;  // more recently used
+    struct attrcache_entry *lruNext;  // less recently used
+} attrcache_entry;
+
+static attrcache_entry *bucketsG[ATTRCACHE_BUCKETS];
+static attrcache_entry *lruHeadG = NULL; // most recently used
+static attrcache_entry *lruTailG = NULL; // least recently used
+static int ttlG = ATTRCACHE_DEFAULT_TTL;
+static int negativeTtlG = ATTRCACHE_DEFAULT_NEGATIVE_TTL;
+static size_t maxEntriesG = ATTRCACHE_DEFAULT_MAX_ENTRIES;
+static uint64_t epochG = 0; // count of removals
+static attrcache_stats_t statsG;
+static pthread_mutex_t attrcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static time_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static unsigned hash_path(const char *path)
+{
+    unsigned hash = 5381;
+    for (; *path; path++) {
+        hash = hash * 33 + (unsigned char) *path;
+    }
+    return hash % ATTRCACHE_BUCKETS;
+}
+
+// Find path's entry; with the lock held.
+static attrcache_entry *find_entry(const char *path)
+{
+    attrcache_entry *entry = bucketsG[hash_path(path)];
+    while (entry && strcmp(entry->path, path)) {
+        entry = entry->hashNext;
+    }
+    return entry;
+}
+
+static void lru_unlink(attrcache_entry *entry)
+{
+    if (entry->lruPrev) {
+        entry->lruPrev->lruNext = entry->lruNext;
+    }
+    else {
+        lruHeadG = entry->lruNext;
+    }
+    if (entry->lruNext) {
+        entry->lruNext->lruPrev = entry->lruPrev;
+    }
+    else {
+        lruTailG = entry->lruPrev;
+    }
+    entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void lru_push(attrcache_entry *entry)
+{
+    entry->lruPrev = NULL;
+    entry->lruNext = lruHeadG;
+    if (lruHeadG) {
+        lruHeadG->lruPrev = entry;
+    }
+    lruHeadG = entry;
+    if (!lruTailG) {
+        lruTailG = entry;
+    }
+}
+
+// Unlink and free an entry; with the lock held.
+static void drop_entry(attrcache_entry *entry)
+{
+    attrcache_entry **slot = &bucketsG[hash_path(entry->path)];
+    while (*slot != entry) {
+        slot = &(*slot)->hashNext;
+    }
+    *slot = entry->hashNext;
+    lru_unlink(entry);
+
+    statsG.entries--;
+    free(entry->path);
+    free(entry);
+}
+
+static int is_fresh(const attrcache_entry *entry)
+{
+    return now() - entry->cached < (entry->absent ? negativeTtlG : ttlG);
+}
+
+// Cache path as absent or with attributes st, looked up in epoch.
+static void put_entry(const char *path, int absent, const struct stat *st,
+                      uint64_t epoch)
+{
+    pthread_mutex_lock(&attrcache_lock);
+    if (epoch != epochG) {
+        statsG.raced++;
+        pthread_mutex_unlock(&attrcache_lock);
+        return;
+    }
+    if (maxEntriesG == 0 || (absent ? negativeTtlG : ttlG) == 0) {
+        attrcache_entry *old = find_entry(path);
+        if (old) {
+            drop_entry(old);
+        }
+        pthread_mutex_unlock(&attrcache_lock);
+        return;
+    }
+    attrcache_entry *entry = find_entry(path);
+    if (entry) {
+        // just refresh it in place
+        lru_unlink(entry);
+    }
+    else {
+        entry = calloc(1, sizeof(attrcache_entry));
+        if (entry) {
+            entry->path = strdup(path);
+        }
+        if (!entry || !entry->path) {
+            free(entry);
+            pthread_mutex_unlock(&attrcache_lock);
+            return;
+        }
+        while (lruTailG && (size_t) statsG.entries >= maxEntriesG) {
+            drop_entry(lruTailG);
+            statsG.evictions++;
+        }
+        unsigned bucket = hash_path(path);
+        entry->hashNext = bucketsG[bucket];
+        bucketsG[bucket] = entry;
+        statsG.entries++;
+    }
+    entry->absent = absent;
+    if (!absent) {
+        entry->st = *st;
+    }
+    entry->cached = now();
+    lru_push(entry);
+    pthread_mutex_unlock(&attrcache_lock);
+}
+
+
+void attrcache_init(int ttl, int negative_ttl, size_t max_entries)
+{
+    pthread_mutex_lock(&attrcache_lock);
+    ttlG = ttl >= 0 ? ttl : 0;
+    negativeTtlG = negative_ttl >= 0 ? negative_ttl : 0;
+    maxEntriesG = max_entries;
+    pthread_mutex_unlock(&attrcache_lock);
+}
+
+void attrcache_destroy()
+{
+    pthread_mutex_lock(&attrcache_lock);
+    while (lruHeadG) {
+        drop_entry(lruHeadG);
+    }
+    pthread_mutex_unlock(&attrcache_lock);
+}
+
+int attrcache_get(const char *path, struct stat *st)
+{
+    int rv = ATTRCACHE_MISS;
+    pthread_mutex_lock(&attrcache_lock);
+    attrcache_entry *entry = find_entry(path);
+    if (entry && !is_fresh(entry)) {
+        drop_entry(entry);
+        entry = NULL;
+    }
+    if (entry && entry->absent) {
+        rv = ATTRCACHE_ABSENT;
+        lru_unlink(entry);
+        lru_push(entry);
+        statsG.negative++;
+    }
+    else if (entry) {
+        *st = entry->st;
+        rv = ATTRCACHE_HIT;
+        lru_unlink(entry);
+        lru_push(entry);
+        statsG.hits++;
+    }
+    else {
+        statsG.misses++;
+    }
+    pthread_mutex_unlock(&attrcache_lock);
+    return rv;
+}
+
+uint64_t attrcache_epoch()
+{
+    pthread_mutex_lock(&attrcache_lock);
+    uint64_t epoch = epochG;
+    pthread_mutex_unlock(&attrcache_lock);
+    return epoch;
+}
+
+void attrcache_put(const char *path, const struct stat *st, uint64_t epoch)
+{
+    put_entry(path, 0, st, epoch);
+}
+
+void attrcache_put_absent(const char *path, uint64_t epoch)
+{
+    put_entry(path, 1, NULL, epoch);
+}
+
+void attrcache_remove(const char *path)
+{
+    pthread_mutex_lock(&attrcache_lock);
+    attrcache_entry *entry = find_entry(path);
+    if (entry) {
+        drop_entry(entry);
+    }
+    // even if path isn't cached, a lookup of it may be under way
+    epochG++;
+    pthread_mutex_unlock(&attrcache_lock);
+}
+
+void attrcache_remove_tree(const char *path)
+{
+    size_t len = strlen(path);
+    pthread_mutex_lock(&attrcache_lock);
+    attrcache_entry *entry = lruHeadG;
+    while (entry) {
+        attrcache_entry *next = entry->lruNext;
+        if (!strncmp(entry->path, path, len) &&
+            (entry->path[len] == '\0' || entry->path[len] == '/' ||
+             path[len - 1] == '/')) {
+            drop_entry(entry);
+        }
+        entry = next;
+    }
+    epochG++;
+    pthread_mutex_unlock(&attrcache_lock);
+}
+
+void attrcache_get_stats(attrcache_stats_t *stats)
+{
+    pthread_mutex_lock(&attrcache_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&attrcache_lock);
+}
@@ -0,0 +1,105 @@
+/*
+ * In-memory cache of file and directory attributes for the s3fs project.
+ *
+ * Attributes are cached as struct stat, keyed by path.  fs_readdir fills
+ * the cache from the dirents it lists, and fs_getattr both answers from it
+ * and fills it, so listing a directory and then stat'ing everything in it
+ * (as "ls -l" does) costs no more requests than the listing.  The
+ * filesystem drops a path's entry whenever it changes the path, so an
+ * entry can only go stale through another client; entries older than the
+ * TTL are dropped rather than revalidated.  The least recently used
+ * entries are evicted to keep the cache under its cap.
+ *
+ * Paths found not to exist are cached too, as absent, under a shorter TTL
+ * of their own, so that probing a missing path again (as build tools and
+ * shells do all the time) costs no request.  Creating the path drops its
+ * entry like any other change, so only another client's creates can go
+ * unseen, and then only for the negative TTL.
+ *
+ * A lookup may race with a change to what it looked up, so callers take
+ * an epoch (attrcache_epoch) before looking a path up, and what they then
+ * put is dropped if anything was removed from the cache in the meantime.
+ * A change must therefore remove its paths after it is made, not before.
+ *
+ * All functions are thread-safe.
+ */
+#ifndef __ATTRCACHE_H__
+#define __ATTRCACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define ATTRCACHE_DEFAULT_TTL 60         // seconds
+#define ATTRCACHE_DEFAULT_NEGATIVE_TTL 5 // seconds, for absent paths
+#define ATTRCACHE_DEFAULT_MAX_ENTRIES (256 * 1024)
+
+/*
+ * Results of attrcache_get.
+ */
+#define ATTRCACHE_MISS 0   // not cached, or older than the TTL
+#define ATTRCACHE_HIT 1    // cached and fresh
+#define ATTRCACHE_ABSENT 2 // cached as not existing, and fresh
+
+typedef struct {
+    uint64_t hits;      // lookups answered from a fresh entry
+    uint64_t negative;  // lookups answered from a fresh absent entry
+    uint64_t misses;    // lookups that found no fresh entry
+    uint64_t evictions; // entries dropped to stay under the cap
+    uint64_t raced;     // puts dropped for a change since their epoch
+    int entries;        // number of cached paths
+} attrcache_stats_t;
+
+/*
+ * Set up the cache.  Entries are fresh for ttl seconds, or negative_ttl
+ * seconds for absent paths (0 disables either kind), and at most
+ * max_entries paths are kept (0 disables the cache).
+ */
+void attrcache_init(int ttl, int negative_ttl, size_t max_entries);
+
+/*
+ * Drop every entry and release the cache.
+ */
+void attrcache_destroy();
+
+/*
+ * Look up the attributes of path, copying them to *st.  Returns
+ * ATTRCACHE_HIT, ATTRCACHE_ABSENT (leaving *st alone) or ATTRCACHE_MISS.
+ */
+int attrcache_get(const char *path, struct stat *st);
+
+/*
+ * The current epoch; take it before looking up what to put.
+ */
+uint64_t attrcache_epoch();
+
+/*
+ * Cache st as the attributes of path, replacing any cached copy, unless
+ * anything was removed from the cache since epoch.
+ */
+void attrcache_put(const char *path, const struct stat *st, uint64_t epoch);
+
+/*
+ * Cache path as not existing, replacing any cached attributes, unless
+ * anything was removed from the cache since epoch.
+ */
+void attrcache_put_absent(const char *path, uint64_t epoch);
+
+/*
+ * Drop path's attributes (or absence) from the cache.
+ */
+void attrcache_remove(const char *path);
+
+/*
+ * Drop the attributes (or absence) of path and of every path below it,
+ * as when path is a directory that has been renamed.  This looks at every
+ * cached path, but costs no request.
+ */
+void attrcache_remove_tree(const char *path);
+
+/*
+ * Copy the cache's counters to *stats.
+ */
+void attrcache_get_stats(attrcache_stats_t *stats);
+
+#endif // __ATTRCACHE_H__
@@ -0,0 +1,376 @@
+/*
+ * blockcache.c, the block cache of file contents for the s3fs project.
+ * See blockcache.h.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockcache.h"
+#include "diskcache.h"
+#include "libs3_wrapper.h"
+
+#define BLOCKCACHE_BUCKETS 16384
+
+typedef struct block
+{
+    char *key;
+    uint64_t number;
+    uint8_t *data;
+    size_t len;                // short only at the end of the object
+    char etag[S3FS_ETAG_SIZE]; // the object's ETag when fetched
+    struct block *hashNext;    // next block in the hash bucket
+    struct block *lruPrev;     // more recently used
+    struct block *lruNext;     // less recently used
+} block;
+
+static block *bucketsG[BLOCKCACHE_BUCKETS];
+static block *lruHeadG = NULL; // most recently used
+static block *lruTailG = NULL; // least recently used
+static size_t blockSizeG = BLOCKCACHE_DEFAULT_BLOCK_SIZE;
+static size_t maxBytesG = BLOCKCACHE_DEFAULT_MAX_BYTES;
+static size_t readaheadG = BLOCKCACHE_DEFAULT_READAHEAD;
+static blockcache_stats_t statsG;
+static pthread_mutex_t blockcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static unsigned hash_block(const char *key, uint64_t number)
+{
+    unsigned hash = 5381;
+    for (; *key; key++) {
+        hash = hash * 33 + (unsigned char) *key;
+    }
+    hash ^= (unsigned) number * 2654435761u;
+    return hash % BLOCKCACHE_BUCKETS;
+}
+
+static size_t block_bytes(const block *b)
+{
+    return sizeof(block) + strlen(b->key) + 1 + b->len;
+}
+
+// Find a block; with the lock held.
+static block *find_block(const char *key, uint64_t number)
+{
+    block *b = bucketsG[hash_block(key, number)];
+    while (b && (b->number != number || strcmp(b->key, key))) {
+        b = b->hashNext;
+    }
+    return b;
+}
+
+static void lru_unlink(block *b)
+{
+    if (b->lruPrev) {
+        b->lruPrev->lruNext = b->lruNext;
+    }
+    else {
+        lruHeadG = b->lruNext;
+    }
+    if (b->lruNext) {
+        b->lruNext->lruPrev = b->lruPrev;
+    }
+    else {
+        lruTailG = b->lruPrev;
+    }
+    b->lruPrev = b->lruNext = NULL;
+}
+
+static void lru_push(block *b)
+{
+    b->lruPrev = NULL;
+    b->lruNext = lruHeadG;
+    if (lruHeadG) {
+        lruHeadG->lruPrev = b;
+    }
+    lruHeadG = b;
+    if (!lruTailG) {
+        lruTailG = b;
+    }
+}
+
+static void free_block(block *b)
+{
+    free(b->key);
+    free(b->data);
+    free(b);
+}
+
+// Unlink and free a block; with the lock held.
+static void drop_block(block *b)
+{
+    block **slot = &bucketsG[hash_block(b->key, b->number)];
+    while (*slot != b) {
+        slot = &(*slot)->hashNext;
+    }
+    *slot = b->hashNext;
+    lru_unlink(b);
+
+    statsG.bytes -= block_bytes(b);
+    statsG.blocks--;
+    free_block(b);
+}
+
+// Copy up to len bytes from offset in a cached block to dst; with the lock
+// held.  Returns the number of bytes copied, or -1 if it isn't cached.
+static ssize_t copy_block(const char *key, uint64_t number, size_t offset,
+                          uint8_t *dst, size_t len)
+{
+    block *b = find_block(key, number);
+    if (!b) {
+        return -1;
+    }
+    lru_unlink(b);
+    lru_push(b);
+    if (offset >= b->len) {
+        return 0;
+    }
+    if (len > b->len - offset) {
+        len = b->len - offset;
+    }
+    memcpy(dst, b->data + offset, len);
+    return len;
+}
+
+static void put_block(const char *key, uint64_t number, const uint8_t *data,
+                      size_t len, const char *etag)
+{
+    block *b = calloc(1, sizeof(block));
+    if (b) {
+        b->key = strdup(key);
+        b->data = malloc(len ? len : 1);
+    }
+    if (!b || !b->key || !b->data) {
+        if (b) {
+            free_block(b);
+        }
+        return;
+    }
+    b->number = number;
+    memcpy(b->data, data, len);
+    b->len = len;
+    snprintf(b->etag, sizeof(b->etag), "%s", etag);
+
+    pthread_mutex_lock(&blockcache_lock);
+    block *old = find_block(key, number);
+    if (old) {
+        drop_block(old);
+    }
+    while (lruTailG && statsG.bytes + block_bytes(b) > maxBytesG) {
+        drop_block(lruTailG);
+        statsG.evictions++;
+    }
+    unsigned bucket = hash_block(key, number);
+    b->hashNext = bucketsG[bucket];
+    bucketsG[bucket] = b;
+    lru_push(b);
+    statsG.bytes += block_bytes(b);
+    statsG.blocks++;
+    pthread_mutex_unlock(&blockcache_lock);
+}
+
+// Load blocks first to last, those not in memory, from the disk cache if
+// it has them from the object's current version (etag), stopping at the
+// first it doesn't have.
+static void load_blocks(const char *bucket, const char *key,
+                        const char *etag, uint64_t first, uint64_t last)
+{
+    uint64_t number;
+    for (number = first; number <= last; number++) {
+        pthread_mutex_lock(&blockcache_lock);
+        int cached = find_block(key, number) != NULL;
+        pthread_mutex_unlock(&blockcache_lock);
+        if (cached) {
+            continue;
+        }
+        uint8_t *data = NULL;
+        char diskEtag[S3FS_ETAG_SIZE];
+        ssize_t len = diskcache_get(bucket, key, number, &data, diskEtag);
+        if (len < 0 || strcmp(diskEtag, etag)) {
+            free(data);
+            return;
+        }
+        put_block(key, number, data, len, etag);
+        free(data);
+        if ((size_t) len < blockSizeG) {
+            return; // the end of the object
+        }
+    }
+}
+
+// Fetch block first, and after it those up to last that aren't cached, in
+// one ranged GET.  Returns 0 on success and -1 on failure.
+static int fetch_blocks(const char *bucket, const char *key, uint64_t first,
+                        uint64_t last)
+{
+    // stop at the first block already cached; there's no need to fetch
+    // it again, and the blocks after it will be fetched when reached
+    uint64_t end = first + 1;
+    pthread_mutex_lock(&blockcache_lock);
+    while (end <= last && !find_block(key, end)) {
+        end++;
+    }
+    pthread_mutex_unlock(&blockcache_lock);
+
+    size_t len = (end - first) * blockSizeG;
+    uint8_t *buf = malloc(len);
+    if (!buf) {
+        return -1;
+    }
+    s3fs_object_info_t info;
+    info.etag[0] = '\0';
+    ssize_t got = s3fs_get_object_into_if_changed(bucket, key, buf, len,
+                                                  first * blockSizeG, NULL,
+                                                  &info);
+    if (got < 0) {
+        free(buf);
+        return -1;
+    }
+
+    uint64_t number;
+    int stored = 0;
+    for (number = first; number < end; number++) {
+        size_t start = (number - first) * blockSizeG;
+        size_t blockLen = (size_t) got - start < blockSizeG ?
+            (size_t) got - start : blockSizeG;
+        // a short (or empty) block marks the end of the object
+        put_block(key, number, buf + start, blockLen, info.etag);
+        if (info.etag[0]) {
+            diskcache_put(bucket, key, number, buf + start, blockLen,
+                          info.etag);
+        }
+        stored++;
+        if (blockLen < blockSizeG) {
+            break;
+        }
+    }
+    free(buf);
+
+    pthread_mutex_lock(&blockcache_lock);
+    statsG.misses++;
+    statsG.prefetched += stored - 1;
+    pthread_mutex_unlock(&blockcache_lock);
+    return 0;
+}
+
+
+void blockcache_init(size_t block_size, size_t max_bytes, size_t readahead)
+{
+    pthread_mutex_lock(&blockcache_lock);
+    blockSizeG = block_size ? block_size : BLOCKCACHE_DEFAULT_BLOCK_SIZE;
+    maxBytesG = max_bytes;
+    // leave most of the cache to blocks already read
+    readaheadG = readahead < max_bytes / 4 ? readahead : max_bytes / 4;
+    pthread_mutex_unlock(&blockcache_lock);
+}
+
+void blockcache_destroy()
+{
+    pthread_mutex_lock(&blockcache_lock);
+    while (lruHeadG) {
+        drop_block(lruHeadG);
+    }
+    pthread_mutex_unlock(&blockcache_lock);
+}
+
+ssize_t blockcache_read(const char *bucket, const char *key, uint8_t *dst,
+                        size_t len, uint64_t offset, int64_t file_size,
+                        const char *etag, blockcache_stream_t *stream)
+{
+    if (len == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&blockcache_lock);
+    if (maxBytesG == 0) {
+        pthread_mutex_unlock(&blockcache_lock);
+        return s3fs_get_object_into(bucket, key, dst, len, offset);
+    }
+    // a read that starts where the last one ended doubles the window;
+    // any other read closes it again
+    size_t window = 0;
+    if (stream) {
+        if (offset == stream->next) {
+            window = stream->window ? stream->window * 2 : blockSizeG;
+            window = window < readaheadG ? window : readaheadG;
+        }
+        stream->window = window;
+        stream->next = offset + len;
+    }
+    pthread_mutex_unlock(&blockcache_lock);
+
+    uint64_t first = offset / blockSizeG;
+    uint64_t last = (offset + len - 1) / blockSizeG;
+    uint64_t ahead = (offset + len - 1 + window) / blockSizeG;
+    if (file_size > 0 && ahead > (uint64_t) (file_size - 1) / blockSizeG) {
+        ahead = (uint64_t) (file_size - 1) / blockSizeG;
+    }
+    if (ahead < last) {
+        ahead = last;
+    }
+
+    size_t done = 0;
+    uint64_t number;
+    for (number = first; number <= last; number++) {
+        size_t blockOffset = number == first ? offset % blockSizeG : 0;
+        size_t want = blockSizeG - blockOffset;
+        want = want < len - done ? want : len - done;
+
+        pthread_mutex_lock(&blockcache_lock);
+        ssize_t got = copy_block(key, number, blockOffset, dst + done, want);
+        if (got >= 0) {
+            statsG.hits++;
+        }
+        pthread_mutex_unlock(&blockcache_lock);
+
+        if (got < 0 && etag && etag[0]) {
+            load_blocks(bucket, key, etag, number, ahead);
+            pthread_mutex_lock(&blockcache_lock);
+            got = copy_block(key, number, blockOffset, dst + done, want);
+            pthread_mutex_unlock(&blockcache_lock);
+        }
+        if (got < 0) {
+            if (fetch_blocks(bucket, key, number, ahead) < 0) {
+                return -1;
+            }
+            pthread_mutex_lock(&blockcache_lock);
+            got = copy_block(key, number, blockOffset, dst + done, want);
+            pthread_mutex_unlock(&blockcache_lock);
+        }
+        if (got < 0) {
+            // evicted again before it could be copied; read it directly
+            got = s3fs_get_object_into(bucket, key, dst + done, want,
+                                       number * blockSizeG + blockOffset);
+            if (got < 0) {
+                return -1;
+            }
+        }
+        done += got;
+        if ((size_t) got < want) {
+            break; // the end of the object
+        }
+    }
+    return done;
+}
+
+void blockcache_invalidate(const char *key, const char *etag)
+{
+    pthread_mutex_lock(&blockcache_lock);
+    block *b = lruHeadG;
+    while (b) {
+        block *next = b->lruNext;
+        if (!strcmp(b->key, key) && (!etag || strcmp(b->etag, etag))) {
+            drop_block(b);
+        }
+        b = next;
+    }
+    pthread_mutex_unlock(&blockcache_lock);
+}
+
+void blockcache_get_stats(blockcache_stats_t *stats)
+{
+    pthread_mutex_lock(&blockcache_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&blockcache_lock);
+}
@@ -0,0 +1,89 @@
+/*
+ * Block cache of file contents for the s3fs project.
+ *
+ * Objects are read through the cache in fixed-size blocks, aligned to
+ * multiples of the block size and keyed by the object's key and the
+ * block's number.  Each block is tagged with the ETag the object had when
+ * the block was fetched, so blocks of an older version can be dropped when
+ * a newer one is seen.  The least recently used blocks are evicted to keep
+ * the cache under its memory cap.
+ *
+ * Blocks missing from memory are looked for in the persistent disk cache
+ * (diskcache.h), if it is on, before they are fetched from s3, and blocks
+ * fetched from s3 are written to it.
+ *
+ * Reads are also watched for sequential access, per open file (a
+ * blockcache_stream_t).  While a file is read sequentially, each fetch
+ * also reads ahead, over a window that starts at one block and doubles
+ * with every sequential read up to a maximum, so that a streaming reader
+ * pays one round trip per window rather than one per read.
+ *
+ * All functions are thread-safe.
+ */
+#ifndef __BLOCKCACHE_H__
+#define __BLOCKCACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define BLOCKCACHE_DEFAULT_BLOCK_SIZE (1024 * 1024)
+#define BLOCKCACHE_DEFAULT_MAX_BYTES (256 * 1024 * 1024)
+#define BLOCKCACHE_DEFAULT_READAHEAD (32 * 1024 * 1024) // most bytes
+
+typedef struct {
+    uint64_t hits;        // blocks read from the cache
+    uint64_t misses;      // blocks that had to be fetched
+    uint64_t prefetched;  // blocks fetched ahead of a read
+    uint64_t evictions;   // blocks dropped to stay under the memory cap
+    size_t bytes;         // memory held by cached blocks
+    int blocks;           // number of cached blocks
+} blockcache_stats_t;
+
+/*
+ * Sequential-access state of one open file; zero it before the first
+ * read.
+ */
+typedef struct {
+    uint64_t next;  // offset a sequential read would start at
+    size_t window;  // bytes to read ahead; 0 until reads look sequential
+} blockcache_stream_t;
+
+/*
+ * Set up the cache, with blocks of block_size bytes, at most max_bytes of
+ * them cached (0 disables the cache) and at most readahead bytes read
+ * ahead of a sequential reader.
+ */
+void blockcache_init(size_t block_size, size_t max_bytes, size_t readahead);
+
+/*
+ * Drop every block and release the cache.
+ */
+void blockcache_destroy();
+
+/*
+ * Read up to len bytes of the object at key, starting at offset, into
+ * dst, through the cache.  file_size is the object's size if known (it
+ * limits read-ahead), or -1.  etag is the object's current ETag if known,
+ * or NULL; blocks are only taken from the disk cache if it matches.
+ * stream (which may be NULL) is the reader's sequential-access state.
+ *
+ * Returns the number of bytes read, which is less than len only at the
+ * end of the object, or -1 on error.
+ */
+ssize_t blockcache_read(const char *bucket, const char *key, uint8_t *dst,
+                        size_t len, uint64_t offset, int64_t file_size,
+                        const char *etag, blockcache_stream_t *stream);
+
+/*
+ * Drop the blocks of key, except those fetched when the object had the
+ * ETag etag (all of them if etag is NULL).
+ */
+void blockcache_invalidate(const char *key, const char *etag);
+
+/*
+ * Copy the cache's counters to *stats.
+ */
+void blockcache_get_stats(blockcache_stats_t *stats);
+
+#endif // __BLOCKCACHE_H__
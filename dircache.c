@@ -0,0 +1,283 @@
+/*
+ * dircache.c, the in-memory directory cache for the s3fs project.  See
+ * dircache.h.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dircache.h"
+#include "libs3_wrapper.h"
+#include "s3dir.h"
+
+#define DIRCACHE_BUCKETS 16384
+
+typedef struct dircache_entry
+{
+    char *path;
+    s3dirent_t *dir;
+    int count;
+    s3dir_index_t index;              // dir's entries by name
+    char etag[S3FS_ETAG_SIZE];
+    time_t validated;                 // when last fetched or revalidated
+    struct dircache_entry *hashNext;  // next entry in the hash bucket
+    struct dircache_entry *lruPrev;   // more recently used
+    struct dircache_entry *lruNext;   // less recently used
+} dircache_entry;
+
+static dircache_entry *bucketsG[DIRCACHE_BUCKETS];
+static dircache_entry *lruHeadG = NULL; // most recently used
+static dircache_entry *lruTailG = NULL; // least recently used
+static int ttlG = DIRCACHE_DEFAULT_TTL;
+static size_t maxBytesG = DIRCACHE_DEFAULT_MAX_BYTES;
+static dircache_stats_t statsG;
+static pthread_mutex_t dircache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static time_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static unsigned hash_path(const char *path)
+{
+    unsigned hash = 5381;
+    for (; *path; path++) {
+        hash = hash * 33 + (unsigned char) *path;
+    }
+    return hash % DIRCACHE_BUCKETS;
+}
+
+static size_t entry_bytes(const dircache_entry *entry)
+{
+    return sizeof(dircache_entry) + strlen(entry->path) + 1 +
+        (size_t) entry->count * sizeof(s3dirent_t) +
+        s3dir_index_bytes(&entry->index);
+}
+
+// Find path's entry; with the lock held.
+static dircache_entry *find_entry(const char *path)
+{
+    dircache_entry *entry = bucketsG[hash_path(path)];
+    while (entry && strcmp(entry->path, path)) {
+        entry = entry->hashNext;
+    }
+    return entry;
+}
+
+static void lru_unlink(dircache_entry *entry)
+{
+    if (entry->lruPrev) {
+        entry->lruPrev->lruNext = entry->lruNext;
+    }
+    else {
+        lruHeadG = entry->lruNext;
+    }
+    if (entry->lruNext) {
+        entry->lruNext->lruPrev = entry->lruPrev;
+    }
+    else {
+        lruTailG = entry->lruPrev;
+    }
+    entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void lru_push(dircache_entry *entry)
+{
+    entry->lruPrev = NULL;
+    entry->lruNext = lruHeadG;
+    if (lruHeadG) {
+        lruHeadG->lruPrev = entry;
+    }
+    lruHeadG = entry;
+    if (!lruTailG) {
+        lruTailG = entry;
+    }
+}
+
+static void free_entry(dircache_entry *entry)
+{
+    s3dir_index_free(&entry->index);
+    free(entry->path);
+    free(entry->dir);
+    free(entry);
+}
+
+// Unlink and free an entry; with the lock held.
+static void drop_entry(dircache_entry *entry)
+{
+    dircache_entry **slot = &bucketsG[hash_path(entry->path)];
+    while (*slot != entry) {
+        slot = &(*slot)->hashNext;
+    }
+    *slot = entry->hashNext;
+    lru_unlink(entry);
+
+    statsG.bytes -= entry_bytes(entry);
+    statsG.entries--;
+    free_entry(entry);
+}
+
+static int is_fresh(const dircache_entry *entry)
+{
+    return now() - entry->validated < ttlG;
+}
+
+
+void dircache_init(int ttl, size_t max_bytes)
+{
+    pthread_mutex_lock(&dircache_lock);
+    ttlG = ttl >= 0 ? ttl : 0;
+    maxBytesG = max_bytes;
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+void dircache_destroy()
+{
+    pthread_mutex_lock(&dircache_lock);
+    while (lruHeadG) {
+        drop_entry(lruHeadG);
+    }
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+int dircache_get(const char *path, s3dirent_t **dir, int *count,
+                 char *etag, s3dir_index_t *index)
+{
+    int rv = DIRCACHE_MISS;
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry *entry = find_entry(path);
+    if (entry) {
+        size_t dirBytes = (size_t) entry->count * sizeof(s3dirent_t);
+        s3dirent_t *copy = malloc(dirBytes ? dirBytes : 1);
+        if (copy && index && s3dir_index_copy(index, &entry->index) < 0) {
+            free(copy);
+            copy = NULL;
+        }
+        if (copy) {
+            memcpy(copy, entry->dir, dirBytes);
+            *dir = copy;
+            *count = entry->count;
+            memcpy(etag, entry->etag, S3FS_ETAG_SIZE);
+            rv = is_fresh(entry) ? DIRCACHE_HIT : DIRCACHE_STALE;
+            lru_unlink(entry);
+            lru_push(entry);
+        }
+    }
+    if (rv == DIRCACHE_HIT) {
+        statsG.hits++;
+    }
+    else if (rv == DIRCACHE_STALE) {
+        statsG.stale++;
+    }
+    else {
+        statsG.misses++;
+    }
+    pthread_mutex_unlock(&dircache_lock);
+    return rv;
+}
+
+int dircache_lookup(const char *path, const char *name, s3dirent_t *dirent)
+{
+    int rv = DIRCACHE_MISS;
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry *entry = find_entry(path);
+    if (entry && is_fresh(entry)) {
+        int i = s3dir_index_find(&entry->index, entry->dir, name);
+        if (i >= 0) {
+            *dirent = entry->dir[i];
+            rv = DIRCACHE_HIT;
+        }
+        else {
+            rv = DIRCACHE_ABSENT;
+        }
+        lru_unlink(entry);
+        lru_push(entry);
+        // a miss here is counted by the dircache_get that follows it
+        statsG.hits++;
+    }
+    pthread_mutex_unlock(&dircache_lock);
+    return rv;
+}
+
+void dircache_put(const char *path, const s3dirent_t *dir, int count,
+                  const char *etag, const s3dir_index_t *index)
+{
+    size_t dirBytes = (size_t) count * sizeof(s3dirent_t);
+    dircache_entry *entry = calloc(1, sizeof(dircache_entry));
+    if (entry) {
+        entry->path = strdup(path);
+        entry->dir = malloc(dirBytes ? dirBytes : 1);
+    }
+    if (entry && entry->dir) {
+        memcpy(entry->dir, dir, dirBytes);
+    }
+    // index outside the lock; a large directory takes a while to hash
+    if (!entry || !entry->path || !entry->dir ||
+        (index ? s3dir_index_copy(&entry->index, index) :
+         s3dir_index_build(&entry->index, entry->dir, count)) < 0) {
+        if (entry) {
+            free_entry(entry);
+        }
+        dircache_remove(path);
+        return;
+    }
+    entry->count = count;
+    snprintf(entry->etag, sizeof(entry->etag), "%s", etag ? etag : "");
+    entry->validated = now();
+
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry *old = find_entry(path);
+    if (old) {
+        drop_entry(old);
+    }
+    if (entry_bytes(entry) > maxBytesG) {
+        // too big to cache at all
+        pthread_mutex_unlock(&dircache_lock);
+        free_entry(entry);
+        return;
+    }
+    while (lruTailG && statsG.bytes + entry_bytes(entry) > maxBytesG) {
+        drop_entry(lruTailG);
+        statsG.evictions++;
+    }
+    unsigned bucket = hash_path(path);
+    entry->hashNext = bucketsG[bucket];
+    bucketsG[bucket] = entry;
+    lru_push(entry);
+    statsG.bytes += entry_bytes(entry);
+    statsG.entries++;
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+void dircache_touch(const char *path)
+{
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry *entry = find_entry(path);
+    if (entry) {
+        entry->validated = now();
+        statsG.revalidations++;
+    }
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+void dircache_remove(const char *path)
+{
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry *entry = find_entry(path);
+    if (entry) {
+        drop_entry(entry);
+    }
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+void dircache_get_stats(dircache_stats_t *stats)
+{
+    pthread_mutex_lock(&dircache_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&dircache_lock);
+}
@@ -0,0 +1,100 @@
+/*
+ * In-memory cache of directory objects for the s3fs project.
+ *
+ * Directories are cached as parsed s3dirent_t arrays, keyed by path.  The
+ * filesystem writes each change it makes to a directory through to the
+ * cache as well as to s3, so an entry can only go stale through another
+ * client.  An entry older than the TTL is revalidated against s3 by its
+ * ETag before it is used again.  The least recently used entries are
+ * evicted to keep the cache under its memory cap.  Each cached directory
+ * carries a hash index of its names (see s3dir.h), so dircache_lookup
+ * takes the same time however large the directory is.
+ *
+ * All functions are thread-safe.
+ */
+#ifndef __DIRCACHE_H__
+#define __DIRCACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "s3fs.h"
+#include "s3dir.h"
+
+#define DIRCACHE_DEFAULT_TTL 60 // seconds
+#define DIRCACHE_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+
+/*
+ * Results of dircache_get and dircache_lookup.
+ */
+#define DIRCACHE_MISS 0   // not cached (or, for dircache_lookup, stale)
+#define DIRCACHE_HIT 1    // cached and fresh
+#define DIRCACHE_STALE 2  // cached, but older than the TTL
+#define DIRCACHE_ABSENT 3 // cached and fresh, but has no such entry
+
+typedef struct {
+    uint64_t hits;          // lookups answered from a fresh entry
+    uint64_t misses;        // lookups that found no entry
+    uint64_t stale;         // lookups that found an entry past its TTL
+    uint64_t revalidations; // stale entries found unchanged on s3
+    uint64_t evictions;     // entries dropped to stay under the memory cap
+    size_t bytes;           // memory held by the cached directories
+    int entries;            // number of cached directories
+} dircache_stats_t;
+
+/*
+ * Set up the cache.  Entries are fresh for ttl seconds (0 means they are
+ * always revalidated), and at most max_bytes of directory entries are
+ * kept (0 disables the cache).
+ */
+void dircache_init(int ttl, size_t max_bytes);
+
+/*
+ * Drop every entry and release the cache.
+ */
+void dircache_destroy();
+
+/*
+ * Look up the directory at path.  On DIRCACHE_HIT or DIRCACHE_STALE, *dir
+ * is set to a malloc'ed copy of its entries (which the caller must free),
+ * *count to their number, and etag (S3FS_ETAG_SIZE bytes) to the ETag the
+ * directory had on s3, or "" if unknown; and unless index is NULL, *index
+ * is set to a copy of its index (release it with s3dir_index_free).
+ * Returns DIRCACHE_MISS if the directory is not cached.
+ */
+int dircache_get(const char *path, s3dirent_t **dir, int *count,
+                 char *etag, s3dir_index_t *index);
+
+/*
+ * Look up the dirent called name in the cached directory at path, copying
+ * it to *dirent.  Returns DIRCACHE_HIT if it was found, DIRCACHE_ABSENT if
+ * the directory has no such dirent, and DIRCACHE_MISS if the directory is
+ * not cached or is stale (use dircache_get then).
+ */
+int dircache_lookup(const char *path, const char *name, s3dirent_t *dirent);
+
+/*
+ * Cache count dirents as the directory at path, fetched or stored with the
+ * given ETag ("" or NULL if unknown), replacing any cached copy.  index is
+ * an index the caller already built over dir, which is copied rather than
+ * built again, or NULL to have one built.
+ */
+void dircache_put(const char *path, const s3dirent_t *dir, int count,
+                  const char *etag, const s3dir_index_t *index);
+
+/*
+ * Mark the directory at path fresh again, after s3 reported that it has
+ * not changed.
+ */
+void dircache_touch(const char *path);
+
+/*
+ * Drop the directory at path from the cache.
+ */
+void dircache_remove(const char *path);
+
+/*
+ * Copy the cache's counters to *stats.
+ */
+void dircache_get_stats(dircache_stats_t *stats);
+
+#endif // __DIRCACHE_H__
@@ -0,0 +1,141 @@
+/*
+ * Simple tests for the directory cache's revalidation (dircache.h), through
+ * the directory operations of the s3fs project (dirops.h).
+ *
+ * Like libs3_wrapper_test, these run against the bucket named in the
+ * environment, so they see how libs3 really reports an unchanged object.
+ * A directory cached for longer than the TTL must be revalidated by its
+ * ETag and used again, not fetched again or dropped; one changed or
+ * removed behind the cache's back must be noticed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dircache.h"
+#include "dirops.h"
+#include "libs3_wrapper.h"
+#include "s3fs.h" // for environment strings to look for
+
+#define TEST_TTL 1 // seconds
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    if (ok) {
+        printf("Successfully %s\n", what);
+    } else {
+        printf("Failed: %s\n", what);
+        failures++;
+    }
+}
+
+// Let every cached directory go stale.
+static void wait_stale()
+{
+    sleep(TEST_TTL + 1);
+}
+
+int main(int argc, char **argv) {
+
+    /*
+     * Tests:
+     *  - Store a directory, and look a name up in it from the cache
+     *  - Let it go stale; the lookup revalidates it and touches the entry
+     *  - Look the name up again, fresh, without asking s3
+     *  - Change the directory behind the cache's back; the change is seen
+     *  - Remove it behind the cache's back; it is gone, and uncached
+     *  - Done.
+     */
+
+    char *s3bucket = getenv(S3BUCKET);
+    if (!s3bucket) {
+        fprintf(stderr, "%s environment variable must be defined\n", S3BUCKET);
+        return -1;
+    }
+    if (s3fs_init_credentials() < 0 || s3fs_initialize(0) < 0) {
+        printf("Failed to initialize libs3\n");
+        return -1;
+    }
+    dircache_init(TEST_TTL, DIRCACHE_DEFAULT_MAX_BYTES);
+    dirops_init(s3bucket);
+
+    s3dirent_t dir[2];
+    memset(dir, 0, sizeof(dir));
+    dir[0].type = 'D';
+    strcpy(dir[0].name, ".");
+    dir[0].st_mode = S_IFDIR | 0755;
+    dir[0].st_ino = new_ino();
+    dir[1].type = 'F';
+    strcpy(dir[1].name, "thefile");
+    dir[1].st_mode = S_IFREG | 0644;
+    dir[1].st_ino = new_ino();
+    char dirkey[S3DIR_KEY_SIZE];
+    s3dir_object_key(dirkey, sizeof(dirkey), dir[0].st_ino);
+
+    s3dirent_t dirent;
+    dircache_stats_t before, after;
+    check(dir_store(dirkey, dir, 2) == 0 &&
+          dir_lookup(dirkey, "thefile", &dirent) == 0 &&
+          dirent.st_ino == dir[1].st_ino,
+          "stored a directory and looked a name up in it (dir_lookup)");
+
+    // past the TTL, the lookup revalidates the cached copy with s3
+    wait_stale();
+    dircache_get_stats(&before);
+    int rv = dir_lookup(dirkey, "thefile", &dirent);
+    dircache_get_stats(&after);
+    check(rv == 0 && dirent.st_ino == dir[1].st_ino &&
+          after.revalidations == before.revalidations + 1,
+          "revalidated a stale directory (dircache_touch)");
+
+    dircache_get_stats(&before);
+    rv = dir_lookup(dirkey, "thefile", &dirent);
+    dircache_get_stats(&after);
+    check(rv == 0 && after.hits > before.hits &&
+          after.misses == before.misses && after.stale == before.stale,
+          "looked a name up in a revalidated directory without asking s3");
+
+    // another client changes it: revalidation fetches the new contents
+    strcpy(dir[1].name, "renamed");
+    uint8_t *buf = NULL;
+    ssize_t len = s3dir_encode(dir, 2, &buf);
+    check(len > 0 && s3fs_put_object(s3bucket, dirkey, buf, len) == len,
+          "changed the directory behind the cache's back");
+    free(buf);
+    wait_stale();
+    dircache_get_stats(&before);
+    check(dir_lookup(dirkey, "renamed", &dirent) == 0 &&
+          dir_lookup(dirkey, "thefile", &dirent) == -ENOENT,
+          "saw the directory's change once it went stale");
+    dircache_get_stats(&after);
+    check(after.revalidations == before.revalidations,
+          "didn't take the changed directory for unchanged");
+
+    // another client removes it: it is gone, and no longer cached
+    check(s3fs_remove_object(s3bucket, dirkey) == 0,
+          "removed the directory behind the cache's back");
+    wait_stale();
+    int count = 0;
+    s3dirent_t *cached = NULL;
+    char etag[S3FS_ETAG_SIZE];
+    check(dir_lookup(dirkey, "renamed", &dirent) == -ENOENT &&
+          part_load(s3bucket, dirkey, &count, NULL) == NULL &&
+          count == -ENOENT &&
+          dircache_get(dirkey, &cached, &count, etag, NULL) == DIRCACHE_MISS,
+          "saw the directory removed, and dropped it from the cache");
+    free(cached);
+
+    dircache_destroy();
+    s3fs_deinitialize();
+
+    if (failures) {
+        printf("%d directory cache tests failed.\n", failures);
+        return 1;
+    }
+    printf("Done with directory cache tests.  Share and enjoy.\n");
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * dirlock.c, the striped directory locks for the s3fs project.  See
+ * dirlock.h.
+ */
+
+#include <pthread.h>
+#include "dirlock.h"
+
+static pthread_mutex_t stripesG[DIRLOCK_STRIPES];
+static pthread_once_t stripesOnce = PTHREAD_ONCE_INIT;
+
+
+static void init_stripes()
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    int i;
+    for (i = 0; i < DIRLOCK_STRIPES; i++) {
+        pthread_mutex_init(&stripesG[i], &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+}
+
+static unsigned stripe_of(const char *path)
+{
+    pthread_once(&stripesOnce, init_stripes);
+    unsigned hash = 5381;
+    for (; *path; path++) {
+        hash = hash * 33 + (unsigned char) *path;
+    }
+    return hash % DIRLOCK_STRIPES;
+}
+
+
+void dirlock_lock(const char *path)
+{
+    pthread_mutex_lock(&stripesG[stripe_of(path)]);
+}
+
+void dirlock_unlock(const char *path)
+{
+    pthread_mutex_unlock(&stripesG[stripe_of(path)]);
+}
+
+void dirlock_lock2(const char *path, const char *otherpath)
+{
+    unsigned a = stripe_of(path);
+    unsigned b = stripe_of(otherpath);
+    // the lower stripe first, so two threads locking the same pair can't
+    // each hold the lock the other is waiting for
+    pthread_mutex_lock(&stripesG[a < b ? a : b]);
+    if (a != b) {
+        pthread_mutex_lock(&stripesG[a < b ? b : a]);
+    }
+}
+
+void dirlock_unlock2(const char *path, const char *otherpath)
+{
+    unsigned a = stripe_of(path);
+    unsigned b = stripe_of(otherpath);
+    if (a != b) {
+        pthread_mutex_unlock(&stripesG[a < b ? b : a]);
+    }
+    pthread_mutex_unlock(&stripesG[a < b ? a : b]);
+}
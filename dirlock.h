@@ -0,0 +1,36 @@
+/*
+ * Striped directory locks for the s3fs project.
+ *
+ * Every change to a directory is a read-modify-write of its object (or of
+ * one of its shards) on s3, so two changes to the same directory at once
+ * could each undo the other.  Each directory's object key (which, unlike
+ * its path, never changes) hashes to one of a fixed table of locks, and a
+ * change holds its directory's lock from the read to the write.  Changes
+ * to different directories almost always take different locks, so they
+ * (and all reads and writes of file contents, which take none) proceed in
+ * parallel.
+ *
+ * The locks are recursive, so a change may be built out of smaller ones
+ * on the same directory.  Code that needs two directories at once must
+ * take them together with dirlock_lock2, which always locks in the same
+ * order.
+ */
+#ifndef __DIRLOCK_H__
+#define __DIRLOCK_H__
+
+#define DIRLOCK_STRIPES 1024
+
+/*
+ * Lock (or unlock) the directory whose object key is path.
+ */
+void dirlock_lock(const char *path);
+void dirlock_unlock(const char *path);
+
+/*
+ * Lock (or unlock) the directories whose object keys are path and
+ * otherpath, which may be the same, without risk of deadlock.
+ */
+void dirlock_lock2(const char *path, const char *otherpath);
+void dirlock_unlock2(const char *path, const char *otherpath);
+
+#endif // __DIRLOCK_H__
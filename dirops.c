@@ -0,0 +1,805 @@
+/*
+ * dirops.c, the directory operations for the s3fs project.  See dirops.h.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "attrcache.h"
+#include "dircache.h"
+#include "dirlock.h"
+#include "diskcache.h"
+#include "dirops.h"
+#include "libs3_wrapper.h"
+#include "workpool.h"
+
+static char bucketG[BUFFERSIZE]; // the bucket the directories are in
+
+
+void dirops_init(const char *bucket)
+{
+	snprintf(bucketG, sizeof(bucketG), "%s", bucket);
+}
+
+/*
+ * Index the count dirents in dir into *index, unless index is NULL.
+ * Returns 0 on success and -1 if out of memory.
+ */
+static int part_index(const s3dirent_t *dir, int count, s3dir_index_t *index)
+{
+	return index == NULL ? 0 : s3dir_index_build(index, dir, count);
+}
+
+s3dirent_t *part_load(const char *bucket, const char *key, int *count, s3dir_index_t *index)
+{
+	s3dirent_t *dir = NULL;
+	char etag[S3FS_ETAG_SIZE];
+	int cached = dircache_get(key, &dir, count, etag, index);
+	if (cached == DIRCACHE_HIT)
+	{
+		return dir;
+	}
+	uint8_t *disk = NULL;
+	ssize_t disklen = -1;
+	if (cached == DIRCACHE_MISS)//a previous mount may have left a copy on disk
+	{
+		disklen = diskcache_get(bucket, key, DISKCACHE_WHOLE_OBJECT, &disk, etag);
+	}
+	uint8_t *udir = NULL;
+	s3fs_object_info_t info;
+	const char *ifchanged = (cached == DIRCACHE_STALE || disklen >= 0) && etag[0] ? etag : NULL;
+	ssize_t getsuccess = s3fs_get_object_if_changed(bucket, key, &udir, 0, 0, ifchanged, &info);
+	if (ifchanged != NULL && getsuccess < 0 && getsuccess != S3FS_NOT_MODIFIED && getsuccess != S3FS_NOT_FOUND)//a failed revalidation says nothing about the copy, so fetch the object afresh
+	{
+		getsuccess = s3fs_get_object_info(bucket, key, &udir, 0, 0, &info);
+	}
+	if (getsuccess == S3FS_NOT_MODIFIED && disklen >= 0)//the disk copy is still good
+	{
+		*count = s3dir_decode(disk, disklen, &dir);
+		free(disk);
+		if (*count < 0)
+		{
+			diskcache_remove(bucket, key, DISKCACHE_WHOLE_OBJECT);
+			*count = -EIO;
+			return NULL;
+		}
+		if (part_index(dir, *count, index) != 0)
+		{
+			free(dir);
+			*count = -EIO;
+			return NULL;
+		}
+		dircache_put(key, dir, *count, etag, index);
+		return dir;
+	}
+	free(disk);
+	if (getsuccess == S3FS_NOT_MODIFIED)//the cached copy is still good
+	{
+		dircache_touch(key);
+		return dir;
+	}
+	free(dir);
+	dir = NULL;
+	if (index != NULL)//the stale copy's index goes with it
+	{
+		s3dir_index_free(index);
+	}
+	if (getsuccess < 0 && getsuccess != S3FS_NOT_FOUND)//s3 couldn't be read, which says nothing of the copies cached, so they are kept
+	{
+		free(udir);
+		*count = -EIO;
+		return NULL;
+	}
+	*count = -1;
+	if ((int)getsuccess > 0)//even an empty shard has a header
+	{
+		*count = s3dir_decode(udir, getsuccess, &dir);
+	}
+	if (*count >= 0 && info.etag[0])
+	{
+		diskcache_put(bucket, key, DISKCACHE_WHOLE_OBJECT, udir, getsuccess, info.etag);
+	}
+	free(udir);
+	if (*count < 0)//the object is gone, or unreadable, so any cached copy of it is too
+	{
+		if (getsuccess >= 0)
+		{
+			fprintf(stderr, "part_load(key=\"%s\"): unreadable directory object\n", key);
+		}
+		dircache_remove(key);
+		diskcache_remove(bucket, key, DISKCACHE_WHOLE_OBJECT);
+		*count = getsuccess == S3FS_NOT_FOUND ? -ENOENT : -EIO;
+		return NULL;
+	}
+	if (part_index(dir, *count, index) != 0)
+	{
+		free(dir);
+		*count = -EIO;
+		return NULL;
+	}
+	dircache_put(key, dir, *count, info.etag, index);
+	return dir;
+}
+
+/*
+ * Store count dirents as the directory object at key, in s3 and in the
+ * cache.  Returns 0 on success and -EIO on failure.
+ */
+static int part_store(const char *bucket, const char *key, const s3dirent_t *dir, int count)
+{
+	s3fs_object_info_t info;
+	uint8_t *udir = NULL;
+	ssize_t len = s3dir_encode(dir, count, &udir);
+	if (len < 0)
+	{
+		dircache_remove(key);
+		return -EIO;
+	}
+	ssize_t putsuccess = s3fs_put_object_info(bucket, key, udir, len, &info);
+	if ((int)putsuccess < 0 || !info.etag[0])
+	{
+		diskcache_remove(bucket, key, DISKCACHE_WHOLE_OBJECT);
+	}
+	else
+	{
+		diskcache_put(bucket, key, DISKCACHE_WHOLE_OBJECT, udir, len, info.etag);
+	}
+	free(udir);
+	if ((int)putsuccess < 0)
+	{
+		dircache_remove(key); //we no longer know what s3 holds
+		return -EIO;
+	}
+	dircache_put(key, dir, count, info.etag, NULL);
+	return 0;
+}
+
+int dir_shards(const char *bucket, const char *dirkey)
+{
+	s3dirent_t marker;
+	int cached = dircache_lookup(dirkey, S3DIR_SHARDS_NAME, &marker);
+	if (cached == DIRCACHE_MISS)
+	{
+		int count = 0;
+		s3dir_index_t index = { 0, NULL };
+		s3dirent_t *dir = part_load(bucket, dirkey, &count, &index);
+		if (dir == NULL)
+		{
+			return count;
+		}
+		int i = s3dir_index_find(&index, dir, S3DIR_SHARDS_NAME);
+		if (i >= 0)
+		{
+			marker = dir[i];
+		}
+		cached = i >= 0 ? DIRCACHE_HIT : DIRCACHE_ABSENT;
+		s3dir_index_free(&index);
+		free(dir);
+	}
+	return cached == DIRCACHE_HIT ? (int)marker.st_size : 0;
+}
+
+/*
+ * Write the key of the object that holds the dirent called name, in the
+ * directory whose object is at dirkey split into shards shards (0 if it
+ * isn't), to key.
+ */
+static void part_key(char *key, const char *dirkey, int shards, const char *name)
+{
+	if (shards > 0 && strcmp(name, ".") != 0)
+	{
+		s3dir_shard_key(key, S3DIR_KEY_SIZE, dirkey, shards, s3dir_shard_of(name, shards));
+	}
+	else
+	{
+		snprintf(key, S3DIR_KEY_SIZE, "%s", dirkey);
+	}
+}
+
+typedef struct {
+	const char *bucket;
+	const char *dirkey;
+	int shards;
+	s3dirent_t **dirs; //each shard's dirents
+	int *counts;       //and their number
+	int store;         //store the shards rather than load them
+	int failed;
+	pthread_mutex_t lock;
+} shard_io_t;
+
+static void shard_io_item(void *arg, int shard)
+{
+	shard_io_t *io = arg;
+	pthread_mutex_lock(&io->lock);
+	int failed = io->failed;
+	pthread_mutex_unlock(&io->lock);
+	if (failed)//no point going on
+	{
+		return;
+	}
+	char key[S3DIR_KEY_SIZE];
+	s3dir_shard_key(key, sizeof(key), io->dirkey, io->shards, shard);
+	int ok = 0;
+	if (io->store)
+	{
+		ok = part_store(io->bucket, key, io->dirs[shard], io->counts[shard]) == 0;
+	}
+	else
+	{
+		io->dirs[shard] = part_load(io->bucket, key, &io->counts[shard], NULL);
+		ok = io->dirs[shard] != NULL;
+	}
+	if (!ok)
+	{
+		pthread_mutex_lock(&io->lock);
+		io->failed = 1;
+		pthread_mutex_unlock(&io->lock);
+	}
+}
+
+/*
+ * Load (or, if store is set, store) all shards shards of the directory
+ * whose object is at dirkey, from (or to) dirs and counts, a shard to each
+ * of the workers (workpool.h) at once.  Returns 0 on success and -1 if any
+ * shard failed.
+ */
+static int shard_io(const char *bucket, const char *dirkey, int shards, s3dirent_t **dirs, int *counts, int store)
+{
+	shard_io_t io = { bucket, dirkey, shards, dirs, counts, store, 0, PTHREAD_MUTEX_INITIALIZER };
+	workpool_run(shard_io_item, &io, shards);
+	pthread_mutex_destroy(&io.lock);
+	return io.failed ? -1 : 0;
+}
+
+s3dirent_t *dir_load(const char *dirkey, int *count)
+{
+	const char *bucket = bucketG;
+	s3dir_index_t index = { 0, NULL };
+	s3dirent_t *manifest = part_load(bucket, dirkey, count, &index);
+	if (manifest == NULL)
+	{
+		return NULL;
+	}
+	int m = s3dir_index_find(&index, manifest, S3DIR_SHARDS_NAME);
+	s3dir_index_free(&index);
+	if (m < 0)//not split, so this is the whole directory
+	{
+		return manifest;
+	}
+	int shards = (int)manifest[m].st_size;
+	s3dirent_t **dirs = calloc(shards, sizeof(s3dirent_t*));
+	int *counts = calloc(shards, sizeof(int));
+	s3dirent_t *dir = NULL;
+	if (dirs != NULL && counts != NULL && shard_io(bucket, dirkey, shards, dirs, counts, 0) == 0)
+	{
+		int total = 1;
+		int i = 0;
+		for (; i < shards; i++)
+		{
+			total += counts[i];
+		}
+		dir = malloc(sizeof(s3dirent_t) * total);
+		if (dir != NULL)
+		{
+			dir[0] = manifest[0];
+			*count = 1;
+			for (i = 0; i < shards; i++)
+			{
+				memcpy(dir + *count, dirs[i], sizeof(s3dirent_t) * counts[i]);
+				*count += counts[i];
+			}
+		}
+	}
+	int i = 0;
+	for (; dirs != NULL && i < shards; i++)
+	{
+		free(dirs[i]);
+	}
+	free(dirs);
+	free(counts);
+	free(manifest);
+	return dir;
+}
+
+void path_join(char *out, const char *path, const char *name)
+{
+	if (strcmp(name, ".") == 0)
+	{
+		snprintf(out, PATH_MAX, "%s", path);
+	}
+	else
+	{
+		snprintf(out, PATH_MAX, "%s/%s", strcmp(path, "/") == 0 ? "" : path, name);
+	}
+}
+
+int path_split(const char *path, char *parent, char *name)
+{
+	const char *slash = strrchr(path, '/');
+	if (slash == NULL || strcmp(path, "/") == 0)
+	{
+		strcpy(parent, "/");
+		strcpy(name, ".");
+		return 0;
+	}
+	if (strlen(slash + 1) > 255)
+	{
+		return -ENAMETOOLONG;
+	}
+	strcpy(name, slash + 1);
+	size_t len = slash == path ? 1 : (size_t)(slash - path); //keep the / of a child of the root
+	snprintf(parent, PATH_MAX, "%.*s", (int)len, path);
+	return 0;
+}
+
+uint64_t new_ino()
+{
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	static uint64_t seed = 0;
+	static uint64_t counter = 0;
+	pthread_mutex_lock(&lock);
+	if (seed == 0)
+	{
+		FILE *urandom = fopen("/dev/urandom", "r");
+		if (urandom == NULL || fread(&seed, sizeof(seed), 1, urandom) != 1)
+		{
+			seed = (uint64_t)time(NULL) << 32 ^ (uint64_t)getpid();
+		}
+		if (urandom != NULL)
+		{
+			fclose(urandom);
+		}
+		seed |= 1;
+	}
+	uint64_t ino = 0;
+	while (ino <= S3DIR_ROOT_INO)
+	{
+		uint64_t z = seed + ++counter * 0x9e3779b97f4a7c15ULL;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		ino = z ^ (z >> 31);
+	}
+	pthread_mutex_unlock(&lock);
+	return ino;
+}
+
+/*
+ * Drop the cached attributes that a change to the dirent called name, in
+ * the directory at path, makes stale: name's own and the directory's
+ * (whose size counts its dirents).  Call it once the change is made, so a
+ * lookup racing with the change can't cache what it replaced.  With no
+ * path (on the low-level API, which has no attribute cache), nothing.
+ */
+static void attr_forget(const char *path, const char *name)
+{
+	if (path == NULL)
+	{
+		return;
+	}
+	if (strcmp(name, ".") != 0)
+	{
+		char child[PATH_MAX];
+		path_join(child, path, name);
+		attrcache_remove(child);
+	}
+	attrcache_remove(path);
+}
+
+int dir_store(const char *dirkey, const s3dirent_t *dir, int count)
+{
+	dirlock_lock(dirkey);
+	int rv = part_store(bucketG, dirkey, dir, count);
+	dirlock_unlock(dirkey);
+	return rv;
+}
+
+/*
+ * Store the count dirents in dir ("." first) as the directory whose object
+ * is at dirkey, split into enough shards that each is at most half full,
+ * then remove the oldshards shards it was split into before (if any).
+ * Returns 0 on success and -EIO on failure.
+ */
+static int dir_split(const char *bucket, const char *dirkey, const s3dirent_t *dir, int count, int oldshards)
+{
+	int shards = oldshards > 0 ? oldshards * 2 : S3DIR_MIN_SHARDS;
+	while (count > shards * (S3DIR_SHARD_ENTRIES / 2))
+	{
+		shards *= 2;
+	}
+	//STEP 1: DEAL THE DIRENTS OUT TO THEIR SHARDS
+	s3dirent_t **dirs = calloc(shards, sizeof(s3dirent_t*));
+	int *counts = calloc(shards, sizeof(int));
+	int rv = -EIO;
+	int ok = dirs != NULL && counts != NULL;
+	int i = 1;
+	for (; ok && i < count; i++)
+	{
+		counts[s3dir_shard_of(dir[i].name, shards)]++;
+	}
+	for (i = 0; ok && i < shards; i++)
+	{
+		dirs[i] = malloc(sizeof(s3dirent_t) * (counts[i] + 1));
+		ok = dirs[i] != NULL;
+		counts[i] = 0;
+	}
+	for (i = 1; ok && i < count; i++)
+	{
+		int shard = s3dir_shard_of(dir[i].name, shards);
+		dirs[shard][counts[shard]++] = dir[i];
+	}
+	//STEP 2: STORE THE SHARDS, THEN THE MANIFEST THAT SWITCHES THE DIRECTORY OVER TO THEM
+	if (ok && shard_io(bucket, dirkey, shards, dirs, counts, 1) == 0)
+	{
+		s3dirent_t manifest[2];
+		manifest[0] = dir[0];
+		memset(&manifest[1], 0, sizeof(s3dirent_t));
+		manifest[1].type = S3DIR_SHARDS_TYPE;
+		strncpy(manifest[1].name, S3DIR_SHARDS_NAME, 256);
+		manifest[1].st_size = shards;
+		rv = part_store(bucket, dirkey, manifest, 2);
+	}
+	//STEP 3: REMOVE THE OLD SHARDS (A FAILURE HERE ONLY LEAVES UNUSED OBJECTS BEHIND)
+	for (i = 0; rv == 0 && i < oldshards; i++)
+	{
+		char key[S3DIR_KEY_SIZE];
+		s3dir_shard_key(key, sizeof(key), dirkey, oldshards, i);
+		dircache_remove(key);
+		diskcache_remove(bucket, key, DISKCACHE_WHOLE_OBJECT);
+		s3fs_remove_object(bucket, key);
+	}
+	for (i = 0; dirs != NULL && i < shards; i++)
+	{
+		free(dirs[i]);
+	}
+	free(dirs);
+	free(counts);
+	return rv;
+}
+
+/*
+ * dir_add, with dirkey's lock held.
+ */
+static int dir_add_locked(const char *dirkey, const s3dirent_t *dirent)
+{
+	const char *bucket = bucketG;
+	int shards = dir_shards(bucket, dirkey);
+	if (shards < 0)
+	{
+		return shards;
+	}
+	char key[S3DIR_KEY_SIZE];
+	part_key(key, dirkey, shards, dirent->name);
+	int count = 0;
+	s3dir_index_t index = { 0, NULL };
+	s3dirent_t *part = part_load(bucket, key, &count, &index);
+	if (part == NULL)
+	{
+		return shards || count != -ENOENT ? -EIO : -ENOENT;
+	}
+	int exists = s3dir_index_find(&index, part, dirent->name) >= 0;
+	s3dir_index_free(&index);
+	if (exists)
+	{
+		free(part);
+		return -EEXIST;
+	}
+	s3dirent_t *newpart = realloc(part, sizeof(s3dirent_t) * (count + 1));
+	if (newpart == NULL)
+	{
+		free(part);
+		return -EIO;
+	}
+	newpart[count++] = *dirent;
+	if (shards == 0)
+	{
+		newpart[0].st_size = newpart[0].st_size + sizeof(s3dirent_t); //change size of directory
+	}
+	int rv = 0;
+	if (count <= S3DIR_SHARD_ENTRIES)
+	{
+		rv = part_store(bucket, key, newpart, count);
+	}
+	else if (shards == 0)//too big for one object, so split the directory
+	{
+		rv = dir_split(bucket, dirkey, newpart, count, 0);
+	}
+	else//this shard is full, so split the whole directory further
+	{
+		int total = 0;
+		s3dirent_t *dir = dir_load(dirkey, &total);
+		s3dirent_t *newdir = dir ? realloc(dir, sizeof(s3dirent_t) * (total + 1)) : NULL;
+		if (newdir == NULL)
+		{
+			free(dir);
+			rv = -EIO;
+		}
+		else
+		{
+			newdir[total++] = *dirent;
+			rv = dir_split(bucket, dirkey, newdir, total, shards);
+			free(newdir);
+		}
+	}
+	free(newpart);
+	return rv;
+}
+
+int dir_add(const char *path, const char *dirkey, const s3dirent_t *dirent)
+{
+	dirlock_lock(dirkey);
+	int rv = dir_add_locked(dirkey, dirent);
+	attr_forget(path, dirent->name);
+	dirlock_unlock(dirkey);
+	return rv;
+}
+
+/*
+ * dir_delete, with dirkey's lock held.
+ */
+static int dir_delete_locked(const char *dirkey, const char *name)
+{
+	const char *bucket = bucketG;
+	int shards = dir_shards(bucket, dirkey);
+	if (shards < 0)
+	{
+		return shards;
+	}
+	char key[S3DIR_KEY_SIZE];
+	part_key(key, dirkey, shards, name);
+	int count = 0;
+	s3dir_index_t index = { 0, NULL };
+	s3dirent_t *part = part_load(bucket, key, &count, &index);
+	if (part == NULL)
+	{
+		return shards || count != -ENOENT ? -EIO : -ENOENT;
+	}
+	int i = s3dir_index_find(&index, part, name);
+	s3dir_index_free(&index);
+	if (i < 0)
+	{
+		free(part);
+		return -ENOENT;
+	}
+	memmove(part + i, part + i + 1, sizeof(s3dirent_t) * (count - i - 1));
+	count--;
+	if (shards == 0)
+	{
+		part[0].st_size = part[0].st_size - sizeof(s3dirent_t); //change size of directory
+	}
+	int rv = part_store(bucket, key, part, count);
+	free(part);
+	return rv;
+}
+
+int dir_delete(const char *path, const char *dirkey, const char *name)
+{
+	dirlock_lock(dirkey);
+	int rv = dir_delete_locked(dirkey, name);
+	attr_forget(path, name);
+	dirlock_unlock(dirkey);
+	return rv;
+}
+
+/*
+ * dir_update, with dirkey's lock held.
+ */
+static int dir_update_locked(const char *dirkey, const s3dirent_t *dirent)
+{
+	const char *bucket = bucketG;
+	int shards = dir_shards(bucket, dirkey);
+	if (shards < 0)
+	{
+		return shards;
+	}
+	char key[S3DIR_KEY_SIZE];
+	part_key(key, dirkey, shards, dirent->name);
+	int count = 0;
+	s3dir_index_t index = { 0, NULL };
+	s3dirent_t *part = part_load(bucket, key, &count, &index);
+	if (part == NULL)
+	{
+		return shards || count != -ENOENT ? -EIO : -ENOENT;
+	}
+	int i = s3dir_index_find(&index, part, dirent->name);
+	s3dir_index_free(&index);
+	int rv = -ENOENT;
+	if (i >= 0)
+	{
+		part[i] = *dirent;
+		rv = part_store(bucket, key, part, count);
+	}
+	free(part);
+	return rv;
+}
+
+int dir_update(const char *path, const char *dirkey, const s3dirent_t *dirent)
+{
+	dirlock_lock(dirkey);
+	int rv = dir_update_locked(dirkey, dirent);
+	attr_forget(path, dirent->name);
+	dirlock_unlock(dirkey);
+	return rv;
+}
+
+/*
+ * dir_move, with the locks of both dirkey and newdirkey held.
+ */
+static int dir_move_locked(const char *path, const char *dirkey, const char *name, const char *newpath, const char *newdirkey, const s3dirent_t *newdirent)
+{
+	const char *bucket = bucketG;
+	int shards = dir_shards(bucket, dirkey);
+	int newshards = strcmp(dirkey, newdirkey) == 0 ? shards : dir_shards(bucket, newdirkey);
+	if (shards < 0 || newshards < 0)
+	{
+		return shards < 0 ? shards : newshards;
+	}
+	char key[S3DIR_KEY_SIZE];
+	char newkey[S3DIR_KEY_SIZE];
+	part_key(key, dirkey, shards, name);
+	part_key(newkey, newdirkey, newshards, newdirent->name);
+	if (strcmp(key, newkey) != 0)//different objects, so add to one and remove from the other
+	{
+		int rv = dir_add(newpath, newdirkey, newdirent);
+		return rv == 0 ? dir_delete(path, dirkey, name) : rv;
+	}
+	//BOTH NAMES ARE IN THE SAME OBJECT, SO RENAME THE DIRENT IN PLACE WITH ONE PUT
+	int count = 0;
+	s3dir_index_t index = { 0, NULL };
+	s3dirent_t *part = part_load(bucket, key, &count, &index);
+	if (part == NULL)
+	{
+		return shards || count != -ENOENT ? -EIO : -ENOENT;
+	}
+	int i = s3dir_index_find(&index, part, name);
+	int taken = s3dir_index_find(&index, part, newdirent->name) >= 0;
+	s3dir_index_free(&index);
+	int rv = -ENOENT;
+	if (taken)
+	{
+		rv = -EEXIST;
+	}
+	else if (i >= 0)
+	{
+		part[i] = *newdirent;
+		rv = part_store(bucket, key, part, count);
+	}
+	free(part);
+	return rv;
+}
+
+int dir_move(const char *path, const char *dirkey, const char *name, const char *newpath, const char *newdirkey, const s3dirent_t *newdirent)
+{
+	dirlock_lock2(dirkey, newdirkey);
+	int rv = dir_move_locked(path, dirkey, name, newpath, newdirkey, newdirent);
+	attr_forget(path, name);
+	attr_forget(newpath, newdirent->name);
+	dirlock_unlock2(dirkey, newdirkey);
+	return rv;
+}
+
+/*
+ * dir_remove, with dirkey's lock held.
+ */
+static int dir_remove_locked(const char *dirkey)
+{
+	const char *bucket = bucketG;
+	int shards = dir_shards(bucket, dirkey);
+	int i = 0;
+	for (; i < shards; i++)
+	{
+		char key[S3DIR_KEY_SIZE];
+		s3dir_shard_key(key, sizeof(key), dirkey, shards, i);
+		dircache_remove(key);
+		diskcache_remove(bucket, key, DISKCACHE_WHOLE_OBJECT);
+		if (s3fs_remove_object(bucket, key) < 0)
+		{
+			return -EIO;
+		}
+	}
+	dircache_remove(dirkey);
+	diskcache_remove(bucket, dirkey, DISKCACHE_WHOLE_OBJECT);
+	if (s3fs_remove_object(bucket, dirkey) < 0)
+	{
+		return -EIO;
+	}
+	return 0;
+}
+
+int dir_remove(const char *dirkey)
+{
+	dirlock_lock(dirkey);
+	int rv = dir_remove_locked(dirkey);
+	dirlock_unlock(dirkey);
+	return rv;
+}
+
+int dir_lookup(const char *dirkey, const char *name, s3dirent_t *dirent)
+{
+	const char *bucket = bucketG;
+	int shards = dir_shards(bucket, dirkey);
+	if (shards < 0)
+	{
+		return shards;
+	}
+	char key[S3DIR_KEY_SIZE];
+	part_key(key, dirkey, shards, name);
+	int cached = dircache_lookup(key, name, dirent);
+	if (cached == DIRCACHE_HIT)
+	{
+		return 0;
+	}
+	else if (cached == DIRCACHE_ABSENT)
+	{
+		return -ENOENT;
+	}
+	int count = 0;
+	s3dir_index_t index = { 0, NULL };
+	s3dirent_t *part = part_load(bucket, key, &count, &index);
+	if (part == NULL)
+	{
+		return count == -ENOENT ? -ENOENT : -EIO;
+	}
+	int i = s3dir_index_find(&index, part, name);
+	s3dir_index_free(&index);
+	if (i >= 0)
+	{
+		*dirent = part[i];
+	}
+	free(part);
+	return i >= 0 ? 0 : -ENOENT;
+}
+
+int path_lookup(const char *path, s3dirent_t *dirent)
+{
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), S3DIR_ROOT_INO);
+	int rv = dir_lookup(key, ".", dirent);
+	const char *p = path;
+	while (rv == 0)
+	{
+		while (*p == '/')
+		{
+			p++;
+		}
+		size_t len = strcspn(p, "/");
+		if (len == 0)//no components left
+		{
+			return 0;
+		}
+		if (len > 255)
+		{
+			return -ENAMETOOLONG;
+		}
+		if (dirent->type != 'D')
+		{
+			return -ENOTDIR;
+		}
+		char name[256];
+		memcpy(name, p, len);
+		name[len] = '\0';
+		p += len;
+		s3dir_object_key(key, sizeof(key), dirent->st_ino);
+		rv = dir_lookup(key, name, dirent);
+	}
+	return rv;
+}
+
+int dir_key(const char *path, char *dirkey)
+{
+	s3dirent_t dirent;
+	int rv = path_lookup(path, &dirent);
+	if (rv == 0 && dirent.type != 'D')
+	{
+		rv = -ENOTDIR;
+	}
+	if (rv == 0)
+	{
+		s3dir_object_key(dirkey, S3DIR_KEY_SIZE, dirent.st_ino);
+	}
+	return rv == -ENAMETOOLONG ? -ENOENT : rv;
+}
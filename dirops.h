@@ -0,0 +1,171 @@
+/*
+ * Directory operations for the s3fs project.
+ *
+ * Directory objects are read through the in-memory directory cache
+ * (dircache.h), and every change to a directory is written through to
+ * both s3 and the cache, so repeated lookups in the same directory don't
+ * each GET it again.  On s3 they are kept in the compact encoding of
+ * s3dir.h; directories still in the old raw-array form are converted
+ * the next time they change.
+ *
+ * A large directory is split into shards (see s3dir.h) that are cached
+ * and stored separately, so adding, removing or looking up one dirent
+ * only reads and writes the shard that holds it.  The dir_* functions
+ * hide the split from the rest of the filesystem; the part_* functions
+ * work on a single directory object (a whole directory, a manifest or a
+ * shard).
+ *
+ * Every file and directory is stored under a key made from its inode
+ * number (see s3dir.h), not its path, and dirents hold only the names of
+ * their entries.  A path is resolved by looking each component up from
+ * the root down (path_lookup), and the dir_* functions take the object key
+ * of the directory they work on along with its path, which is used only
+ * to drop cached attributes.  Renaming anything, even a directory with a
+ * great deal below it, just moves one dirent.
+ *
+ * FUSE runs the filesystem on many threads at once.  Each dir_* function
+ * that changes a directory holds that directory's lock (dirlock.h) for the
+ * whole read-modify-write, so changes to one directory are applied one at
+ * a time while changes to different directories, lookups and file I/O
+ * all run in parallel.
+ *
+ * All functions are thread-safe.
+ */
+#ifndef __DIROPS_H__
+#define __DIROPS_H__
+
+#include <stdint.h>
+#include "s3fs.h"
+#include "s3dir.h"
+
+/*
+ * Set up the directory operations to work on the directories in bucket.
+ */
+void dirops_init(const char *bucket);
+
+/*
+ * Load the directory object at key, from the cache if it's there and
+ * fresh.  A stale cached copy, or failing that a copy in the disk cache
+ * (diskcache.h), is revalidated with a conditional GET, so it is only
+ * downloaded again if it changed (if the conditional GET fails, the object
+ * is fetched whole, and a cached copy is only dropped if that finds it
+ * gone or unreadable).  Returns a malloc'ed array of dirents (free it when
+ * done) and sets *count to their number; or returns NULL and sets *count
+ * to -ENOENT if there is no such object, and -EIO if it can't be read.
+ * Unless index is NULL, *index is also set to an index of the dirents'
+ * names (release it with s3dir_index_free), taken from the cache along
+ * with them if they were cached, so that finding a name in them costs no
+ * scan.
+ */
+s3dirent_t *part_load(const char *bucket, const char *key, int *count,
+                      s3dir_index_t *index);
+
+/*
+ * Number of shards the directory whose object is at dirkey is split into:
+ * 0 if it isn't, -ENOENT if there is no such directory and -EIO if it
+ * can't be read.
+ */
+int dir_shards(const char *bucket, const char *dirkey);
+
+/*
+ * Load the whole directory whose object is at dirkey: its "." dirent and
+ * then every other dirent, gathered from all its shards at once if it has
+ * been split.  Returns a malloc'ed array of dirents (free it when done)
+ * and sets *count to their number, or returns NULL if the directory
+ * doesn't exist or can't be read.
+ */
+s3dirent_t *dir_load(const char *dirkey, int *count);
+
+/*
+ * Write the path of the entry called name, in the directory at path, to
+ * out (of PATH_MAX bytes); the "." entry's path is the directory's own.
+ */
+void path_join(char *out, const char *path, const char *name);
+
+/*
+ * Split path into the path of its parent directory, written to parent (of
+ * PATH_MAX bytes), and its last component, written to name (of 256 bytes).
+ * The root is its own parent, and its last component is ".".  Returns 0,
+ * or -ENAMETOOLONG if the last component doesn't fit in a dirent.
+ */
+int path_split(const char *path, char *parent, char *name);
+
+/*
+ * A new inode number, for a file or directory being created.  Numbers are
+ * a counter run through the splitmix64 mixer from a random seed, so they
+ * never repeat within a mount and are most unlikely to collide with those
+ * another client hands out.  0 (unset) and the root's are never used.
+ */
+uint64_t new_ino();
+
+/*
+ * Store count dirents as a new, unsplit directory object at dirkey.
+ * Returns 0 on success and -EIO on failure.
+ */
+int dir_store(const char *dirkey, const s3dirent_t *dir, int count);
+
+/*
+ * Add dirent to the directory at path, whose object is at dirkey,
+ * splitting the directory (or splitting it further) if that makes the
+ * object holding it too big.  Returns 0 on success, -ENOENT if there is no
+ * such directory, -EEXIST if it already has a dirent of that name and
+ * -EIO on failure.
+ */
+int dir_add(const char *path, const char *dirkey, const s3dirent_t *dirent);
+
+/*
+ * Remove the dirent called name from the directory at path, whose object
+ * is at dirkey.  Returns 0 on success, -ENOENT if there is no such dirent
+ * and -EIO on failure.
+ */
+int dir_delete(const char *path, const char *dirkey, const char *name);
+
+/*
+ * Replace the dirent of the same name as dirent, in the directory at path
+ * whose object is at dirkey, with dirent.  Returns 0 on success, -ENOENT
+ * if there is no such dirent and -EIO on failure.
+ */
+int dir_update(const char *path, const char *dirkey, const s3dirent_t *dirent);
+
+/*
+ * Move the dirent called name in the directory at path (whose object is
+ * at dirkey) to the directory at newpath (whose object is at newdirkey),
+ * as newdirent (which carries its new name).  Only the dirent moves: what
+ * it names keeps its inode number, so however much lies below a directory,
+ * moving it costs the same.  Returns 0 on success, -ENOENT if either is
+ * missing, -EEXIST if the new name is taken and -EIO on failure.
+ */
+int dir_move(const char *path, const char *dirkey, const char *name,
+             const char *newpath, const char *newdirkey,
+             const s3dirent_t *newdirent);
+
+/*
+ * Remove the directory object at dirkey, and any shards it is split into,
+ * from s3 and the cache.  Returns 0 on success and -EIO on failure.
+ */
+int dir_remove(const char *dirkey);
+
+/*
+ * Copy the dirent called name in the directory whose object is at dirkey
+ * to *dirent.  Returns 0 if it was found and -ENOENT if not (or if there
+ * is no such directory).
+ */
+int dir_lookup(const char *dirkey, const char *name, s3dirent_t *dirent);
+
+/*
+ * Copy the dirent for path to *dirent, looking each component up in turn
+ * from the root down (the root's is its own "." dirent).  The directories
+ * along the way are usually all cached, so this seldom costs a request.
+ * Returns 0 if it was found, -ENOENT if not, -ENOTDIR if a component
+ * before the last is a file and -ENAMETOOLONG if one is too long.
+ */
+int path_lookup(const char *path, s3dirent_t *dirent);
+
+/*
+ * Write the object key of the directory at path to dirkey (of
+ * S3DIR_KEY_SIZE bytes).  Returns 0 on success, or -ENOENT or -ENOTDIR
+ * if there is no directory at path.
+ */
+int dir_key(const char *path, char *dirkey);
+
+#endif // __DIROPS_H__
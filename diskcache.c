@@ -0,0 +1,562 @@
+/*
+ * diskcache.c, the persistent local-disk object cache for the s3fs
+ * project.  See diskcache.h.
+ *
+ * The cache directory holds 256 subdirectories, 00 to ff, and each entry
+ * is the file <subdir>/<id>, where id is a 64-bit hash of the entry's
+ * bucket, key and block number (and subdir is its top byte).  A file is a
+ * file_header, the bucket, key and ETag strings, and then the data.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "diskcache.h"
+#include "libs3_wrapper.h"
+
+#define DISKCACHE_BUCKETS 65536
+#define DISKCACHE_MAGIC "S3FC"
+#define DISKCACHE_VERSION 1
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t block;
+    uint64_t length;   // bytes of data
+    uint32_t checksum; // CRC-32 of the data
+    uint16_t bucketLen;
+    uint16_t keyLen;
+    uint16_t etagLen;
+    uint16_t unused;
+} file_header;
+
+typedef struct entry
+{
+    uint64_t id;
+    char *bucket;
+    char *key;
+    uint64_t block;
+    uint64_t size;             // bytes of the file
+    time_t used;               // the file's mtime, when recovered
+    struct entry *hashNext;    // next entry in the hash bucket
+    struct entry *lruPrev;     // more recently used
+    struct entry *lruNext;     // less recently used
+} entry;
+
+static char *dirG = NULL; // NULL while the cache is off
+static uint64_t maxBytesG = DISKCACHE_DEFAULT_MAX_BYTES;
+static entry *bucketsG[DISKCACHE_BUCKETS];
+static entry *lruHeadG = NULL; // most recently used
+static entry *lruTailG = NULL; // least recently used
+static diskcache_stats_t statsG;
+static uint32_t crcTableG[256];
+static unsigned tempCounterG = 0;
+static pthread_mutex_t diskcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// util ----------------------------------------------------------------------
+
+static void crc_init()
+{
+    uint32_t i;
+    for (i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        int bit;
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320u : 0);
+        }
+        crcTableG[i] = crc;
+    }
+}
+
+static uint32_t crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xffffffffu;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        crc = crcTableG[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
+
+// 64-bit FNV-1a of bucket, key and block
+static uint64_t entry_id(const char *bucket, const char *key, uint64_t block)
+{
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char *p;
+    for (p = (const unsigned char *) bucket; ; p++) {
+        hash = (hash ^ *p) * 1099511628211ull;
+        if (!*p) {
+            break;
+        }
+    }
+    for (p = (const unsigned char *) key; ; p++) {
+        hash = (hash ^ *p) * 1099511628211ull;
+        if (!*p) {
+            break;
+        }
+    }
+    int i;
+    for (i = 0; i < 8; i++) {
+        hash = (hash ^ ((block >> (8 * i)) & 0xff)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static void entry_path(char *path, size_t size, uint64_t id)
+{
+    snprintf(path, size, "%s/%02x/%016llx", dirG, (unsigned) (id >> 56),
+             (unsigned long long) id);
+}
+
+// Read exactly len bytes; returns 0 on success and -1 on error or EOF.
+static int read_full(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// index ---------------------------------------------------------------------
+
+// Find an entry; with the lock held.
+static entry *find_entry(uint64_t id, const char *bucket, const char *key,
+                         uint64_t block)
+{
+    entry *e = bucketsG[id % DISKCACHE_BUCKETS];
+    while (e && (e->id != id || e->block != block ||
+                 strcmp(e->key, key) || strcmp(e->bucket, bucket))) {
+        e = e->hashNext;
+    }
+    return e;
+}
+
+// Find an entry by id alone (two entries never share a file); with the
+// lock held.
+static entry *find_id(uint64_t id)
+{
+    entry *e = bucketsG[id % DISKCACHE_BUCKETS];
+    while (e && e->id != id) {
+        e = e->hashNext;
+    }
+    return e;
+}
+
+static void lru_unlink(entry *e)
+{
+    if (e->lruPrev) {
+        e->lruPrev->lruNext = e->lruNext;
+    }
+    else {
+        lruHeadG = e->lruNext;
+    }
+    if (e->lruNext) {
+        e->lruNext->lruPrev = e->lruPrev;
+    }
+    else {
+        lruTailG = e->lruPrev;
+    }
+    e->lruPrev = e->lruNext = NULL;
+}
+
+static void lru_push(entry *e)
+{
+    e->lruPrev = NULL;
+    e->lruNext = lruHeadG;
+    if (lruHeadG) {
+        lruHeadG->lruPrev = e;
+    }
+    lruHeadG = e;
+    if (!lruTailG) {
+        lruTailG = e;
+    }
+}
+
+static void free_entry(entry *e)
+{
+    free(e->bucket);
+    free(e->key);
+    free(e);
+}
+
+// Add an entry to the index (but not the LRU list); with the lock held.
+static void add_entry(entry *e)
+{
+    unsigned bucket = e->id % DISKCACHE_BUCKETS;
+    e->hashNext = bucketsG[bucket];
+    bucketsG[bucket] = e;
+    statsG.bytes += e->size;
+    statsG.entries++;
+}
+
+// Drop an entry from the index, and its file from disk if unlinkFile is
+// set; with the lock held.
+static void drop_entry(entry *e, int unlinkFile)
+{
+    entry **slot = &bucketsG[e->id % DISKCACHE_BUCKETS];
+    while (*slot != e) {
+        slot = &(*slot)->hashNext;
+    }
+    *slot = e->hashNext;
+    lru_unlink(e);
+    statsG.bytes -= e->size;
+    statsG.entries--;
+    if (unlinkFile) {
+        char path[PATH_MAX];
+        entry_path(path, sizeof(path), e->id);
+        unlink(path);
+    }
+    free_entry(e);
+}
+
+// Evict the least recently used entries until the cache fits; with the
+// lock held.
+static void evict()
+{
+    while (lruTailG && statsG.bytes > maxBytesG) {
+        drop_entry(lruTailG, 1);
+        statsG.evictions++;
+    }
+}
+
+// recovery ------------------------------------------------------------------
+
+// Read and check the header of the entry file at path.  Returns a new
+// (unindexed) entry, or NULL if the file is damaged or unfinished.
+static entry *recover_file(const char *path, uint64_t id)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    file_header header;
+    entry *e = calloc(1, sizeof(entry));
+    int ok = e && fstat(fd, &st) == 0 &&
+        read_full(fd, &header, sizeof(header)) == 0 &&
+        !memcmp(header.magic, DISKCACHE_MAGIC, 4) &&
+        header.version == DISKCACHE_VERSION &&
+        (uint64_t) st.st_size == sizeof(header) + header.bucketLen +
+        header.keyLen + header.etagLen + header.length;
+    if (ok) {
+        e->bucket = calloc(1, header.bucketLen + 1);
+        e->key = calloc(1, header.keyLen + 1);
+        ok = e->bucket && e->key &&
+            read_full(fd, e->bucket, header.bucketLen) == 0 &&
+            read_full(fd, e->key, header.keyLen) == 0 &&
+            entry_id(e->bucket, e->key, header.block) == id;
+    }
+    close(fd);
+    if (!ok) {
+        if (e) {
+            free_entry(e);
+        }
+        return NULL;
+    }
+    e->id = id;
+    e->block = header.block;
+    e->size = st.st_size;
+    e->used = st.st_mtime;
+    return e;
+}
+
+static int by_use(const void *a, const void *b)
+{
+    const entry *ea = *(entry * const *) a, *eb = *(entry * const *) b;
+    return ea->used < eb->used ? -1 : ea->used > eb->used;
+}
+
+// Rebuild the index from the files in the cache directory; with the lock
+// held.
+static void recover()
+{
+    char path[PATH_MAX];
+    entry **found = NULL;
+    size_t count = 0, capacity = 0;
+
+    // temporary files are writes that never finished
+    DIR *dir = opendir(dirG);
+    struct dirent *de;
+    while (dir && (de = readdir(dir))) {
+        if (!strncmp(de->d_name, "tmp.", 4)) {
+            snprintf(path, sizeof(path), "%s/%s", dirG, de->d_name);
+            unlink(path);
+            statsG.discarded++;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+
+    int sub;
+    for (sub = 0; sub < 256; sub++) {
+        char subdir[PATH_MAX];
+        snprintf(subdir, sizeof(subdir), "%s/%02x", dirG, sub);
+        dir = opendir(subdir);
+        while (dir && (de = readdir(dir))) {
+            if (de->d_name[0] == '.') {
+                continue;
+            }
+            snprintf(path, sizeof(path), "%s/%s", subdir, de->d_name);
+            char *end;
+            uint64_t id = strtoull(de->d_name, &end, 16);
+            entry *e = *end ? NULL : recover_file(path, id);
+            if (!e || find_id(id)) {
+                unlink(path);
+                statsG.discarded++;
+                if (e) {
+                    free_entry(e);
+                }
+                continue;
+            }
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 1024;
+                entry **grown = realloc(found, capacity * sizeof(entry *));
+                if (!grown) {
+                    free_entry(e);
+                    break;
+                }
+                found = grown;
+            }
+            found[count++] = e;
+            add_entry(e);
+        }
+        if (dir) {
+            closedir(dir);
+        }
+    }
+
+    // oldest first, so the most recently used end up at the head
+    qsort(found, count, sizeof(entry *), by_use);
+    size_t i;
+    for (i = 0; i < count; i++) {
+        lru_push(found[i]);
+    }
+    free(found);
+    statsG.recovered = count;
+    evict();
+}
+
+// ---------------------------------------------------------------------------
+
+int diskcache_init(const char *dir, uint64_t max_bytes)
+{
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    int sub;
+    for (sub = 0; sub < 256; sub++) {
+        char subdir[PATH_MAX];
+        snprintf(subdir, sizeof(subdir), "%s/%02x", dir, sub);
+        if (mkdir(subdir, 0700) < 0 && errno != EEXIST) {
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&diskcache_lock);
+    crc_init();
+    free(dirG);
+    dirG = strdup(dir);
+    maxBytesG = max_bytes;
+    if (dirG) {
+        recover();
+    }
+    pthread_mutex_unlock(&diskcache_lock);
+    return dirG ? 0 : -1;
+}
+
+void diskcache_destroy()
+{
+    pthread_mutex_lock(&diskcache_lock);
+    while (lruHeadG) {
+        drop_entry(lruHeadG, 0);
+    }
+    free(dirG);
+    dirG = NULL;
+    pthread_mutex_unlock(&diskcache_lock);
+}
+
+ssize_t diskcache_get(const char *bucket, const char *key, uint64_t block,
+                      uint8_t **buf, char *etag)
+{
+    uint64_t id = entry_id(bucket, key, block);
+    char path[PATH_MAX];
+    pthread_mutex_lock(&diskcache_lock);
+    entry *e = dirG ? find_entry(id, bucket, key, block) : NULL;
+    if (!e) {
+        if (dirG) {
+            statsG.misses++;
+        }
+        pthread_mutex_unlock(&diskcache_lock);
+        return -1;
+    }
+    lru_unlink(e);
+    lru_push(e);
+    entry_path(path, sizeof(path), id);
+    uint64_t size = e->size;
+    pthread_mutex_unlock(&diskcache_lock);
+
+    // read and check the whole file outside the lock
+    uint8_t *file = malloc(size ? size : 1);
+    int fd = open(path, O_RDONLY);
+    int ok = file && fd >= 0 && read_full(fd, file, size) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    file_header header;
+    if (ok) {
+        memcpy(&header, file, sizeof(header));
+        const char *strings = (const char *) file + sizeof(header);
+        ok = size >= sizeof(header) &&
+            size == sizeof(header) + header.bucketLen + header.keyLen +
+            header.etagLen + header.length &&
+            header.block == block && header.etagLen < S3FS_ETAG_SIZE &&
+            header.bucketLen == strlen(bucket) &&
+            header.keyLen == strlen(key) &&
+            !memcmp(strings, bucket, header.bucketLen) &&
+            !memcmp(strings + header.bucketLen, key, header.keyLen) &&
+            crc32(file + size - header.length, header.length) ==
+            header.checksum;
+    }
+    if (!ok) {
+        // damaged, or replaced under us; either way it's of no use
+        free(file);
+        pthread_mutex_lock(&diskcache_lock);
+        e = find_entry(id, bucket, key, block);
+        if (e) {
+            drop_entry(e, 1);
+        }
+        statsG.misses++;
+        pthread_mutex_unlock(&diskcache_lock);
+        return -1;
+    }
+
+    memcpy(etag, (char *) file + sizeof(header) + header.bucketLen +
+           header.keyLen, header.etagLen);
+    etag[header.etagLen] = '\0';
+    memmove(file, file + size - header.length, header.length);
+    *buf = file;
+    utimensat(AT_FDCWD, path, NULL, 0); // recency survives a remount
+
+    pthread_mutex_lock(&diskcache_lock);
+    statsG.hits++;
+    pthread_mutex_unlock(&diskcache_lock);
+    return header.length;
+}
+
+void diskcache_put(const char *bucket, const char *key, uint64_t block,
+                   const uint8_t *buf, size_t len, const char *etag)
+{
+    pthread_mutex_lock(&diskcache_lock);
+    if (!dirG || len > maxBytesG) {
+        pthread_mutex_unlock(&diskcache_lock);
+        return;
+    }
+    uint64_t id = entry_id(bucket, key, block);
+    char path[PATH_MAX], temp[PATH_MAX];
+    entry_path(path, sizeof(path), id);
+    snprintf(temp, sizeof(temp), "%s/tmp.%016llx.%u", dirG,
+             (unsigned long long) id, tempCounterG++);
+    pthread_mutex_unlock(&diskcache_lock);
+
+    entry *e = calloc(1, sizeof(entry));
+    if (e) {
+        e->bucket = strdup(bucket);
+        e->key = strdup(key);
+    }
+    if (!e || !e->bucket || !e->key) {
+        if (e) {
+            free_entry(e);
+        }
+        return;
+    }
+
+    // write to a temporary file and rename it into place, so the entry's
+    // file is always either whole or absent
+    file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DISKCACHE_MAGIC, 4);
+    header.version = DISKCACHE_VERSION;
+    header.block = block;
+    header.length = len;
+    header.checksum = crc32(buf, len);
+    header.bucketLen = strlen(bucket);
+    header.keyLen = strlen(key);
+    header.etagLen = strlen(etag);
+    struct iovec iov[5] = {
+        { &header, sizeof(header) },
+        { (void *) bucket, header.bucketLen },
+        { (void *) key, header.keyLen },
+        { (void *) etag, header.etagLen },
+        { (void *) buf, len }
+    };
+    size_t total = sizeof(header) + header.bucketLen + header.keyLen +
+        header.etagLen + len;
+    int fd = open(temp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    int ok = fd >= 0 && writev(fd, iov, 5) == (ssize_t) total;
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!ok || rename(temp, path) < 0) {
+        unlink(temp);
+        free_entry(e);
+        return;
+    }
+
+    pthread_mutex_lock(&diskcache_lock);
+    if (!dirG) {
+        pthread_mutex_unlock(&diskcache_lock);
+        free_entry(e);
+        return;
+    }
+    entry *old = find_id(id);
+    if (old) {
+        drop_entry(old, 0); // its file was just replaced
+    }
+    e->id = id;
+    e->block = block;
+    e->size = total;
+    add_entry(e);
+    lru_push(e);
+    statsG.writes++;
+    evict();
+    pthread_mutex_unlock(&diskcache_lock);
+}
+
+void diskcache_remove(const char *bucket, const char *key, uint64_t block)
+{
+    pthread_mutex_lock(&diskcache_lock);
+    entry *e = dirG ? find_entry(entry_id(bucket, key, block), bucket, key,
+                                 block) : NULL;
+    if (e) {
+        drop_entry(e, 1);
+    }
+    pthread_mutex_unlock(&diskcache_lock);
+}
+
+void diskcache_get_stats(diskcache_stats_t *stats)
+{
+    pthread_mutex_lock(&diskcache_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&diskcache_lock);
+}
@@ -0,0 +1,87 @@
+/*
+ * Persistent cache of objects on local disk for the s3fs project.
+ *
+ * An optional cache directory, meant for a fast local disk, that holds
+ * file blocks (for the block cache, blockcache.h) and whole directory
+ * objects across mounts.  Each entry is keyed by bucket, key and block
+ * number, and records the ETag the object had when it was cached, so a
+ * caller can check it against s3 (a HEAD or a conditional GET) before
+ * first trusting it.
+ *
+ * Every entry is a file of its own, written to a temporary name and then
+ * renamed into place, whose header names the entry and checksums its
+ * data.  The index is rebuilt at startup by scanning those headers, so a
+ * crash can at worst lose entries, never serve a torn one; files that
+ * don't check out are deleted.  Recency is kept in the files' mtimes, and
+ * the least recently used entries are evicted to keep the cache under its
+ * size cap.
+ *
+ * All functions are thread-safe, and do nothing until diskcache_init has
+ * succeeded.
+ */
+#ifndef __DISKCACHE_H__
+#define __DISKCACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define DISKCACHE_DEFAULT_MAX_BYTES ((uint64_t) 1024 * 1024 * 1024)
+
+/*
+ * The block number under which a whole object (rather than one of its
+ * blocks) is cached.
+ */
+#define DISKCACHE_WHOLE_OBJECT UINT64_MAX
+
+typedef struct {
+    uint64_t hits;       // entries read from disk
+    uint64_t misses;     // lookups that found no (readable) entry
+    uint64_t writes;     // entries written
+    uint64_t evictions;  // entries dropped to stay under the size cap
+    uint64_t recovered;  // entries found on disk at startup
+    uint64_t discarded;  // files found damaged or unfinished at startup
+    uint64_t bytes;      // disk space used by entries
+    int entries;         // number of entries
+} diskcache_stats_t;
+
+/*
+ * Open (creating it if need be) the cache in directory dir, holding at
+ * most max_bytes, and recover the entries already there.  Returns 0 on
+ * success and -1 on failure (the cache then stays off).
+ */
+int diskcache_init(const char *dir, uint64_t max_bytes);
+
+/*
+ * Close the cache.  Its entries stay on disk for the next mount.
+ */
+void diskcache_destroy();
+
+/*
+ * Look up block number block (or DISKCACHE_WHOLE_OBJECT) of key in
+ * bucket.  On a hit, sets *buf to a malloc'ed copy of its data (which the
+ * caller must free) and etag (S3FS_ETAG_SIZE bytes) to the ETag it was
+ * cached with, and returns the data's length.  Returns -1 on a miss.
+ */
+ssize_t diskcache_get(const char *bucket, const char *key, uint64_t block,
+                      uint8_t **buf, char *etag);
+
+/*
+ * Cache len bytes at buf as block number block (or
+ * DISKCACHE_WHOLE_OBJECT) of key in bucket, fetched when the object had
+ * the ETag etag, replacing any entry it had.
+ */
+void diskcache_put(const char *bucket, const char *key, uint64_t block,
+                   const uint8_t *buf, size_t len, const char *etag);
+
+/*
+ * Drop block number block (or DISKCACHE_WHOLE_OBJECT) of key in bucket.
+ */
+void diskcache_remove(const char *bucket, const char *key, uint64_t block);
+
+/*
+ * Copy the cache's counters to *stats.
+ */
+void diskcache_get_stats(diskcache_stats_t *stats);
+
+#endif // __DISKCACHE_H__
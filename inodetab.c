@@ -0,0 +1,133 @@
+/*
+ * inodetab.c, the in-memory inode table for the s3fs project.  See
+ * inodetab.h.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "inodetab.h"
+
+#define INODETAB_BUCKETS 65536
+
+typedef struct inodetab_entry
+{
+    inodetab_node_t node;
+    uint64_t nlookup;                 // references the kernel holds
+    struct inodetab_entry *hashNext;  // next entry in the hash bucket
+} inodetab_entry;
+
+static inodetab_entry *bucketsG[INODETAB_BUCKETS];
+static inodetab_stats_t statsG;
+static pthread_mutex_t inodetab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static unsigned hash_ino(uint64_t ino)
+{
+    // inode numbers are already well mixed (see new_ino in dirops.c)
+    return (unsigned) (ino ^ (ino >> 32)) % INODETAB_BUCKETS;
+}
+
+// Find ino's entry; with the lock held.
+static inodetab_entry *find_entry(uint64_t ino)
+{
+    inodetab_entry *entry = bucketsG[hash_ino(ino)];
+    while (entry && entry->node.ino != ino) {
+        entry = entry->hashNext;
+    }
+    return entry;
+}
+
+// Unlink and free an entry; with the lock held.
+static void drop_entry(inodetab_entry *entry)
+{
+    inodetab_entry **slot = &bucketsG[hash_ino(entry->node.ino)];
+    while (*slot != entry) {
+        slot = &(*slot)->hashNext;
+    }
+    *slot = entry->hashNext;
+
+    statsG.entries--;
+    free(entry);
+}
+
+
+void inodetab_destroy()
+{
+    pthread_mutex_lock(&inodetab_lock);
+    unsigned bucket;
+    for (bucket = 0; bucket < INODETAB_BUCKETS; bucket++) {
+        while (bucketsG[bucket]) {
+            drop_entry(bucketsG[bucket]);
+        }
+    }
+    pthread_mutex_unlock(&inodetab_lock);
+}
+
+void inodetab_lookup(const inodetab_node_t *node)
+{
+    pthread_mutex_lock(&inodetab_lock);
+    statsG.lookups++;
+    inodetab_entry *entry = find_entry(node->ino);
+    if (!entry) {
+        entry = calloc(1, sizeof(inodetab_entry));
+        if (!entry) {
+            // the kernel will still use the node, but the table can't help
+            pthread_mutex_unlock(&inodetab_lock);
+            return;
+        }
+        unsigned bucket = hash_ino(node->ino);
+        entry->hashNext = bucketsG[bucket];
+        bucketsG[bucket] = entry;
+        statsG.entries++;
+    }
+    entry->node = *node;
+    entry->nlookup++;
+    pthread_mutex_unlock(&inodetab_lock);
+}
+
+void inodetab_forget(uint64_t ino, uint64_t nlookup)
+{
+    pthread_mutex_lock(&inodetab_lock);
+    statsG.forgets += nlookup;
+    inodetab_entry *entry = find_entry(ino);
+    if (entry) {
+        if (entry->nlookup <= nlookup) {
+            drop_entry(entry);
+        }
+        else {
+            entry->nlookup -= nlookup;
+        }
+    }
+    pthread_mutex_unlock(&inodetab_lock);
+}
+
+int inodetab_get(uint64_t ino, inodetab_node_t *node)
+{
+    pthread_mutex_lock(&inodetab_lock);
+    inodetab_entry *entry = find_entry(ino);
+    if (entry) {
+        *node = entry->node;
+    }
+    else {
+        statsG.misses++;
+    }
+    pthread_mutex_unlock(&inodetab_lock);
+    return entry ? 0 : -1;
+}
+
+void inodetab_update(const inodetab_node_t *node)
+{
+    pthread_mutex_lock(&inodetab_lock);
+    inodetab_entry *entry = find_entry(node->ino);
+    if (entry) {
+        entry->node = *node;
+    }
+    pthread_mutex_unlock(&inodetab_lock);
+}
+
+void inodetab_get_stats(inodetab_stats_t *stats)
+{
+    pthread_mutex_lock(&inodetab_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&inodetab_lock);
+}
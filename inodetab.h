@@ -0,0 +1,73 @@
+/*
+ * In-memory inode table for the s3fs project's low-level FUSE backend.
+ *
+ * On the low-level API the kernel names files and directories by node ID
+ * rather than by path, and s3fs uses each one's inode number (see
+ * s3dir.h) as its node ID.  A directory's attributes and dirents live
+ * under its own inode number, so the node ID is all it takes to find
+ * them.  A file's attributes live in its dirent, in its parent directory,
+ * so for each node the kernel holds the table keeps the inode number of
+ * the directory holding its dirent and a copy of that dirent, as of the
+ * last lookup or change.
+ *
+ * The kernel counts the lookups it has been answered for each node, and
+ * forgets them again when it drops the node from its caches; the table
+ * keeps the same count, and drops a node once it reaches zero.  The root
+ * is never looked up, so it is never in the table (nor needs to be).
+ *
+ * All functions are thread-safe.
+ */
+#ifndef __INODETAB_H__
+#define __INODETAB_H__
+
+#include <stdint.h>
+#include "s3fs.h"
+
+typedef struct {
+    uint64_t ino;       // the node's inode number, and node ID
+    uint64_t parent;    // inode number of the directory holding its dirent
+    s3dirent_t dirent;  // its dirent there
+} inodetab_node_t;
+
+typedef struct {
+    uint64_t lookups; // references taken by the kernel
+    uint64_t forgets; // references dropped by the kernel
+    uint64_t misses;  // gets of nodes not in the table
+    int entries;      // number of nodes in the table
+} inodetab_stats_t;
+
+/*
+ * Drop every node and release the table.
+ */
+void inodetab_destroy();
+
+/*
+ * Count a lookup of node, which the kernel now holds a reference to,
+ * adding it to the table or refreshing the copy there.
+ */
+void inodetab_lookup(const inodetab_node_t *node);
+
+/*
+ * Drop nlookup of the references to inode number ino, and the node itself
+ * once none are left.
+ */
+void inodetab_forget(uint64_t ino, uint64_t nlookup);
+
+/*
+ * Copy the node with inode number ino to *node.  Returns 0 if it is in
+ * the table and -1 if not.
+ */
+int inodetab_get(uint64_t ino, inodetab_node_t *node);
+
+/*
+ * Refresh the copy of node in the table, after a change to its dirent or
+ * a move to another directory, if it is there.
+ */
+void inodetab_update(const inodetab_node_t *node);
+
+/*
+ * Copy the table's counters to *stats.
+ */
+void inodetab_get_stats(inodetab_stats_t *stats);
+
+#endif // __INODETAB_H__
@@ -40,13 +40,17 @@
  **/
 
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -56,26 +60,22 @@
 #include "libs3_wrapper.h"
 
 
-// Some Unix stuff (to work around Windows issues)
-#ifndef SLEEP_UNITS_PER_SECOND
-#define SLEEP_UNITS_PER_SECOND 1
-#endif
-
-// prototype declarations
-int __s3fs_test_bucket(const char *bucketName);
-int __s3fs_clear_bucket(const char *bucketName);
-int __s3fs_remove_object(const char *bucketName, const char *key);
-ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf, ssize_t start_byte, ssize_t byte_count);
-ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength); 
-
-
 // Command-line options, saved as globals ------------------------------------
 
 // static int forceG = 0;
 static int showResponsePropertiesG = 0;
 static S3Protocol protocolG = S3ProtocolHTTPS;
 static S3UriStyle uriStyleG = S3UriStylePath;
-static int retriesG = 5;
+static int retryAttemptsG = S3FS_DEFAULT_RETRY_ATTEMPTS;
+static int retryBaseDelayG = S3FS_DEFAULT_RETRY_BASE_DELAY;
+static int retryMaxDelayG = S3FS_DEFAULT_RETRY_MAX_DELAY;
+static int retryDeadlineG = S3FS_DEFAULT_RETRY_DEADLINE;
+static uint64_t multipartThresholdG = S3FS_DEFAULT_MULTIPART_THRESHOLD;
+static uint64_t multipartPartSizeG = S3FS_DEFAULT_MULTIPART_PART_SIZE;
+static int multipartConcurrencyG = S3FS_DEFAULT_MULTIPART_CONCURRENCY;
+static int multipartRetriesG = S3FS_DEFAULT_MULTIPART_RETRIES;
+static uint64_t stripeSizeG = S3FS_DEFAULT_STRIPE_SIZE;
+static int stripeConcurrencyG = S3FS_DEFAULT_STRIPE_CONCURRENCY;
 
 
 // Environment variables, saved as globals ----------------------------------
@@ -84,28 +84,33 @@ static const char *accessKeyIdG = 0;
 static const char *secretAccessKeyG = 0;
 
 
-// Request results, saved as globals -----------------------------------------
-
-static int statusG = 0;
-static char errorDetailsG[4096] = { 0 };
+// Request results, saved per request ---------------------------------------
 
+// The callbackData of every request starts with one of these, so the shared
+// response callbacks below can record a request's outcome without touching
+// any globals.
+typedef struct request_result
+{
+    int completed; // set once libs3 has reported the request's outcome
+    S3Status status;
+    char errorDetails[4096];
+    s3fs_object_info_t info;
+} request_result;
 
 
-// Option prefixes -----------------------------------------------------------
-
-// s3fs Global lock
-
-static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
-
-void s3fs_lock() {
-    pthread_mutex_lock(&global_lock);
-}
+// Request context pool ------------------------------------------------------
 
-void s3fs_unlock() {
-    pthread_mutex_unlock(&global_lock);
-}
+// libs3 is initialized once, by s3fs_initialize().  Each request is run on
+// an S3RequestContext checked out of this pool; a context owns a curl multi
+// handle, so its connections stay open from one request to the next.  At
+// most poolSizeG requests are in flight at once; further callers wait for
+// a context to be returned.
 
-// --------------------------------------------------------
+static S3RequestContext **poolG = NULL;
+static int poolSizeG = 0;
+static int poolFreeG = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
 
 
 #define LOCATION_PREFIX "location="
@@ -181,52 +186,269 @@ int s3fs_init_credentials() {
     return 0;
 }
 
-static void S3_init()
-{
+int s3fs_initialize(int max_requests) {
     S3Status status;
     const char *hostname = getenv("S3_HOSTNAME");
-    
+    const char *protocol = getenv("S3_PROTOCOL");
+
+    if (protocol && !strcasecmp(protocol, "http")) {
+        protocolG = S3ProtocolHTTP;
+    }
+
     if ((status = S3_initialize("s3", S3_INIT_ALL, hostname))
         != S3StatusOK) {
         fprintf(stderr, "Failed to initialize libs3: %s\n", 
                 S3_get_status_name(status));
-        exit(-1);
+        return -1;
+    }
+
+    if (max_requests <= 0) {
+        max_requests = S3FS_DEFAULT_MAX_REQUESTS;
+    }
+    poolG = calloc(max_requests, sizeof(S3RequestContext *));
+    if (!poolG) {
+        S3_deinitialize();
+        return -1;
+    }
+    for (poolSizeG = 0; poolSizeG < max_requests; poolSizeG++) {
+        status = S3_create_request_context(&(poolG[poolSizeG]));
+        if (status != S3StatusOK) {
+            fprintf(stderr, "Failed to create request context: %s\n",
+                    S3_get_status_name(status));
+            s3fs_deinitialize();
+            return -1;
+        }
     }
+    poolFreeG = poolSizeG;
+    return 0;
 }
 
-static void printError()
+void s3fs_deinitialize() {
+    int i;
+    for (i = 0; i < poolSizeG; i++) {
+        S3_destroy_request_context(poolG[i]);
+    }
+    free(poolG);
+    poolG = NULL;
+    poolSizeG = poolFreeG = 0;
+    S3_deinitialize();
+}
+
+static S3RequestContext *acquire_context()
 {
-    if (statusG < S3StatusErrorAccessDenied) {
-        fprintf(stderr, "\nERROR: %s\n", S3_get_status_name(statusG));
+    pthread_mutex_lock(&pool_lock);
+    while (poolFreeG == 0) {
+        pthread_cond_wait(&pool_cond, &pool_lock);
+    }
+    S3RequestContext *requestContext = poolG[--poolFreeG];
+    pthread_mutex_unlock(&pool_lock);
+    return requestContext;
+}
+
+static void release_context(S3RequestContext *requestContext)
+{
+    pthread_mutex_lock(&pool_lock);
+    poolG[poolFreeG++] = requestContext;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Reset result before (re)issuing a request.
+static void init_result(request_result *result)
+{
+    result->completed = 0;
+    result->status = S3StatusInternalError;
+    result->errorDetails[0] = 0;
+    result->info.content_length = -1;
+    result->info.last_modified = -1;
+    result->info.etag[0] = 0;
+}
+
+// Drive the request just added to requestContext until it completes.
+static void run_context(S3RequestContext *requestContext,
+                        request_result *result)
+{
+    S3Status status = S3_runall_request_context(requestContext);
+    if (status != S3StatusOK) {
+        result->status = status;
+        result->completed = 1;
+    }
+}
+
+// Make progress on all of the requests added to requestContext, waiting a
+// short while for network activity if none of them can proceed yet.  The
+// callbacks of any request that finishes are run from here.  Returns the
+// number of requests still running, or -1 on error.
+static int drive_context(S3RequestContext *requestContext)
+{
+    int remaining = 0;
+    if (S3_runonce_request_context(requestContext, &remaining)
+        != S3StatusOK) {
+        return -1;
+    }
+    if (!remaining) {
+        return 0;
+    }
+
+    fd_set readFds, writeFds, exceptFds;
+    int maxFd = -1;
+    FD_ZERO(&readFds);
+    FD_ZERO(&writeFds);
+    FD_ZERO(&exceptFds);
+    if (S3_get_request_context_fdsets(requestContext, &readFds, &writeFds,
+                                      &exceptFds, &maxFd) != S3StatusOK) {
+        return -1;
+    }
+    int64_t timeout = S3_get_request_context_timeout(requestContext);
+    if (timeout < 0 || timeout > 100) {
+        timeout = 100;
+    }
+    struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+    if (maxFd >= 0) {
+        select(maxFd + 1, &readFds, &writeFds, &exceptFds, &tv);
     }
     else {
-        fprintf(stderr, "\nERROR: %s\n", S3_get_status_name(statusG));
-        fprintf(stderr, "%s\n", errorDetailsG);
+        // curl has nothing to wait on yet (e.g. still resolving)
+        select(0, NULL, NULL, NULL, &tv);
     }
+    return remaining;
 }
 
-static int should_retry()
+static void printError(const request_result *result)
 {
-    if (retriesG--) {
-        // Sleep before next retry; start out with a 1 second sleep
-        static int retrySleepInterval = 1 * SLEEP_UNITS_PER_SECOND;
-        sleep(retrySleepInterval);
-        // Next sleep 1 second longer
-        retrySleepInterval++;
-        return 1;
+    if (result->status < S3StatusErrorAccessDenied) {
+        fprintf(stderr, "\nERROR: %s\n", S3_get_status_name(result->status));
+    }
+    else {
+        fprintf(stderr, "\nERROR: %s\n", S3_get_status_name(result->status));
+        fprintf(stderr, "%s\n", result->errorDetails);
+    }
+}
+
+// retry policy --------------------------------------------------------------
+
+// Every request has its own retry_state.  A request that fails with a
+// retryable status is reissued after a capped exponential backoff with full
+// jitter, until it has used up its retries or its deadline has passed.
+
+typedef struct retry_state
+{
+    int retries;       // retries allowed
+    int count;         // retries made so far
+    int64_t deadline;  // ms on the monotonic clock; 0 for none
+    int64_t notBefore; // when a scheduled retry is due; 0 if none
+} retry_state;
+
+void s3fs_set_retry(int attempts, int base_delay_ms, int max_delay_ms,
+                    int deadline_ms) {
+    retryAttemptsG = attempts >= 0 ? attempts : 0;
+    retryBaseDelayG = base_delay_ms >= 0 ? base_delay_ms : 0;
+    retryMaxDelayG = max_delay_ms >= retryBaseDelayG ?
+        max_delay_ms : retryBaseDelayG;
+    retryDeadlineG = deadline_ms >= 0 ? deadline_ms : 0;
+}
+
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void sleep_until(int64_t when)
+{
+    int64_t delay = when - now_ms();
+    if (delay > 0) {
+        struct timespec ts = { delay / 1000, (delay % 1000) * 1000000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void retry_init(retry_state *retry, int retries)
+{
+    retry->retries = retries;
+    retry->count = 0;
+    retry->deadline = retryDeadlineG ? now_ms() + retryDeadlineG : 0;
+    retry->notBefore = 0;
+}
+
+// Decide whether a request that finished with status gets another try, and
+// if so schedule it.  Returns 1 if it is to be retried at
+// retry->notBefore, 0 if not.
+static int retry_schedule(retry_state *retry, S3Status status)
+{
+    if (!S3_status_is_retryable(status) || retry->count >= retry->retries) {
+        return 0;
+    }
+
+    int64_t delay = retryBaseDelayG;
+    int i;
+    for (i = 0; i < retry->count && delay < retryMaxDelayG; i++) {
+        delay *= 2;
+    }
+    if (delay > retryMaxDelayG) {
+        delay = retryMaxDelayG;
+    }
+    // full jitter: wait anywhere up to the backoff, so that requests that
+    // failed together don't all come back together
+    static __thread unsigned int seed = 0;
+    if (!seed) {
+        seed = (unsigned int) now_ms() ^ (unsigned int) (uintptr_t) &seed;
     }
+    delay = delay ? rand_r(&seed) % (delay + 1) : 0;
 
+    int64_t now = now_ms();
+    if (retry->deadline && now + delay >= retry->deadline) {
+        return 0;
+    }
+    retry->count++;
+    retry->notBefore = now + delay + 1;
+    return 1;
+}
+
+// For the asynchronous loops: returns 1 if the retry scheduled on retry is
+// due (and clears it), or 0 if it must keep waiting, in which case *wakeAt
+// is lowered to when it is due.
+static int retry_due(retry_state *retry, int64_t now, int64_t *wakeAt)
+{
+    if (retry->notBefore <= now) {
+        retry->notBefore = 0;
+        return 1;
+    }
+    if (!*wakeAt || retry->notBefore < *wakeAt) {
+        *wakeAt = retry->notBefore;
+    }
     return 0;
 }
 
+// For the synchronous request loops: schedule a retry and wait for it.
+// Callers hand their request context back to the pool first, so the wait
+// holds up no one else.
+static int should_retry(retry_state *retry, S3Status status)
+{
+    if (!retry_schedule(retry, status)) {
+        return 0;
+    }
+    sleep_until(retry->notBefore);
+    retry->notBefore = 0;
+    return 1;
+}
+
 // response properties callback ----------------------------------------------
 
-// This callback does the same thing for every request type: prints out the
-// properties if the user has requested them to be so
+// This callback does the same thing for every request type: saves the
+// object properties in the request's result, and prints them out if the
+// user has requested them to be so
 static S3Status responsePropertiesCallback
     (const S3ResponseProperties *properties, void *callbackData)
 {
-    (void) callbackData;
+    request_result *result = (request_result *) callbackData;
+
+    result->info.content_length = properties->contentLength;
+    result->info.last_modified = properties->lastModified > 0 ?
+        properties->lastModified : -1;
+    snprintf(result->info.etag, sizeof(result->info.etag), "%s",
+             properties->eTag ? properties->eTag : "");
 
     if (!showResponsePropertiesG) {
         return S3StatusOK;
@@ -267,37 +489,40 @@ static S3Status responsePropertiesCallback
 // response complete callback ------------------------------------------------
 
 // This callback does the same thing for every request type: saves the status
-// and error stuff in global variables
+// and error stuff in the request's result
 static void responseCompleteCallback(S3Status status,
                                      const S3ErrorDetails *error, 
                                      void *callbackData)
 {
-    (void) callbackData;
+    request_result *result = (request_result *) callbackData;
+    char *errorDetails = result->errorDetails;
+    size_t errorDetailsSize = sizeof(result->errorDetails);
 
-    statusG = status;
+    result->status = status;
+    result->completed = 1;
     // Compose the error details message now, although we might not use it.
     // Can't just save a pointer to [error] since it's not guaranteed to last
     // beyond this callback
     int len = 0;
     if (error && error->message) {
-        len += snprintf(&(errorDetailsG[len]), sizeof(errorDetailsG) - len,
+        len += snprintf(&(errorDetails[len]), errorDetailsSize - len,
                         "  Message: %s\n", error->message);
     }
     if (error && error->resource) {
-        len += snprintf(&(errorDetailsG[len]), sizeof(errorDetailsG) - len,
+        len += snprintf(&(errorDetails[len]), errorDetailsSize - len,
                         "  Resource: %s\n", error->resource);
     }
     if (error && error->furtherDetails) {
-        len += snprintf(&(errorDetailsG[len]), sizeof(errorDetailsG) - len,
+        len += snprintf(&(errorDetails[len]), errorDetailsSize - len,
                         "  Further Details: %s\n", error->furtherDetails);
     }
     if (error && error->extraDetailsCount) {
-        len += snprintf(&(errorDetailsG[len]), sizeof(errorDetailsG) - len,
+        len += snprintf(&(errorDetails[len]), errorDetailsSize - len,
                         "%s", "  Extra Details:\n");
         int i;
         for (i = 0; i < error->extraDetailsCount; i++) {
-            len += snprintf(&(errorDetailsG[len]), 
-                            sizeof(errorDetailsG) - len, "    %s: %s\n", 
+            len += snprintf(&(errorDetails[len]), 
+                            errorDetailsSize - len, "    %s: %s\n", 
                             error->extraDetails[i].name,
                             error->extraDetails[i].value);
         }
@@ -305,33 +530,32 @@ static void responseCompleteCallback(S3Status status,
 }
 
 
-int s3fs_test_bucket(const char *bucketName) {
-    s3fs_lock();
-    int rv = __s3fs_test_bucket(bucketName);
-    s3fs_unlock();
-    return rv;
-}
-
-int __s3fs_test_bucket(const char *bucketName)
+int s3fs_test_bucket(const char *bucketName)
 {
-    S3_init();
-
     S3ResponseHandler responseHandler =
     {
         &responsePropertiesCallback, &responseCompleteCallback
     };
 
+    request_result result;
+    retry_state retry;
     char locationConstraint[64];
+    retry_init(&retry, retryAttemptsG);
     do {
+        init_result(&result);
+        S3RequestContext *requestContext = acquire_context();
         S3_test_bucket(protocolG, uriStyleG, accessKeyIdG, secretAccessKeyG,
                        0, bucketName, sizeof(locationConstraint),
-                       locationConstraint, 0, &responseHandler, 0);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+                       locationConstraint, requestContext, &responseHandler,
+                       &result);
+        run_context(requestContext, &result);
+        release_context(requestContext);
+    } while (should_retry(&retry, result.status));
 
     const char *reason = "Unknown";
-    int result = statusG == S3StatusOK ? 1 : 0;
+    int rv = result.status == S3StatusOK ? 1 : 0;
 
-    switch (statusG) {
+    switch (result.status) {
     case S3StatusOK:
         // bucket exists
         reason = locationConstraint[0] ? locationConstraint : "USA";
@@ -348,27 +572,26 @@ int __s3fs_test_bucket(const char *bucketName)
 
     fprintf(stderr, "S3 test_bucket: %s\n", reason);
 
-    S3_deinitialize();
-
-    return result;
+    return rv;
 }
 
 
 // list bucket ---------------------------------------------------------------
 // JS: well, it's really remove bucket.  doesn't that make sense?
 
-struct node {
-    char *key;
-    struct node *next;
-};
-
+// Deletes in flight at once while clearing a bucket
+#define CLEAR_DELETE_CONCURRENCY 32
+// One page of a bucket listing
 typedef struct traverse_bucket_callback_data
 {
+    request_result result;
     int isTruncated;
+    char marker[1024];
     char nextMarker[1024];
     int keyCount;
-    int allDetails;
-    struct node *keylist;
+    int keyCapacity;
+    char **keys;
+    retry_state retry;
 } traverse_bucket_callback_data;
 
 
@@ -398,39 +621,74 @@ static S3Status traverseBucketCallback(int isTruncated, const char *nextMarker,
         data->nextMarker[0] = 0;
     }
     
+    if (data->keyCount + contentsCount > data->keyCapacity) {
+        int capacity = data->keyCount + contentsCount;
+        char **keys = realloc(data->keys, capacity * sizeof(char *));
+        if (!keys) {
+            return S3StatusOutOfMemory;
+        }
+        data->keys = keys;
+        data->keyCapacity = capacity;
+    }
+
     int i;
     for (i = 0; i < contentsCount; i++) {
-        const S3ListBucketContent *content = &(contents[i]);
+        data->keys[data->keyCount++] = strdup(contents[i].key);
+    }
 
-        // add key onto linked list; push at head
-        struct node *el = malloc(sizeof(struct node));
-        el->key = strdup(content->key);
-        el->next = data->keylist;
-        data->keylist = el;
+    return S3StatusOK;
+}
+
+static void free_keys(traverse_bucket_callback_data *page)
+{
+    int i;
+    for (i = 0; i < page->keyCount; i++) {
+        free(page->keys[i]);
     }
+    page->keyCount = 0;
+}
 
-    data->keyCount += contentsCount;
+// Add the listing of the page after marker to requestContext.
+static void start_list(const S3BucketContext *bucketContext,
+                       const S3ListBucketHandler *listBucketHandler,
+                       S3RequestContext *requestContext,
+                       traverse_bucket_callback_data *page)
+{
+    free_keys(page);
+    page->isTruncated = 0;
+    page->nextMarker[0] = 0;
+    init_result(&page->result);
+    S3_list_bucket(bucketContext, 0, page->marker[0] ? page->marker : 0, 0,
+                   0, requestContext, listBucketHandler, page);
+}
 
-    return S3StatusOK;
+// One delete in flight
+typedef struct delete_slot
+{
+    request_result result; // first, for the shared callbacks
+    const char *key;       // NULL when the slot is idle
+    retry_state retry;
+} delete_slot;
+
+static void start_delete(const S3BucketContext *bucketContext,
+                         const S3ResponseHandler *responseHandler,
+                         S3RequestContext *requestContext,
+                         delete_slot *slot)
+{
+    init_result(&slot->result);
+    S3_delete_object(bucketContext, slot->key, requestContext,
+                     responseHandler, &slot->result);
 }
 
 
 // JS: for s3fs project; adapted from original list_bucket.
 // (Makes sense, right?  Instead of listing, we just remove everything :-)
+//
+// Keys are deleted a page at a time, up to CLEAR_DELETE_CONCURRENCY at
+// once, while the next page is listed on the same request context.  At
+// most two pages of keys are held in memory.
 
 int s3fs_clear_bucket(const char *bucketName) {
-    s3fs_lock();
-    int rv = __s3fs_clear_bucket(bucketName);
-    s3fs_unlock();
-    return rv;
-}
-
-int __s3fs_clear_bucket(const char *bucketName) {
-    S3_init();
-
-    const char *prefix = 0, *marker = 0, *delimiter = 0;
-    int maxkeys = 0, allDetails = 0;
-    
     S3BucketContext bucketContext =
     {
         0,
@@ -447,49 +705,124 @@ int __s3fs_clear_bucket(const char *bucketName) {
         &traverseBucketCallback
     };
 
-    traverse_bucket_callback_data data;
+    S3ResponseHandler deleteHandler =
+    { 
+        0,
+        &responseCompleteCallback
+    };
 
-    snprintf(data.nextMarker, sizeof(data.nextMarker), "%s", marker);
-    data.keyCount = 0;
-    data.keylist = NULL;
-    data.allDetails = allDetails;
+    traverse_bucket_callback_data pages[2];
+    delete_slot slots[CLEAR_DELETE_CONCURRENCY];
+    memset(pages, 0, sizeof(pages));
+    memset(slots, 0, sizeof(slots));
+
+    // listing is the page being listed (NULL once there are no more) and
+    // deleting the page whose keys are being removed
+    traverse_bucket_callback_data *listing = &pages[0];
+    traverse_bucket_callback_data *deleting = &pages[1];
+    int nextKey = 0, activeDeletes = 0, rv = 0, i;
+
+    S3RequestContext *requestContext = acquire_context();
+    retry_init(&listing->retry, retryAttemptsG);
+    start_list(&bucketContext, &listBucketHandler, requestContext, listing);
+
+    while (listing || nextKey < deleting->keyCount || activeDeletes) {
+        // start new deletes, and any retries that are due; if there are
+        // only retries waiting, sleep until the first is due
+        int64_t now = now_ms(), wakeAt = 0;
+        int running = 0;
+        for (i = 0; i < CLEAR_DELETE_CONCURRENCY; i++) {
+            delete_slot *slot = &slots[i];
+            if (!slot->key && nextKey < deleting->keyCount) {
+                slot->key = deleting->keys[nextKey++];
+                retry_init(&slot->retry, retryAttemptsG);
+                start_delete(&bucketContext, &deleteHandler, requestContext,
+                             slot);
+                activeDeletes++;
+            }
+            else if (slot->key && slot->retry.notBefore &&
+                     retry_due(&slot->retry, now, &wakeAt)) {
+                start_delete(&bucketContext, &deleteHandler, requestContext,
+                             slot);
+            }
+            running += slot->key && !slot->retry.notBefore;
+        }
+        if (listing && listing->retry.notBefore &&
+            retry_due(&listing->retry, now, &wakeAt)) {
+            start_list(&bucketContext, &listBucketHandler, requestContext,
+                       listing);
+        }
+        running += listing && !listing->retry.notBefore &&
+            !listing->result.completed;
+        if (!running) {
+            sleep_until(wakeAt);
+            continue;
+        }
 
-    do {
-        data.isTruncated = 0;
-        do {
-            S3_list_bucket(&bucketContext, prefix, data.nextMarker,
-                           delimiter, maxkeys, 0, &listBucketHandler, &data);
-        } while (S3_status_is_retryable(statusG) && should_retry());
-        if (statusG != S3StatusOK) {
+        if (drive_context(requestContext) < 0) {
+            rv = -1;
             break;
         }
-    } while (data.isTruncated && (!maxkeys || (data.keyCount < maxkeys)));
-
-    int rv = statusG == S3StatusOK ? 0 : -1;
 
-    S3_deinitialize();
-
-    struct node *klist = data.keylist;
+        for (i = 0; i < CLEAR_DELETE_CONCURRENCY; i++) {
+            delete_slot *slot = &slots[i];
+            if (!slot->key || slot->retry.notBefore ||
+                !slot->result.completed) {
+                continue;
+            }
+            S3Status status = slot->result.status;
+            if (status != S3StatusOK && status != S3StatusErrorNoSuchKey &&
+                status != S3StatusHttpErrorNotFound) {
+                if (retry_schedule(&slot->retry, status)) {
+                    continue;
+                }
+                printError(&slot->result);
+                rv = -1;
+            }
+            slot->key = NULL;
+            activeDeletes--;
+        }
 
-    // try to remove objects
-    if (rv == 0) {
-        while (klist) {
-            struct node *el = klist;
-            int thisrv = __s3fs_remove_object(bucketName, el->key);
-            if (thisrv < 0) {
+        if (!listing || listing->retry.notBefore ||
+            !listing->result.completed) {
+            continue;
+        }
+        if (listing->result.status != S3StatusOK) {
+            if (!retry_schedule(&listing->retry, listing->result.status)) {
+                printError(&listing->result);
                 rv = -1;
+                listing = NULL;
             }
-            klist = klist->next;
+            continue;
         }
+
+        // once the last page is deleted, start on the one just listed,
+        // and list the page after it in the meantime
+        if (nextKey == deleting->keyCount && !activeDeletes) {
+            traverse_bucket_callback_data *done = deleting;
+            free_keys(done);
+            deleting = listing;
+            nextKey = 0;
+            listing = NULL;
+            if (deleting->isTruncated && deleting->nextMarker[0]) {
+                listing = done;
+                retry_init(&listing->retry, retryAttemptsG);
+                snprintf(listing->marker, sizeof(listing->marker), "%s",
+                         deleting->nextMarker);
+                start_list(&bucketContext, &listBucketHandler,
+                           requestContext, listing);
+            }
+        }
+    }
+
+    // let any requests still in flight finish before the context is reused
+    while (drive_context(requestContext) > 0) {
     }
+    release_context(requestContext);
 
-    // free keylist
-    klist = data.keylist;
-    while (klist) {
-        struct node *el = klist;
-        klist = klist->next;
-        free(el->key);
-        free(el);
+    for (i = 0; i < 2; i++) {
+        free_keys(&pages[i]);
+        free(pages[i].keys);
     }
 
     return rv;
@@ -499,9 +832,12 @@ int __s3fs_clear_bucket(const char *bucketName) {
 
 typedef struct put_object_callback_data
 {
-    const uint8_t *data;
+    request_result result;
+    s3fs_put_producer_t producer;
+    void *producerArg;
+    uint64_t offset; // object offset of the next byte to send
     uint64_t contentLength, originalContentLength;
-    int written;
+    uint64_t written;
     int noStatus;
 } put_object_callback_data;
 
@@ -517,11 +853,14 @@ int putObjectDataCallback(int bufferSize, char *buffer,
     if (data->contentLength) {
         int toRead = ((data->contentLength > (unsigned) bufferSize) ?
                       (unsigned) bufferSize : data->contentLength);
-        const unsigned char *tmp = data->data;
-        memcpy(buffer, tmp, toRead);
-        tmp += toRead;
-        data->data = tmp; // advance data ptr
-        ret += toRead;
+        ssize_t produced = data->producer(data->producerArg, data->offset,
+                                          (uint8_t *) buffer, toRead);
+        if (produced <= 0) {
+            // the producer failed or ran dry early; abort the request
+            return -1;
+        }
+        data->offset += produced;
+        ret += produced;
     }
     data->written += ret;
     data->contentLength -= ret;
@@ -540,14 +879,118 @@ int putObjectDataCallback(int bufferSize, char *buffer,
     return ret;
 }
 
-ssize_t s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength) {
-    s3fs_lock();
-    ssize_t rv = __s3fs_put_object(bucketName, key, buf, contentLength);
-    s3fs_unlock();
-    return rv;
+// Producer over a contiguous buffer
+static ssize_t buffer_producer(void *arg, uint64_t offset, uint8_t *buf,
+                               size_t len)
+{
+    memcpy(buf, (const uint8_t *) arg + offset, len);
+    return len;
+}
+
+static ssize_t put_object(const char *bucketName, const char *key,
+                          uint64_t contentLength,
+                          s3fs_put_producer_t producer, void *arg,
+                          s3fs_object_info_t *info);
+
+ssize_t s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength)
+{
+    return put_object(bucketName, key, contentLength, buffer_producer,
+                      (void *) buf, NULL);
+}
+
+ssize_t s3fs_put_object_info(const char *bucketName, const char *key,
+                             const uint8_t *buf, ssize_t byte_count,
+                             s3fs_object_info_t *info) {
+    return put_object(bucketName, key, byte_count, buffer_producer,
+                      (void *) buf, info);
+}
+
+// Producer over an iovec array.  Parts of a multipart upload ask for their
+// ranges concurrently and in any order, so every call finds its own place
+// from the start of the array rather than sharing a cursor.
+struct iov_producer_arg {
+    const struct iovec *iov;
+    int iovcnt;
+};
+
+static ssize_t iov_producer(void *arg, uint64_t offset, uint8_t *buf,
+                            size_t len)
+{
+    const struct iov_producer_arg *iovArg =
+        (const struct iov_producer_arg *) arg;
+    int index = 0;
+    while (index < iovArg->iovcnt && offset >= iovArg->iov[index].iov_len) {
+        offset -= iovArg->iov[index].iov_len;
+        index++;
+    }
+
+    size_t copied = 0;
+    for (; copied < len && index < iovArg->iovcnt; index++, offset = 0) {
+        const struct iovec *v = &(iovArg->iov[index]);
+        size_t n = v->iov_len - offset;
+        if (n > len - copied) {
+            n = len - copied;
+        }
+        memcpy(buf + copied, (const uint8_t *) v->iov_base + offset, n);
+        copied += n;
+    }
+    return copied;
+}
+
+ssize_t s3fs_put_object_iov(const char *bucketName, const char *key,
+                            const struct iovec *iov, int iovcnt) {
+    struct iov_producer_arg iovArg = { iov, iovcnt };
+    uint64_t contentLength = 0;
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+        contentLength += iov[i].iov_len;
+    }
+    return s3fs_put_object_stream(bucketName, key, contentLength,
+                                  iov_producer, &iovArg);
+}
+
+// Producer over a range of an open file
+struct fd_producer_arg {
+    int fd;
+    off_t start;
+};
+
+static ssize_t fd_producer(void *arg, uint64_t offset, uint8_t *buf,
+                           size_t len)
+{
+    struct fd_producer_arg *fdArg = (struct fd_producer_arg *) arg;
+    ssize_t n;
+    do {
+        n = pread(fdArg->fd, buf, len, fdArg->start + offset);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+ssize_t s3fs_put_object_fd(const char *bucketName, const char *key, int fd,
+                           off_t start, uint64_t byte_count) {
+    struct fd_producer_arg fdArg = { fd, start };
+    return s3fs_put_object_stream(bucketName, key, byte_count, fd_producer,
+                                  &fdArg);
+}
+
+static ssize_t put_object_multipart(const S3BucketContext *bucketContext,
+                                    const char *key, uint64_t contentLength,
+                                    s3fs_put_producer_t producer, void *arg,
+                                    S3PutProperties *putProperties);
+
+ssize_t s3fs_put_object_stream(const char *bucketName, const char *key,
+                               uint64_t contentLength,
+                               s3fs_put_producer_t producer, void *arg)
+{
+    return put_object(bucketName, key, contentLength, producer, arg, NULL);
 }
 
-ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength)
+// Put an object, filling in *info (if not NULL) on success.  The ETag of a
+// multipart upload is not reported.
+static ssize_t put_object(const char *bucketName, const char *key,
+                          uint64_t contentLength,
+                          s3fs_put_producer_t producer, void *arg,
+                          s3fs_object_info_t *info)
 {
     const char *cacheControl = 0, *contentType = 0, *md5 = 0;
     const char *contentDispositionFilename = 0, *contentEncoding = 0;
@@ -558,15 +1001,7 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
     int noStatus = 0;
 
     put_object_callback_data data;
-    memset(&data, 0, sizeof(put_object_callback_data));
-    data.data = buf;
-    // data.gb = 0;
-    data.noStatus = noStatus;
 
-    data.contentLength = data.originalContentLength = contentLength;
-
-    S3_init();
-    
     S3BucketContext bucketContext =
     {
         0,
@@ -596,57 +1031,542 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
         &putObjectDataCallback
     };
 
-    do {
-        S3_put_object(&bucketContext, key, contentLength, &putProperties, 0,
-                      &putObjectHandler, &data);
-    } while (S3_status_is_retryable(statusG) && should_retry());
-
-    int result = data.written;
+    if (multipartThresholdG && contentLength >= multipartThresholdG) {
+        if (info) {
+            info->content_length = contentLength;
+            info->last_modified = -1;
+            info->etag[0] = 0;
+        }
+        return put_object_multipart(&bucketContext, key, contentLength,
+                                    producer, arg, &putProperties);
+    }
 
-    if (statusG != S3StatusOK) {
-        printError();
+    retry_state retry;
+    retry_init(&retry, retryAttemptsG);
+    do {
+        // every attempt sends the object from the beginning
+        memset(&data, 0, sizeof(put_object_callback_data));
+        init_result(&data.result);
+        data.producer = producer;
+        data.producerArg = arg;
+        data.noStatus = noStatus;
+        data.contentLength = data.originalContentLength = contentLength;
+
+        S3RequestContext *requestContext = acquire_context();
+        S3_put_object(&bucketContext, key, contentLength, &putProperties,
+                      requestContext, &putObjectHandler, &data);
+        run_context(requestContext, &data.result);
+        release_context(requestContext);
+    } while (should_retry(&retry, data.result.status));
+
+    ssize_t result = data.written;
+
+    if (data.result.status != S3StatusOK) {
+        printError(&data.result);
         result = -1;
     }
     else if (data.contentLength) {
         fprintf(stderr, "\nERROR: Failed to read remaining %llu bytes from "
                 "input\n", (unsigned long long) data.contentLength);
     }
+    else if (info) {
+        *info = data.result.info;
+        info->content_length = contentLength;
+    }
 
-    S3_deinitialize();
     return result;
 }
 
+// multipart upload ----------------------------------------------------------
+
+// Limits set by s3 (and, for the part size, by the int libs3 takes)
+#define MULTIPART_MIN_PART_SIZE (5 * 1024 * 1024)
+#define MULTIPART_MAX_PART_SIZE ((uint64_t) INT_MAX)
+#define MULTIPART_MAX_PARTS 10000
+
+void s3fs_set_multipart(uint64_t threshold, uint64_t part_size,
+                        int concurrency, int part_retries) {
+    multipartThresholdG = threshold;
+    multipartPartSizeG = part_size;
+    multipartConcurrencyG = concurrency > 0 ? concurrency : 1;
+    multipartRetriesG = part_retries >= 0 ? part_retries : 0;
+}
+
+typedef struct multipart_initiate_data
+{
+    request_result result;
+    char uploadId[1024];
+} multipart_initiate_data;
+
+static S3Status initiateMultipartCallback(const char *upload_id,
+                                          void *callbackData)
+{
+    multipart_initiate_data *data = 
+        (multipart_initiate_data *) callbackData;
+    snprintf(data->uploadId, sizeof(data->uploadId), "%s", upload_id);
+    return S3StatusOK;
+}
+
+static S3Status commitMultipartCallback(const char *location,
+                                        const char *etag, void *callbackData)
+{
+    (void) location;
+    (void) etag;
+    (void) callbackData;
+    return S3StatusOK;
+}
+
+// The abort handler is called without our callbackData, so it can't share
+// the usual callbacks.
+static void abortMultipartCallback(S3Status status,
+                                   const S3ErrorDetails *error,
+                                   void *callbackData)
+{
+    (void) error;
+    (void) callbackData;
+    if (status != S3StatusOK) {
+        fprintf(stderr, "\nERROR: Failed to abort multipart upload: %s\n",
+                S3_get_status_name(status));
+    }
+}
+
+// State shared by all the parts of one upload
+typedef struct multipart_upload
+{
+    const S3BucketContext *bucketContext;
+    const char *key;
+    S3PutProperties *putProperties;
+    S3PutObjectHandler partHandler;
+    S3RequestContext *requestContext;
+    char uploadId[1024];
+    const char *copySource; // key the parts are copied from, or NULL
+    s3fs_put_producer_t producer;
+    void *producerArg;
+    uint64_t contentLength;
+    uint64_t partSize;
+    int partCount;
+} multipart_upload;
+
+// One part upload in flight
+typedef struct multipart_slot
+{
+    put_object_callback_data data; // first, for the shared callbacks
+    int partNumber;                // 1-based; 0 when the slot is idle
+    char copyEtag[S3FS_ETAG_SIZE]; // a copied part's ETag
+    retry_state retry;
+} multipart_slot;
+
+// Add the upload of partNumber to the upload's request context.
+static void start_part(multipart_upload *upload, multipart_slot *slot,
+                       int partNumber)
+{
+    uint64_t start = (uint64_t) (partNumber - 1) * upload->partSize;
+    uint64_t length = upload->contentLength - start;
+    if (length > upload->partSize) {
+        length = upload->partSize;
+    }
+
+    memset(&slot->data, 0, sizeof(put_object_callback_data));
+    init_result(&slot->data.result);
+    slot->data.producer = upload->producer;
+    slot->data.producerArg = upload->producerArg;
+    slot->data.offset = start;
+    slot->data.contentLength = slot->data.originalContentLength = length;
+    slot->data.noStatus = 1;
+    slot->partNumber = partNumber;
+
+    if (upload->copySource) {
+        // the part's ETag comes back in the response body, not its headers
+        slot->copyEtag[0] = 0;
+        S3_copy_object_range(upload->bucketContext, upload->copySource,
+                             upload->bucketContext->bucketName, upload->key,
+                             partNumber, upload->uploadId, start, length,
+                             0, 0, sizeof(slot->copyEtag), slot->copyEtag,
+                             upload->requestContext,
+                             &upload->partHandler.responseHandler,
+                             &slot->data);
+        return;
+    }
+
+    S3_upload_part((S3BucketContext *) upload->bucketContext, upload->key,
+                   upload->putProperties, &upload->partHandler, partNumber,
+                   upload->uploadId, (int) length, upload->requestContext,
+                   &slot->data);
+}
+
+// Upload every part, keeping up to multipartConcurrencyG of them in flight
+// on the upload's request context.  A failed part is retried on its own.
+// Part ETags are saved in etags, S3FS_ETAG_SIZE bytes apart.  Returns 0 on
+// success and -1 on failure.
+static int upload_parts(multipart_upload *upload, char *etags)
+{
+    int concurrency = multipartConcurrencyG;
+    if (concurrency > upload->partCount) {
+        concurrency = upload->partCount;
+    }
+    multipart_slot *slots = calloc(concurrency, sizeof(multipart_slot));
+    if (!slots) {
+        return -1;
+    }
+
+    int nextPart = 1, active = 0, failed = 0, i;
+    while (!failed && (nextPart <= upload->partCount || active)) {
+        // start new parts, and any retries that are due; if there are only
+        // retries waiting, sleep until the first is due
+        int64_t now = now_ms(), wakeAt = 0;
+        int running = 0;
+        for (i = 0; i < concurrency; i++) {
+            multipart_slot *slot = &slots[i];
+            if (!slot->partNumber && nextPart <= upload->partCount) {
+                retry_init(&slot->retry, multipartRetriesG);
+                start_part(upload, slot, nextPart++);
+                active++;
+            }
+            else if (slot->partNumber && slot->retry.notBefore &&
+                     retry_due(&slot->retry, now, &wakeAt)) {
+                start_part(upload, slot, slot->partNumber);
+            }
+            running += slot->partNumber && !slot->retry.notBefore;
+        }
+        if (!running) {
+            sleep_until(wakeAt);
+            continue;
+        }
+
+        if (drive_context(upload->requestContext) < 0) {
+            failed = 1;
+            break;
+        }
+
+        for (i = 0; i < concurrency; i++) {
+            multipart_slot *slot = &slots[i];
+            if (!slot->partNumber || slot->retry.notBefore ||
+                !slot->data.result.completed) {
+                continue;
+            }
+            if (slot->data.result.status == S3StatusOK) {
+                snprintf(etags + (slot->partNumber - 1) * S3FS_ETAG_SIZE,
+                         S3FS_ETAG_SIZE, "%s", upload->copySource ?
+                         slot->copyEtag : slot->data.result.info.etag);
+                slot->partNumber = 0;
+                active--;
+            }
+            else if (retry_schedule(&slot->retry,
+                                    slot->data.result.status)) {
+                continue;
+            }
+            else {
+                printError(&slot->data.result);
+                failed = 1;
+            }
+        }
+    }
+
+    // let any parts still in flight finish before the context is reused
+    while (active && drive_context(upload->requestContext) > 0) {
+    }
+
+    free(slots);
+    return failed ? -1 : 0;
+}
+
+// Send the CompleteMultipartUpload request that stitches the parts
+// together.  Returns 0 on success and -1 on failure.
+static int complete_multipart(multipart_upload *upload, const char *etags)
+{
+    size_t xmlSize = 64 + (size_t) upload->partCount * (S3FS_ETAG_SIZE + 64);
+    char *xml = malloc(xmlSize);
+    if (!xml) {
+        return -1;
+    }
+    int len = snprintf(xml, xmlSize, "<CompleteMultipartUpload>");
+    int i;
+    for (i = 0; i < upload->partCount; i++) {
+        len += snprintf(xml + len, xmlSize - len,
+                        "<Part><PartNumber>%d</PartNumber>"
+                        "<ETag>%s</ETag></Part>",
+                        i + 1, etags + i * S3FS_ETAG_SIZE);
+    }
+    len += snprintf(xml + len, xmlSize - len, "</CompleteMultipartUpload>");
+
+    S3MultipartCommitHandler commitHandler =
+    {
+        { &responsePropertiesCallback, &responseCompleteCallback },
+        &putObjectDataCallback,
+        &commitMultipartCallback
+    };
+
+    // the upload keeps its own context, so a backoff here holds up only
+    // this upload
+    put_object_callback_data data;
+    retry_state retry;
+    retry_init(&retry, retryAttemptsG);
+    do {
+        memset(&data, 0, sizeof(put_object_callback_data));
+        init_result(&data.result);
+        data.producer = buffer_producer;
+        data.producerArg = xml;
+        data.contentLength = data.originalContentLength = len;
+        data.noStatus = 1;
+
+        S3_complete_multipart_upload((S3BucketContext *) upload->bucketContext,
+                                     upload->key, &commitHandler,
+                                     upload->uploadId, len,
+                                     upload->requestContext, &data);
+        run_context(upload->requestContext, &data.result);
+    } while (should_retry(&retry, data.result.status));
+
+    free(xml);
+    if (data.result.status != S3StatusOK) {
+        printError(&data.result);
+        return -1;
+    }
+    return 0;
+}
+
+// Cut upload->contentLength bytes into parts of about partSize bytes,
+// within s3's limits.  Returns 0 on success and -1 if the object is too
+// large.
+static int plan_parts(multipart_upload *upload, uint64_t partSize)
+{
+    uint64_t contentLength = upload->contentLength;
+
+    // s3 allows at most MULTIPART_MAX_PARTS parts, all but the last at
+    // least MULTIPART_MIN_PART_SIZE bytes
+    if (partSize < MULTIPART_MIN_PART_SIZE) {
+        partSize = MULTIPART_MIN_PART_SIZE;
+    }
+    if ((contentLength + partSize - 1) / partSize > MULTIPART_MAX_PARTS) {
+        partSize = (contentLength + MULTIPART_MAX_PARTS - 1) /
+            MULTIPART_MAX_PARTS;
+    }
+    if (partSize > MULTIPART_MAX_PART_SIZE) {
+        fprintf(stderr, "\nERROR: Object too large for a multipart upload\n");
+        return -1;
+    }
+    upload->partSize = partSize;
+    upload->partCount = (contentLength + partSize - 1) / partSize;
+    return 0;
+}
+
+// Initiate the multipart upload planned in upload, send (or copy) its
+// parts and complete it.  A failed upload is aborted.  Returns 0 on
+// success and -1 on failure.
+static int run_multipart(multipart_upload *upload)
+{
+    upload->partHandler.responseHandler.propertiesCallback =
+        &responsePropertiesCallback;
+    upload->partHandler.responseHandler.completeCallback =
+        &responseCompleteCallback;
+    upload->partHandler.putObjectDataCallback = &putObjectDataCallback;
+
+    char *etags = calloc(upload->partCount, S3FS_ETAG_SIZE);
+    if (!etags) {
+        return -1;
+    }
+
+    upload->requestContext = acquire_context();
+
+    multipart_initiate_data initData;
+    S3MultipartInitialHandler initHandler =
+    {
+        { &responsePropertiesCallback, &responseCompleteCallback },
+        &initiateMultipartCallback
+    };
+    retry_state retry;
+    retry_init(&retry, retryAttemptsG);
+    do {
+        init_result(&initData.result);
+        initData.uploadId[0] = 0;
+        S3_initiate_multipart((S3BucketContext *) upload->bucketContext,
+                              upload->key, upload->putProperties,
+                              &initHandler, upload->requestContext,
+                              &initData);
+        run_context(upload->requestContext, &initData.result);
+    } while (should_retry(&retry, initData.result.status));
+
+    int rv = -1;
+    if (initData.result.status != S3StatusOK || !initData.uploadId[0]) {
+        printError(&initData.result);
+    }
+    else {
+        snprintf(upload->uploadId, sizeof(upload->uploadId), "%s",
+                 initData.uploadId);
+        if (upload_parts(upload, etags) == 0 &&
+            complete_multipart(upload, etags) == 0) {
+            rv = 0;
+        }
+        else {
+            // don't leave the uploaded parts around to be billed for
+            S3AbortMultipartUploadHandler abortHandler =
+            {
+                { 0, &abortMultipartCallback }
+            };
+            S3_abort_multipart_upload((S3BucketContext *)
+                                      upload->bucketContext, upload->key,
+                                      upload->uploadId, &abortHandler);
+        }
+    }
+
+    release_context(upload->requestContext);
+    free(etags);
+    return rv;
+}
+
+static ssize_t put_object_multipart(const S3BucketContext *bucketContext,
+                                    const char *key, uint64_t contentLength,
+                                    s3fs_put_producer_t producer, void *arg,
+                                    S3PutProperties *putProperties)
+{
+    multipart_upload upload;
+    memset(&upload, 0, sizeof(upload));
+    upload.bucketContext = bucketContext;
+    upload.key = key;
+    upload.putProperties = putProperties;
+    upload.producer = producer;
+    upload.producerArg = arg;
+    upload.contentLength = contentLength;
+
+    if (plan_parts(&upload, multipartPartSizeG) < 0 ||
+        run_multipart(&upload) < 0) {
+        return -1;
+    }
+    return contentLength;
+}
+
+// copy object ---------------------------------------------------------------
+
+// s3 copies objects of up to COPY_MAX_SIZE bytes in one request, and larger
+// ones a part at a time.  Parts are copied within s3, so they can be big.
+#define COPY_MAX_SIZE ((uint64_t) 5 * 1024 * 1024 * 1024)
+#define COPY_PART_SIZE ((uint64_t) 1024 * 1024 * 1024)
+
+int s3fs_copy_object(const char *bucketName, const char *key,
+                     const char *dest_key) {
+    S3BucketContext bucketContext =
+    {
+        0,
+        bucketName,
+        protocolG,
+        uriStyleG,
+        accessKeyIdG,
+        secretAccessKeyG
+    };
+
+    s3fs_object_info_t info;
+    if (s3fs_head_object(bucketName, key, &info) < 0) {
+        return -1;
+    }
+
+    if (info.content_length > 0 &&
+        (uint64_t) info.content_length > COPY_MAX_SIZE) {
+        multipart_upload upload;
+        memset(&upload, 0, sizeof(upload));
+        upload.bucketContext = &bucketContext;
+        upload.key = dest_key;
+        upload.copySource = key;
+        upload.contentLength = info.content_length;
+        if (plan_parts(&upload, COPY_PART_SIZE) < 0) {
+            return -1;
+        }
+        return run_multipart(&upload);
+    }
+
+    S3ResponseHandler responseHandler =
+    {
+        &responsePropertiesCallback,
+        &responseCompleteCallback
+    };
+
+    request_result result;
+    retry_state retry;
+    char etag[S3FS_ETAG_SIZE];
+    retry_init(&retry, retryAttemptsG);
+    do {
+        init_result(&result);
+        S3RequestContext *requestContext = acquire_context();
+        S3_copy_object(&bucketContext, key, bucketName, dest_key, 0, 0,
+                       sizeof(etag), etag, requestContext, &responseHandler,
+                       &result);
+        run_context(requestContext, &result);
+        release_context(requestContext);
+    } while (should_retry(&retry, result.status));
+
+    if (result.status != S3StatusOK) {
+        printError(&result);
+        return -1;
+    }
+    return 0;
+}
+
 // get object ----------------------------------------------------------------
 
+// Smallest receive buffer allocated when the object size isn't known
+#define GET_MIN_CAPACITY (16 * 1024)
+
 struct get_callback_data {
+    request_result result;
     uint8_t *buf;
     ssize_t bytes_read;
+    size_t capacity;
+    int fixed; // buf is the caller's, and may not be grown
 };
 
+// Make room for at least size bytes in the receive buffer.
+static int reserve_get_buffer(struct get_callback_data *get_context,
+                              size_t size)
+{
+    if (size <= get_context->capacity) {
+        return 0;
+    }
+    if (get_context->fixed) {
+        return -1;
+    }
+    uint8_t *tmp = realloc(get_context->buf, size);
+    if (!tmp) {
+        return -1;
+    }
+    get_context->buf = tmp;
+    get_context->capacity = size;
+    return 0;
+}
+
+// Once the response headers arrive, size the buffer from Content-Length so
+// the body lands in a single allocation.
+static S3Status getObjectPropertiesCallback
+    (const S3ResponseProperties *properties, void *callbackData)
+{
+    struct get_callback_data *get_context = 
+        (struct get_callback_data*)callbackData;
+
+    S3Status status = responsePropertiesCallback(properties, callbackData);
+    if (status == S3StatusOK && properties->contentLength > 0 &&
+        !get_context->fixed && reserve_get_buffer(get_context, properties->contentLength) < 0) {
+        return S3StatusOutOfMemory;
+    }
+    return status;
+}
+
 S3Status getObjectDataCallback(int bufferSize, const char *buffer,
                                void *callbackData) {
     struct get_callback_data *get_context = (struct get_callback_data*)callbackData;
     if (bufferSize > 0) {
-        if (get_context->buf == NULL) {
-            // make new buffer
-            get_context->buf = malloc(sizeof(uint8_t) * bufferSize);
-            if (!get_context->buf) {
-                return S3StatusAbortedByCallback;
+        size_t needed = get_context->bytes_read + bufferSize;
+        if (needed > get_context->capacity) {
+            // size unknown (or understated): grow geometrically so the
+            // total copying stays linear in the object size
+            size_t capacity = get_context->capacity * 2;
+            if (capacity < GET_MIN_CAPACITY) {
+                capacity = GET_MIN_CAPACITY;
             }
-
-            memcpy(get_context->buf, buffer, bufferSize);
-        } else {
-            // reallocate buffer
-            uint8_t *tmp = malloc(sizeof(uint8_t) * (bufferSize + get_context->bytes_read));
-            if (!tmp) {
+            if (capacity < needed) {
+                capacity = needed;
+            }
+            if (reserve_get_buffer(get_context, capacity) < 0) {
                 return S3StatusAbortedByCallback;
             }
-            
-            memcpy(tmp, get_context->buf, get_context->bytes_read);
-            memcpy(tmp + get_context->bytes_read, buffer, bufferSize);
-            free(get_context->buf);
-            get_context->buf = tmp;
         }
+        memcpy(get_context->buf + get_context->bytes_read, buffer, bufferSize);
     }
 
     get_context->bytes_read += bufferSize;
@@ -657,25 +1577,22 @@ S3Status getObjectDataCallback(int bufferSize, const char *buffer,
 
 ssize_t s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf, 
                         ssize_t start_byte, ssize_t byte_count) {
-    s3fs_lock();
-    ssize_t rv = __s3fs_get_object(bucketName, key, buf, start_byte, byte_count);
-    s3fs_unlock();
-    return rv;
+    return s3fs_get_object_info(bucketName, key, buf, start_byte, byte_count,
+                                NULL);
 }
 
-ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf, 
-                        ssize_t start_byte, ssize_t byte_count) {
-
+// Run a GET of byteCount bytes (0 for all) from startByte into
+// get_context->buf, retrying as needed.  If ifNotMatch is not NULL, the
+// object is only sent if its ETag differs.  The outcome is left in
+// get_context->result.
+static void run_get(const char *bucketName, const char *key,
+                    uint64_t startByte, uint64_t byteCount,
+                    const char *ifNotMatch,
+                    struct get_callback_data *get_context)
+{
     int64_t ifModifiedSince = -1, ifNotModifiedSince = -1;
-    const char *ifMatch = 0, *ifNotMatch = 0;
-    uint64_t startByte = start_byte, byteCount = byte_count;
-
-    S3_init();
+    const char *ifMatch = 0;
 
-    struct get_callback_data get_context;
-    get_context.buf = NULL;
-    get_context.bytes_read = 0;
-    
     S3BucketContext bucketContext =
     {
         0,
@@ -696,41 +1613,199 @@ ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf
 
     S3GetObjectHandler getObjectHandler =
     {
-        { &responsePropertiesCallback, &responseCompleteCallback },
+        { &getObjectPropertiesCallback, &responseCompleteCallback },
         &getObjectDataCallback
     };
 
+    retry_state retry;
+    retry_init(&retry, retryAttemptsG);
     do {
+        // every attempt receives the object from the beginning, into the
+        // buffer left by the last one; a ranged GET knows its size upfront
+        get_context->bytes_read = 0;
+        init_result(&get_context->result);
+        if (reserve_get_buffer(get_context, byteCount) < 0) {
+            get_context->result.status = S3StatusOutOfMemory;
+            break;
+        }
+
+        S3RequestContext *requestContext = acquire_context();
         S3_get_object(&bucketContext, key, &getConditions, startByte,
-                      byteCount, 0, &getObjectHandler, &get_context);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+                      byteCount, requestContext, &getObjectHandler,
+                      get_context);
+        run_context(requestContext, &get_context->result);
+        release_context(requestContext);
+    } while (should_retry(&retry, get_context->result.status));
+}
+
+// A GET with If-None-Match whose ETag still matches gets a bodyless 304.
+// libs3 has no status of its own for that, and reports it as an unknown
+// HTTP error; nor does it pass on the properties (the ETag among them) of
+// anything but a 2xx.  So the response can't tell a 304 from any other
+// bodyless failure, and a HEAD settles it: the object only counts as
+// unchanged if it still has the very ETag asked about.  Anything else is
+// an error, never a reason to keep a cached copy.
+static int not_modified(const char *bucketName, const char *key,
+                        const struct get_callback_data *get_context,
+                        const char *etag)
+{
+    if (!etag || get_context->result.status != S3StatusHttpErrorUnknown ||
+        get_context->bytes_read != 0) {
+        return 0;
+    }
+    s3fs_object_info_t info;
+    return s3fs_head_object(bucketName, key, &info) == 0 &&
+        !strcmp(info.etag, etag);
+}
+
+// Report an unchanged object in info, as if it had been fetched again.
+static void fill_not_modified(s3fs_object_info_t *info, const char *etag)
+{
+    if (info) {
+        info->content_length = -1;
+        info->last_modified = -1;
+        snprintf(info->etag, sizeof(info->etag), "%s", etag);
+    }
+}
+
+ssize_t s3fs_get_object_info(const char *bucketName, const char *key,
+                             uint8_t **buf, ssize_t start_byte,
+                             ssize_t byte_count, s3fs_object_info_t *info) {
+    return s3fs_get_object_if_changed(bucketName, key, buf, start_byte,
+                                      byte_count, NULL, info);
+}
+
+ssize_t s3fs_get_object_if_changed(const char *bucketName, const char *key,
+                                   uint8_t **buf, ssize_t start_byte,
+                                   ssize_t byte_count, const char *etag,
+                                   s3fs_object_info_t *info) {
+    struct get_callback_data get_context;
+    memset(&get_context, 0, sizeof(get_context));
+
+    run_get(bucketName, key, start_byte, byte_count, etag, &get_context);
+
+    if (not_modified(bucketName, key, &get_context, etag)) {
+        free(get_context.buf);
+        fill_not_modified(info, etag);
+        return S3FS_NOT_MODIFIED;
+    }
 
     ssize_t status = get_context.bytes_read;
-    if (statusG != S3StatusOK) {
-        status = -1;
+    if (get_context.result.status != S3StatusOK || status == 0) {
+        // an empty object is returned as a NULL buffer
         if (get_context.buf) {
             free (get_context.buf);
         }
-        printError();
+        get_context.buf = NULL;
+    }
+    if (get_context.result.status == S3StatusErrorNoSuchKey ||
+        get_context.result.status == S3StatusHttpErrorNotFound) {
+        status = S3FS_NOT_FOUND;
+    } else if (get_context.result.status != S3StatusOK) {
+        status = -1;
+        printError(&get_context.result);
     } else {
         *buf = get_context.buf; 
+        if (info) {
+            *info = get_context.result.info;
+        }
     }
 
-    S3_deinitialize();
-
     return status;
 }
 
+static ssize_t get_object_striped(const char *bucketName, const char *key,
+                                  uint8_t *dst, size_t dst_len, off_t offset,
+                                  s3fs_object_info_t *info);
 
-int s3fs_remove_object(const char *bucketName, const char *key) {
-    s3fs_lock();
-    int rv = __s3fs_remove_object(bucketName, key);
-    s3fs_unlock();
-    return rv;
+ssize_t s3fs_get_object_into(const char *bucketName, const char *key,
+                             uint8_t *dst, size_t dst_len, off_t offset) {
+    return s3fs_get_object_into_if_changed(bucketName, key, dst, dst_len,
+                                           offset, NULL, NULL);
 }
 
-int __s3fs_remove_object(const char *bucketName, const char *key) {
-    S3_init();
+ssize_t s3fs_get_object_into_if_changed(const char *bucketName,
+                                        const char *key, uint8_t *dst,
+                                        size_t dst_len, off_t offset,
+                                        const char *etag,
+                                        s3fs_object_info_t *info) {
+    if (dst_len == 0) {
+        return 0;
+    }
+    // a revalidation is expected to come back 304, so it isn't striped
+    if (!etag && stripeConcurrencyG > 1 && dst_len > stripeSizeG) {
+        return get_object_striped(bucketName, key, dst, dst_len, offset,
+                                  info);
+    }
+
+    struct get_callback_data get_context;
+    memset(&get_context, 0, sizeof(get_context));
+    get_context.buf = dst;
+    get_context.capacity = dst_len;
+    get_context.fixed = 1;
+
+    run_get(bucketName, key, offset, dst_len, etag, &get_context);
+
+    if (not_modified(bucketName, key, &get_context, etag)) {
+        fill_not_modified(info, etag);
+        return S3FS_NOT_MODIFIED;
+    }
+    if (get_context.result.status == S3StatusErrorInvalidRange) {
+        // offset is at or past the end of the object
+        return 0;
+    }
+    if (get_context.result.status != S3StatusOK) {
+        printError(&get_context.result);
+        return -1;
+    }
+    if (info) {
+        *info = get_context.result.info;
+    }
+    return get_context.bytes_read;
+}
+
+// striped get ---------------------------------------------------------------
+
+void s3fs_set_striping(uint64_t stripe_size, int concurrency) {
+    stripeSizeG = stripe_size > 0 ? stripe_size : S3FS_DEFAULT_STRIPE_SIZE;
+    stripeConcurrencyG = concurrency;
+}
+
+// One sub-range of a striped GET
+typedef struct get_stripe
+{
+    struct get_callback_data data; // first, for the shared callbacks
+    uint8_t *dst;
+    uint64_t start, length;
+    int active;
+    retry_state retry;
+} get_stripe;
+
+static void start_stripe(const S3BucketContext *bucketContext,
+                         const char *key,
+                         const S3GetObjectHandler *getObjectHandler,
+                         S3RequestContext *requestContext,
+                         get_stripe *stripe)
+{
+    memset(&stripe->data, 0, sizeof(stripe->data));
+    init_result(&stripe->data.result);
+    stripe->data.buf = stripe->dst;
+    stripe->data.capacity = stripe->length;
+    stripe->data.fixed = 1;
+    stripe->active = 1;
+
+    S3_get_object(bucketContext, key, 0, stripe->start, stripe->length,
+                  requestContext, getObjectHandler, &stripe->data);
+}
+
+// Split [offset, offset + dst_len) into stripeSizeG-byte sub-ranges and
+// GET up to stripeConcurrencyG of them at once, each straight into its
+// place in dst.  A stripe that ends short marks the end of the object, so
+// no stripes after it are started.
+static ssize_t get_object_striped(const char *bucketName, const char *key,
+                                  uint8_t *dst, size_t dst_len, off_t offset,
+                                  s3fs_object_info_t *info)
+{
     S3BucketContext bucketContext =
     {
         0,
@@ -741,24 +1816,194 @@ int __s3fs_remove_object(const char *bucketName, const char *key) {
         secretAccessKeyG
     };
 
-    S3ResponseHandler responseHandler =
-    { 
+    S3GetObjectHandler getObjectHandler =
+    {
+        { &getObjectPropertiesCallback, &responseCompleteCallback },
+        &getObjectDataCallback
+    };
+
+    int count = (dst_len + stripeSizeG - 1) / stripeSizeG, i;
+    get_stripe *stripes = calloc(count, sizeof(get_stripe));
+    if (!stripes) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        stripes[i].start = offset + (uint64_t) i * stripeSizeG;
+        stripes[i].dst = dst + (uint64_t) i * stripeSizeG;
+        stripes[i].length = dst_len - (uint64_t) i * stripeSizeG;
+        if (stripes[i].length > stripeSizeG) {
+            stripes[i].length = stripeSizeG;
+        }
+    }
+
+    S3RequestContext *requestContext = acquire_context();
+    int next = 0, active = 0, failed = 0, last = count;
+    while (!failed && ((next < last) || active)) {
+        for (; active < stripeConcurrencyG && next < last; next++) {
+            retry_init(&stripes[next].retry, retryAttemptsG);
+            start_stripe(&bucketContext, key, &getObjectHandler,
+                         requestContext, &stripes[next]);
+            active++;
+        }
+
+        // reissue any retries that are due; if there are only retries
+        // waiting, sleep until the first is due
+        int64_t now = now_ms(), wakeAt = 0;
+        int running = 0;
+        for (i = 0; i < next; i++) {
+            get_stripe *stripe = &stripes[i];
+            if (stripe->active && stripe->retry.notBefore &&
+                retry_due(&stripe->retry, now, &wakeAt)) {
+                start_stripe(&bucketContext, key, &getObjectHandler,
+                             requestContext, stripe);
+            }
+            running += stripe->active && !stripe->retry.notBefore;
+        }
+        if (!running) {
+            sleep_until(wakeAt);
+            continue;
+        }
+
+        if (drive_context(requestContext) < 0) {
+            failed = 1;
+            break;
+        }
+
+        for (i = 0; i < next; i++) {
+            get_stripe *stripe = &stripes[i];
+            if (!stripe->active || stripe->retry.notBefore ||
+                !stripe->data.result.completed) {
+                continue;
+            }
+            S3Status status = stripe->data.result.status;
+            if (status == S3StatusOK || status == S3StatusErrorInvalidRange) {
+                if (status == S3StatusErrorInvalidRange) {
+                    // wholly past the end of the object
+                    stripe->data.bytes_read = 0;
+                }
+                if ((uint64_t) stripe->data.bytes_read < stripe->length &&
+                    i + 1 < last) {
+                    last = i + 1;
+                }
+                stripe->active = 0;
+                active--;
+            }
+            else if (retry_schedule(&stripe->retry, status)) {
+                continue;
+            }
+            else {
+                printError(&stripe->data.result);
+                failed = 1;
+            }
+        }
+    }
+
+    // let any stripes still in flight finish before the context is reused
+    while (active && drive_context(requestContext) > 0) {
+    }
+    release_context(requestContext);
+
+    ssize_t total = 0;
+    if (!failed) {
+        for (i = 0; i < last; i++) {
+            total += stripes[i].data.bytes_read;
+            if ((uint64_t) stripes[i].data.bytes_read < stripes[i].length) {
+                break;
+            }
+        }
+        if (info) {
+            *info = stripes[0].data.result.info;
+            info->content_length = total;
+        }
+    }
+    free(stripes);
+    return failed ? -1 : total;
+}
+
+
+// head object ---------------------------------------------------------------
+
+int s3fs_head_object(const char *bucketName, const char *key,
+                     s3fs_object_info_t *info) {
+    S3BucketContext bucketContext =
+    {
         0,
+        bucketName,
+        protocolG,
+        uriStyleG,
+        accessKeyIdG,
+        secretAccessKeyG
+    };
+
+    S3ResponseHandler responseHandler =
+    {
+        &responsePropertiesCallback,
         &responseCompleteCallback
     };
 
+    request_result result;
+    retry_state retry;
+    retry_init(&retry, retryAttemptsG);
     do {
-        S3_delete_object(&bucketContext, key, 0, &responseHandler, 0);
-    } while (S3_status_is_retryable(statusG) && should_retry());
-
-    int result = statusG == S3StatusOK ? 0 : -1;
+        init_result(&result);
+        S3RequestContext *requestContext = acquire_context();
+        S3_head_object(&bucketContext, key, requestContext,
+                       &responseHandler, &result);
+        run_context(requestContext, &result);
+        release_context(requestContext);
+    } while (should_retry(&retry, result.status));
+
+    if (result.status != S3StatusOK) {
+        // a HEAD response has no body, so a missing key is just a 404
+        if (result.status != S3StatusErrorNoSuchKey &&
+            result.status != S3StatusHttpErrorNotFound) {
+            printError(&result);
+        }
+        return -1;
+    }
 
-    if ((statusG != S3StatusOK) &&
-        (statusG != S3StatusErrorPreconditionFailed)) {
-        printError();
+    if (info) {
+        *info = result.info;
     }
+    return 0;
+}
 
-    S3_deinitialize();
 
-    return result;    
+int s3fs_remove_object(const char *bucketName, const char *key) {
+    S3BucketContext bucketContext =
+    {
+        0,
+        bucketName,
+        protocolG,
+        uriStyleG,
+        accessKeyIdG,
+        secretAccessKeyG
+    };
+
+    S3ResponseHandler responseHandler =
+    { 
+        0,
+        &responseCompleteCallback
+    };
+
+    request_result result;
+    retry_state retry;
+    retry_init(&retry, retryAttemptsG);
+    do {
+        init_result(&result);
+        S3RequestContext *requestContext = acquire_context();
+        S3_delete_object(&bucketContext, key, requestContext,
+                         &responseHandler, &result);
+        run_context(requestContext, &result);
+        release_context(requestContext);
+    } while (should_retry(&retry, result.status));
+
+    int rv = result.status == S3StatusOK ? 0 : -1;
+
+    if ((result.status != S3StatusOK) &&
+        (result.status != S3StatusErrorPreconditionFailed)) {
+        printError(&result);
+    }
+
+    return rv;    
 }
@@ -12,8 +12,20 @@
 
 #include "libs3.h"
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <stdint.h>
 
+#define S3FS_ETAG_SIZE 64
+
+/*
+ * Object metadata reported by s3 along with a response.
+ */
+typedef struct {
+    int64_t content_length; // object (or range) size, -1 if not reported
+    int64_t last_modified;  // seconds since the epoch, -1 if not reported
+    char etag[S3FS_ETAG_SIZE]; // quoted ETag, or "" if not reported
+} s3fs_object_info_t;
+
 /* 
  * Initialize credentials.  This function looks for two shell environment
  * variables: "S3_ACCESS_KEY_ID" and "S3_SECRET_ACCESS_KEY".  If they
@@ -23,6 +35,49 @@
  */
 int s3fs_init_credentials();
 
+/*
+ * Default number of requests that may be in flight at once.
+ */
+#define S3FS_DEFAULT_MAX_REQUESTS 16
+
+/*
+ * Initialize libs3 and a pool of max_requests request contexts (or
+ * S3FS_DEFAULT_MAX_REQUESTS if max_requests <= 0).  Each context keeps its
+ * connections open between requests, and up to max_requests threads may
+ * have a request in flight at once.  The optional "S3_HOSTNAME" and
+ * "S3_PROTOCOL" ("http" or "https") shell environment variables select
+ * the endpoint.  This function must be called once, after
+ * s3fs_init_credentials and before any other library functions.
+ * Returns 0 on success and -1 on error.
+ */
+int s3fs_initialize(int max_requests);
+
+/*
+ * Release the request context pool and shut down libs3.  No requests may
+ * be in flight when this is called.
+ */
+void s3fs_deinitialize();
+
+/*
+ * Default retry policy: see s3fs_set_retry.
+ */
+#define S3FS_DEFAULT_RETRY_ATTEMPTS 5
+#define S3FS_DEFAULT_RETRY_BASE_DELAY 100     // ms
+#define S3FS_DEFAULT_RETRY_MAX_DELAY 10000    // ms
+#define S3FS_DEFAULT_RETRY_DEADLINE 60000     // ms
+
+/*
+ * Configure how requests that fail with a transient error are retried.
+ * Each request is retried up to attempts times.  Before retry n (counting
+ * from 0) it waits a random time of up to base_delay_ms * 2^n, capped at
+ * max_delay_ms.  A request is not retried once deadline_ms have passed
+ * since it was first issued (0 means no deadline).  A request waiting to
+ * be retried does not hold up other requests.  Call this before any
+ * requests are started.
+ */
+void s3fs_set_retry(int attempts, int base_delay_ms, int max_delay_ms,
+                    int deadline_ms);
+
 /*
  * Given a bucket name, test whether we can access the bucket on s3.  This
  * function returns 0 on success and -1 on error.  There is also a reason
@@ -37,6 +92,11 @@ int s3fs_test_bucket(const char *bucket);
  */
 int s3fs_clear_bucket(const char *bucket);  
 
+/*
+ * Returned by the s3fs_get_object functions when there is no such object.
+ */
+#define S3FS_NOT_FOUND (-3)
+
 /*
  * Get/read an object from s3 in a given bucket, identified by the given key.
  *
@@ -47,13 +107,84 @@ int s3fs_clear_bucket(const char *bucket);
  * start_byte is the starting byte to read from, byte_count is the number of
  * bytes to read.  If both values are 0, the *entire* object is retrieved.
  *
- * Returns the number of bytes read, or -1 on error.  If the object contains
- * 0 bytes, *buf will point to NULL, and the return value will be 0.  Thus
- * a return value of 0 or greater means *success*.
+ * Returns the number of bytes read, S3FS_NOT_FOUND if there is no such
+ * object, or -1 on any other error.  If the object contains 0 bytes, *buf
+ * will point to NULL, and the return value will be 0.  Thus a return value
+ * of 0 or greater means *success*.
  */
 ssize_t s3fs_get_object(const char *bucket, const char *key, uint8_t **buf, 
                         ssize_t start_byte, ssize_t byte_count);
 
+/*
+ * Same as s3fs_get_object, but on success also fills in *info (if info is
+ * not NULL) with the ETag, Content-Length and Last-Modified time that s3
+ * reported for the object.
+ */
+ssize_t s3fs_get_object_info(const char *bucket, const char *key,
+                             uint8_t **buf, ssize_t start_byte,
+                             ssize_t byte_count, s3fs_object_info_t *info);
+
+/*
+ * Returned by the *_if_changed functions when the object has not changed.
+ */
+#define S3FS_NOT_MODIFIED (-2)
+
+/*
+ * Conditional form of s3fs_get_object_info, for revalidating a copy the
+ * caller already has.  etag is the ETag of that copy, as reported in info
+ * by an earlier call.  If the object's ETag still matches, nothing is
+ * downloaded, *buf is left alone, and S3FS_NOT_MODIFIED is returned (with
+ * info->etag set to etag).  Otherwise this behaves like
+ * s3fs_get_object_info.  A NULL etag makes the GET unconditional.
+ *
+ * libs3 reports a 304 only as an unknown HTTP error, without its headers,
+ * so one is confirmed with a HEAD of the object before S3FS_NOT_MODIFIED
+ * is returned: an unchanged object costs two small requests.
+ */
+ssize_t s3fs_get_object_if_changed(const char *bucket, const char *key,
+                                   uint8_t **buf, ssize_t start_byte,
+                                   ssize_t byte_count, const char *etag,
+                                   s3fs_object_info_t *info);
+
+/*
+ * Read up to dst_len bytes of an object, starting at byte offset, directly
+ * into the caller's buffer dst.  No buffer is allocated and the data is
+ * not copied again after it arrives.  Large reads are striped across
+ * several connections (see s3fs_set_striping).
+ *
+ * Returns the number of bytes read, which is less than dst_len only at the
+ * end of the object (0 if offset is at or past the end), or -1 on error.
+ */
+ssize_t s3fs_get_object_into(const char *bucket, const char *key,
+                             uint8_t *dst, size_t dst_len, off_t offset);
+
+/*
+ * Conditional form of s3fs_get_object_into, for revalidating a range the
+ * caller already has (see s3fs_get_object_if_changed).  Returns
+ * S3FS_NOT_MODIFIED if the object's ETag still matches etag; dst is then
+ * untouched.  On success, *info (if not NULL) is filled in as for
+ * s3fs_get_object_info.  Conditional reads are never striped.
+ */
+ssize_t s3fs_get_object_into_if_changed(const char *bucket, const char *key,
+                                        uint8_t *dst, size_t dst_len,
+                                        off_t offset, const char *etag,
+                                        s3fs_object_info_t *info);
+
+/*
+ * Defaults for s3fs_set_striping.
+ */
+#define S3FS_DEFAULT_STRIPE_SIZE (8 * 1024 * 1024)
+#define S3FS_DEFAULT_STRIPE_CONCURRENCY 4
+
+/*
+ * Configure striped GETs.  s3fs_get_object_into splits reads of more than
+ * stripe_size bytes into stripe_size-byte ranges and fetches up to
+ * concurrency of them at once, over separate connections, reassembling
+ * them in place in the destination buffer.  A concurrency of 1 or less
+ * turns striping off.  Call this before any reads are started.
+ */
+void s3fs_set_striping(uint64_t stripe_size, int concurrency);
+
 /* 
  * Write a full object to s3.  The object is written to the given bucket,
  * with the given key.  Only writing of complete files/objects is
@@ -68,6 +199,96 @@ ssize_t s3fs_get_object(const char *bucket, const char *key, uint8_t **buf,
 ssize_t s3fs_put_object(const char *bucket, const char *key, 
                         const uint8_t *buf, ssize_t byte_count); 
 
+/*
+ * Same as s3fs_put_object, but on success also fills in *info (if info is
+ * not NULL) with the ETag that s3 reported for the new object, so that a
+ * copy kept by the caller can be revalidated later.
+ */
+ssize_t s3fs_put_object_info(const char *bucket, const char *key,
+                             const uint8_t *buf, ssize_t byte_count,
+                             s3fs_object_info_t *info);
+
+/*
+ * Supplies the data for a streaming put.  Copy up to len bytes of the
+ * object, starting at object byte offset, into buf, and return the number
+ * of bytes copied.  Returning 0 before the end of the object, or -1,
+ * aborts the put.  Make no assumption about the order of the calls: a
+ * multipart upload asks for each part's range from its own request, so
+ * calls may come out of order and from several threads at once, and a
+ * retried request asks for its range again from the start.  A producer
+ * must therefore be safe to call concurrently and work out everything
+ * from offset, keeping no cursor between calls.
+ */
+typedef ssize_t (*s3fs_put_producer_t)(void *arg, uint64_t offset,
+                                       uint8_t *buf, size_t len);
+
+/*
+ * Write a byte_count-byte object to s3, pulling the data from producer as
+ * it is sent.  The object never has to be held in memory in one piece, so
+ * this is the way to upload from scattered pages, a spill file or an mmap.
+ *
+ * This function returns the number of bytes written, or -1 on error.
+ */
+ssize_t s3fs_put_object_stream(const char *bucket, const char *key,
+                               uint64_t byte_count,
+                               s3fs_put_producer_t producer, void *arg);
+
+/*
+ * Write an object made of the concatenation of iovcnt buffers.  Returns
+ * the number of bytes written, or -1 on error.
+ */
+ssize_t s3fs_put_object_iov(const char *bucket, const char *key,
+                            const struct iovec *iov, int iovcnt);
+
+/*
+ * Write an object from byte_count bytes of the open file fd, starting at
+ * file offset start.  The file offset of fd is not changed.  Returns the
+ * number of bytes written, or -1 on error.
+ */
+ssize_t s3fs_put_object_fd(const char *bucket, const char *key, int fd,
+                           off_t start, uint64_t byte_count);
+
+/*
+ * Defaults for s3fs_set_multipart.
+ */
+#define S3FS_DEFAULT_MULTIPART_THRESHOLD (64 * 1024 * 1024)
+#define S3FS_DEFAULT_MULTIPART_PART_SIZE (16 * 1024 * 1024)
+#define S3FS_DEFAULT_MULTIPART_CONCURRENCY 4
+#define S3FS_DEFAULT_MULTIPART_RETRIES 3
+
+/*
+ * Configure multipart uploads.  The s3fs_put_object* functions upload
+ * objects of threshold bytes or more (0 means never) with s3's multipart
+ * API: the object is cut into part_size-byte parts (raised if need be to
+ * s3's 5 MiB minimum and 10000-part maximum), up to concurrency parts are
+ * in flight at once, and a part that fails is retried on its own, up to
+ * part_retries times.  Call this before any uploads are started.
+ */
+void s3fs_set_multipart(uint64_t threshold, uint64_t part_size,
+                        int concurrency, int part_retries);
+
+/*
+ * Copy an object to dest_key in the same bucket, within s3: none of the
+ * object's data passes through this host.  Objects over 5 GB are copied
+ * with a multipart copy, in parts that are copied concurrently (see
+ * s3fs_set_multipart).
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+int s3fs_copy_object(const char *bucket, const char *key,
+                     const char *dest_key);
+
+/*
+ * Fetch the metadata of an object (its size, ETag and last-modified time)
+ * into info with a HEAD request, without downloading its contents.  Use
+ * this to check that an object exists.
+ *
+ * Returns 0 on success and -1 on failure, including when there is no such
+ * object.
+ */
+int s3fs_head_object(const char *bucket, const char *key,
+                     s3fs_object_info_t *info);
+
 /* 
  * Remove a given object from the given bucket.
  *
@@ -20,7 +20,13 @@ int main(int argc, char **argv) {
      *  - Test the bucket (ensure basic connectivity)
      *  - Clear the bucket
      *  - Create an object
+     *  - Fetch the object's metadata and verify it
+     *  - Revalidate the object by its ETag; it should not be sent again,
+     *    whole or as a range, unless the ETag is out of date
      *  - Get the object and verify it
+     *  - Read a range of the object into a buffer and verify it
+     *  - Put the object again from an iovec and verify it
+     *  - Copy the object and verify the copy
      *  - Remove the object
      *  - Try to get the object again, it should fail.
      *  - Done.
@@ -47,6 +53,11 @@ int main(int argc, char **argv) {
         printf("Failed to initialize S3 credentials.\n");
         return -1;
     }
+
+    if (s3fs_initialize(0) < 0) {
+        printf("Failed to initialize libs3 (s3fs_initialize)\n");
+        return -1;
+    }
  
     if (s3fs_test_bucket(s3bucket) < 0) {
         printf("Failed to connect to bucket (s3fs_test_bucket)\n");
@@ -73,6 +84,45 @@ int main(int argc, char **argv) {
         printf("Successfully put test object in s3 (s3fs_put_object)\n");
     }
 
+    // s3fs_head_object fetches the size (and ETag) without the contents
+    s3fs_object_info_t info;
+    if (s3fs_head_object(s3bucket, test_key, &info) < 0) {
+        printf("Failure in s3fs_head_object\n");
+    } else if (info.content_length != object_length || !info.etag[0]) {
+        printf("Unexpected metadata for test object (s3fs_head_object %d)\n", (int)info.content_length);
+    } else {
+        printf("Successfully fetched test object metadata (s3fs_head_object)\n");
+    }
+
+    // s3fs_get_object_if_changed only downloads an object that changed
+    uint8_t *unchanged = NULL;
+    rv = s3fs_get_object_if_changed(s3bucket, test_key, &unchanged, 0, 0, info.etag, NULL);
+    if (rv != S3FS_NOT_MODIFIED) {
+        printf("Revalidation of unchanged test object failed (s3fs_get_object_if_changed %d)\n", (int)rv);
+        free(unchanged);
+    } else {
+        printf("Successfully revalidated test object (s3fs_get_object_if_changed)\n");
+    }
+
+    char unchanged_range[8];
+    rv = s3fs_get_object_into_if_changed(s3bucket, test_key, (uint8_t*)unchanged_range,
+                                         sizeof(unchanged_range), 0, info.etag, NULL);
+    if (rv != S3FS_NOT_MODIFIED) {
+        printf("Revalidation of unchanged test object range failed (s3fs_get_object_into_if_changed %d)\n", (int)rv);
+    } else {
+        printf("Successfully revalidated test object range (s3fs_get_object_into_if_changed)\n");
+    }
+
+    // an out-of-date ETag gets the object sent again
+    uint8_t *changed = NULL;
+    rv = s3fs_get_object_if_changed(s3bucket, test_key, &changed, 0, 0, "\"not-the-etag\"", NULL);
+    if (rv != object_length || memcmp(changed, test_object, object_length) != 0) {
+        printf("Revalidation of test object by a stale ETag failed (s3fs_get_object_if_changed %d)\n", (int)rv);
+    } else {
+        printf("Successfully refetched test object by a stale ETag (s3fs_get_object_if_changed)\n");
+    }
+    free(changed);
+
     uint8_t *retrieved_object = NULL;
     // zeroes as last two args means that we want to retrieve entire object
     rv = s3fs_get_object(s3bucket, test_key, &retrieved_object, 0, 0);
@@ -95,6 +145,52 @@ int main(int argc, char **argv) {
         free (retrieved_object);
     }
 
+    // s3fs_get_object_into reads a range straight into our own buffer
+    char range[8];
+    rv = s3fs_get_object_into(s3bucket, test_key, (uint8_t*)range, sizeof(range), 10);
+    if (rv != sizeof(range)) {
+        printf("Failed to read range of test object (s3fs_get_object_into %d)\n", (int)rv);
+    } else if (memcmp(range, test_object + 10, sizeof(range)) != 0) {
+        printf("Range read doesn't match what we sent?!\n");
+    } else {
+        printf("Successfully read a range of the test object (s3fs_get_object_into)\n");
+    }
+
+    // s3fs_put_object_iov uploads scattered buffers as one object
+    struct iovec iov[2] = {
+        { (void *)test_object, 10 },
+        { (void *)(test_object + 10), object_length - 10 }
+    };
+    rv = s3fs_put_object_iov(s3bucket, test_key, iov, 2);
+    if (rv != object_length) {
+        printf("Failed to upload test object from an iovec (s3fs_put_object_iov %d)\n", (int)rv);
+    } else {
+        retrieved_object = NULL;
+        rv = s3fs_get_object(s3bucket, test_key, &retrieved_object, 0, 0);
+        if (rv == object_length && strcmp((const char *)retrieved_object, test_object) == 0) {
+            printf("Successfully put test object from an iovec (s3fs_put_object_iov)\n");
+        } else {
+            printf("Object put from an iovec doesn't match what we sent?!\n");
+        }
+        free(retrieved_object);
+    }
+
+    // s3fs_copy_object copies the object within s3
+    const char *copy_key = "thekey-copy";
+    if (s3fs_copy_object(s3bucket, test_key, copy_key) < 0) {
+        printf("Failure in s3fs_copy_object\n");
+    } else {
+        retrieved_object = NULL;
+        rv = s3fs_get_object(s3bucket, copy_key, &retrieved_object, 0, 0);
+        if (rv == object_length && strcmp((const char *)retrieved_object, test_object) == 0) {
+            printf("Successfully copied test object (s3fs_copy_object)\n");
+        } else {
+            printf("Copied object doesn't match what we sent?!\n");
+        }
+        free(retrieved_object);
+        s3fs_remove_object(s3bucket, copy_key);
+    }
+
     if (s3fs_remove_object(s3bucket, test_key) < 0) {
         printf("Failure to remove test object (s3fs_remove_object)\n");
     } else {
@@ -102,12 +198,14 @@ int main(int argc, char **argv) {
     }
 
     rv = s3fs_get_object(s3bucket, test_key, &retrieved_object, 0, 0);
-    if (rv == -1) {
+    if (rv == S3FS_NOT_FOUND) {
         printf("Got expected failure in trying to retrieve test object after removing it\n");
     } else {
         printf("Unexpected return value in trying to retrieve an already-removed object: %d\n", rv);
     }
 
+    s3fs_deinitialize();
+
     printf("Done with s3fs tests.  Share and enjoy.\n");
     return 0;
 }
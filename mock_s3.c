@@ -0,0 +1,757 @@
+/*
+ * mock_s3.c, a tiny in-process S3 endpoint used by s3fs_bench to measure
+ * the libs3 wrapper against a local backend.  See mock_s3.h.
+ */
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mock_s3.h"
+
+#define MOCK_HASH_SIZE 4096
+#define MOCK_LIST_MAX 1000
+#define MOCK_IOBUF_SIZE (64 * 1024)
+#define MOCK_MAX_UPLOADS 64
+#define MOCK_MAX_PARTS 10000
+
+struct mock_object {
+    char *key;
+    uint64_t size;
+    struct mock_object *next;
+};
+
+// An in-progress multipart upload; id 0 marks a free slot
+struct mock_upload {
+    unsigned id;
+    uint64_t partSizes[MOCK_MAX_PARTS + 1];
+};
+
+static struct mock_object *objectsG[MOCK_HASH_SIZE];
+static struct mock_upload *uploadsG[MOCK_MAX_UPLOADS];
+static unsigned nextUploadIdG = 1;
+static pthread_mutex_t objects_lock = PTHREAD_MUTEX_INITIALIZER;
+static int listenFdG = -1;
+static int latencyG = 0;
+static uint64_t requestsG = 0;
+
+// object table --------------------------------------------------------------
+
+static unsigned hash_key(const char *key)
+{
+    unsigned h = 5381;
+    while (*key) {
+        h = h * 33 + (unsigned char) *key++;
+    }
+    return h % MOCK_HASH_SIZE;
+}
+
+// Look up key; returns its size, or -1 if there is no such object.
+static int64_t lookup_object(const char *key)
+{
+    int64_t size = -1;
+    pthread_mutex_lock(&objects_lock);
+    struct mock_object *obj = objectsG[hash_key(key)];
+    for (; obj; obj = obj->next) {
+        if (!strcmp(obj->key, key)) {
+            size = obj->size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&objects_lock);
+    return size;
+}
+
+void mock_s3_set_object(const char *key, uint64_t size) {
+    pthread_mutex_lock(&objects_lock);
+    struct mock_object **slot = &(objectsG[hash_key(key)]);
+    struct mock_object *obj = *slot;
+    for (; obj; obj = obj->next) {
+        if (!strcmp(obj->key, key)) {
+            break;
+        }
+    }
+    if (!obj) {
+        obj = malloc(sizeof(struct mock_object));
+        obj->key = strdup(key);
+        obj->next = *slot;
+        *slot = obj;
+    }
+    obj->size = size;
+    pthread_mutex_unlock(&objects_lock);
+}
+
+static int remove_object(const char *key)
+{
+    int found = 0;
+    pthread_mutex_lock(&objects_lock);
+    struct mock_object **slot = &(objectsG[hash_key(key)]);
+    for (; *slot; slot = &((*slot)->next)) {
+        if (!strcmp((*slot)->key, key)) {
+            struct mock_object *obj = *slot;
+            *slot = obj->next;
+            free(obj->key);
+            free(obj);
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&objects_lock);
+    return found;
+}
+
+// multipart uploads ---------------------------------------------------------
+
+static unsigned create_upload()
+{
+    unsigned id = 0;
+    int i;
+    pthread_mutex_lock(&objects_lock);
+    for (i = 0; i < MOCK_MAX_UPLOADS; i++) {
+        if (!uploadsG[i]) {
+            uploadsG[i] = calloc(1, sizeof(struct mock_upload));
+            id = uploadsG[i]->id = nextUploadIdG++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&objects_lock);
+    return id;
+}
+
+// Record a part; returns -1 if there is no such upload.
+static int add_part(unsigned id, int partNumber, uint64_t size)
+{
+    int rv = -1, i;
+    pthread_mutex_lock(&objects_lock);
+    for (i = 0; i < MOCK_MAX_UPLOADS; i++) {
+        if (uploadsG[i] && uploadsG[i]->id == id &&
+            partNumber >= 1 && partNumber <= MOCK_MAX_PARTS) {
+            uploadsG[i]->partSizes[partNumber] = size;
+            rv = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&objects_lock);
+    return rv;
+}
+
+// Finish (or abort) an upload; returns the object size, or -1 if there is
+// no such upload.
+static int64_t end_upload(unsigned id)
+{
+    int64_t size = -1;
+    int i, part;
+    pthread_mutex_lock(&objects_lock);
+    for (i = 0; i < MOCK_MAX_UPLOADS; i++) {
+        if (uploadsG[i] && uploadsG[i]->id == id) {
+            size = 0;
+            for (part = 1; part <= MOCK_MAX_PARTS; part++) {
+                size += uploadsG[i]->partSizes[part];
+            }
+            free(uploadsG[i]);
+            uploadsG[i] = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&objects_lock);
+    return size;
+}
+
+uint64_t mock_s3_requests() {
+    return __sync_fetch_and_add(&requestsG, 0);
+}
+
+// connection i/o ------------------------------------------------------------
+
+struct mock_conn {
+    int fd;
+    size_t len;
+    char buf[MOCK_IOBUF_SIZE];
+};
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read until a full request header block is buffered; returns its length
+// (including the blank line), 0 on orderly close, -1 on error.
+static ssize_t read_headers(struct mock_conn *conn)
+{
+    for (;;) {
+        conn->buf[conn->len] = 0;
+        char *end = strstr(conn->buf, "\r\n\r\n");
+        if (end) {
+            return end + 4 - conn->buf;
+        }
+        if (conn->len >= sizeof(conn->buf) - 1) {
+            return -1;
+        }
+        ssize_t n = recv(conn->fd, conn->buf + conn->len,
+                         sizeof(conn->buf) - 1 - conn->len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n == 0 && conn->len == 0 ? 0 : -1;
+        }
+        conn->len += n;
+    }
+}
+
+// Consume headerLen bytes of header plus bodyLen bytes of (discarded) body.
+static int consume_request(struct mock_conn *conn, size_t headerLen,
+                           uint64_t bodyLen)
+{
+    size_t buffered = conn->len - headerLen;
+    size_t take = bodyLen < buffered ? bodyLen : buffered;
+    memmove(conn->buf, conn->buf + headerLen + take, buffered - take);
+    conn->len = buffered - take;
+    bodyLen -= take;
+
+    char scratch[MOCK_IOBUF_SIZE];
+    while (bodyLen) {
+        ssize_t n = recv(conn->fd, scratch, bodyLen < sizeof(scratch) ?
+                         bodyLen : sizeof(scratch), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        bodyLen -= n;
+    }
+    return 0;
+}
+
+static const char *find_header(const char *headers, const char *name)
+{
+    size_t nameLen = strlen(name);
+    const char *line = strstr(headers, "\r\n");
+    while (line && line[2] != '\r') {
+        line += 2;
+        if (!strncasecmp(line, name, nameLen) && line[nameLen] == ':') {
+            line += nameLen + 1;
+            while (*line == ' ') {
+                line++;
+            }
+            return line;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return NULL;
+}
+
+static void url_decode(char *s)
+{
+    char *out = s;
+    for (; *s; s++) {
+        if (*s == '%' && isxdigit((unsigned char) s[1]) &&
+            isxdigit((unsigned char) s[2])) {
+            char hex[3] = { s[1], s[2], 0 };
+            *out++ = (char) strtol(hex, NULL, 16);
+            s += 2;
+        }
+        else {
+            *out++ = *s;
+        }
+    }
+    *out = 0;
+}
+
+// Copy the value of query parameter name into out; returns 0 if present.
+static int query_param(const char *query, const char *name, char *out,
+                       size_t outSize)
+{
+    size_t nameLen = strlen(name);
+    while (query && *query) {
+        if (!strncmp(query, name, nameLen) &&
+            (query[nameLen] == '=' || query[nameLen] == '&' ||
+             !query[nameLen])) {
+            const char *value = query + nameLen;
+            value += *value == '=';
+            size_t len = strcspn(value, "&");
+            if (len >= outSize) {
+                len = outSize - 1;
+            }
+            memcpy(out, value, len);
+            out[len] = 0;
+            url_decode(out);
+            return 0;
+        }
+        query = strchr(query, '&');
+        query += query ? 1 : 0;
+    }
+    return -1;
+}
+
+// responses -----------------------------------------------------------------
+
+#define LAST_MODIFIED "Sun, 01 Jan 2012 00:00:00 GMT"
+#define XMLNS "xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\""
+
+static int send_response(int fd, int code, const char *reason,
+                         const char *extraHeaders, const char *body,
+                         uint64_t bodyLen)
+{
+    char head[1024];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %d %s\r\n"
+                     "x-amz-request-id: mock\r\n"
+                     "Content-Length: %llu\r\n"
+                     "%s\r\n",
+                     code, reason, (unsigned long long) bodyLen,
+                     extraHeaders ? extraHeaders : "");
+    if (send_all(fd, head, n) < 0) {
+        return -1;
+    }
+    return body ? send_all(fd, body, bodyLen) : 0;
+}
+
+static int send_error(int fd, int code, const char *reason,
+                      const char *s3code)
+{
+    char body[256];
+    int n = snprintf(body, sizeof(body),
+                     "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                     "<Error><Code>%s</Code><Message>%s</Message></Error>",
+                     s3code, reason);
+    return send_response(fd, code, reason,
+                         "Content-Type: application/xml\r\n", body, n);
+}
+
+static void etag_header(char *out, size_t outSize, const char *key,
+                        uint64_t size)
+{
+    snprintf(out, outSize, "ETag: \"%08x%016llx\"\r\n"
+             "Last-Modified: " LAST_MODIFIED "\r\n",
+             hash_key(key), (unsigned long long) size);
+}
+
+// Stream bytes [start, start + count) of an object of the mock pattern.
+static int send_pattern(int fd, uint64_t start, uint64_t count)
+{
+    uint8_t chunk[MOCK_IOBUF_SIZE];
+    while (count) {
+        size_t n = count < sizeof(chunk) ? count : sizeof(chunk);
+        size_t i;
+        for (i = 0; i < n; i++) {
+            chunk[i] = mock_s3_byte(start + i);
+        }
+        if (send_all(fd, chunk, n) < 0) {
+            return -1;
+        }
+        start += n;
+        count -= n;
+    }
+    return 0;
+}
+
+static int key_compare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// ListBucketResult of up to MOCK_LIST_MAX keys after marker.
+static int send_listing(int fd, const char *query)
+{
+    char marker[1024] = "", prefix[1024] = "";
+    query_param(query, "marker", marker, sizeof(marker));
+    query_param(query, "prefix", prefix, sizeof(prefix));
+
+    pthread_mutex_lock(&objects_lock);
+    size_t count = 0, cap = 1024, i;
+    char **keys = malloc(cap * sizeof(char *));
+    for (i = 0; i < MOCK_HASH_SIZE; i++) {
+        struct mock_object *obj = objectsG[i];
+        for (; obj; obj = obj->next) {
+            if (strcmp(obj->key, marker) <= 0 ||
+                strncmp(obj->key, prefix, strlen(prefix))) {
+                continue;
+            }
+            if (count == cap) {
+                cap *= 2;
+                keys = realloc(keys, cap * sizeof(char *));
+            }
+            keys[count] = strdup(obj->key);
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&objects_lock);
+    qsort(keys, count, sizeof(char *), key_compare);
+
+    size_t shown = count < MOCK_LIST_MAX ? count : MOCK_LIST_MAX;
+    size_t bodyCap = 512 + shown * 1280, len = 0;
+    char *body = malloc(bodyCap);
+    len += snprintf(body + len, bodyCap - len,
+                    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                    "<ListBucketResult " XMLNS "><Name>mock</Name>"
+                    "<MaxKeys>%d</MaxKeys><IsTruncated>%s</IsTruncated>",
+                    MOCK_LIST_MAX, count > shown ? "true" : "false");
+    for (i = 0; i < shown; i++) {
+        len += snprintf(body + len, bodyCap - len,
+                        "<Contents><Key>%s</Key>"
+                        "<LastModified>2012-01-01T00:00:00.000Z"
+                        "</LastModified><ETag>&quot;mock&quot;</ETag>"
+                        "<Size>0</Size><StorageClass>STANDARD"
+                        "</StorageClass></Contents>", keys[i]);
+    }
+    len += snprintf(body + len, bodyCap - len, "</ListBucketResult>");
+
+    int rv = send_response(fd, 200, "OK",
+                           "Content-Type: application/xml\r\n", body, len);
+    for (i = 0; i < count; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+    free(body);
+    return rv;
+}
+
+static int handle_bucket(int fd, const char *method, const char *query)
+{
+    if (strcmp(method, "GET")) {
+        return send_response(fd, 200, "OK", NULL, NULL, 0);
+    }
+    if (query && !strncmp(query, "location", 8)) {
+        const char *body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<LocationConstraint " XMLNS "></LocationConstraint>";
+        return send_response(fd, 200, "OK",
+                             "Content-Type: application/xml\r\n",
+                             body, strlen(body));
+    }
+    return send_listing(fd, query);
+}
+
+// Size of the object named by an x-amz-copy-source header ("/bucket/key"),
+// or of the x-amz-copy-source-range within it; -1 if there is no copy
+// source, -2 if it doesn't exist.
+static int64_t copy_source_size(const char *headers)
+{
+    const char *source = find_header(headers, "x-amz-copy-source");
+    if (!source) {
+        return -1;
+    }
+    char key[1024];
+    size_t len = strcspn(source, "\r");
+    if (len >= sizeof(key)) {
+        len = sizeof(key) - 1;
+    }
+    memcpy(key, source, len);
+    key[len] = 0;
+    url_decode(key);
+    char *slash = strchr(key + 1, '/');
+    int64_t size = slash ? lookup_object(slash + 1) : -1;
+    if (size < 0) {
+        return -2;
+    }
+
+    const char *range = find_header(headers, "x-amz-copy-source-range");
+    unsigned long long first, last;
+    if (range && sscanf(range, "bytes=%llu-%llu", &first, &last) == 2 &&
+        first <= last && last < (uint64_t) size) {
+        size = last - first + 1;
+    }
+    return size;
+}
+
+static int handle_multipart(int fd, const char *method, const char *key,
+                            const char *query, const char *headers,
+                            uint64_t bodyLen)
+{
+    char hdrs[512], body[1024], value[64];
+    int n;
+
+    if (!strcmp(method, "POST") && !query_param(query, "uploads", value,
+                                                sizeof(value))) {
+        unsigned id = create_upload();
+        if (!id) {
+            return send_error(fd, 503, "Slow Down", "SlowDown");
+        }
+        n = snprintf(body, sizeof(body),
+                     "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                     "<InitiateMultipartUploadResult " XMLNS ">"
+                     "<Bucket>mock</Bucket><Key>%s</Key>"
+                     "<UploadId>%u</UploadId>"
+                     "</InitiateMultipartUploadResult>", key, id);
+        return send_response(fd, 200, "OK",
+                             "Content-Type: application/xml\r\n", body, n);
+    }
+
+    if (query_param(query, "uploadId", value, sizeof(value))) {
+        return send_error(fd, 400, "Bad Request", "InvalidRequest");
+    }
+    unsigned id = strtoul(value, NULL, 10);
+
+    if (!strcmp(method, "PUT") && !query_param(query, "partNumber", value,
+                                               sizeof(value))) {
+        int partNumber = atoi(value);
+        int64_t copySize = copy_source_size(headers);
+        if (copySize == -2) {
+            return send_error(fd, 404, "Not Found", "NoSuchKey");
+        }
+        uint64_t partSize = copySize >= 0 ? (uint64_t) copySize : bodyLen;
+        if (add_part(id, partNumber, partSize) < 0) {
+            return send_error(fd, 404, "Not Found", "NoSuchUpload");
+        }
+        if (copySize >= 0) {
+            n = snprintf(body, sizeof(body),
+                         "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                         "<CopyPartResult>"
+                         "<LastModified>2012-01-01T00:00:00.000Z"
+                         "</LastModified><ETag>&quot;%08x-%d&quot;</ETag>"
+                         "</CopyPartResult>", hash_key(key), partNumber);
+            return send_response(fd, 200, "OK",
+                                 "Content-Type: application/xml\r\n",
+                                 body, n);
+        }
+        snprintf(body, sizeof(body), "%s#%d", key, partNumber);
+        etag_header(hdrs, sizeof(hdrs), body, bodyLen);
+        return send_response(fd, 200, "OK", hdrs, NULL, 0);
+    }
+
+    int64_t size = end_upload(id);
+    if (size < 0) {
+        return send_error(fd, 404, "Not Found", "NoSuchUpload");
+    }
+    if (!strcmp(method, "DELETE")) {
+        return send_response(fd, 204, "No Content", NULL, NULL, 0);
+    }
+    mock_s3_set_object(key, size);
+    n = snprintf(body, sizeof(body),
+                 "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                 "<CompleteMultipartUploadResult " XMLNS ">"
+                 "<Location>mock</Location><Bucket>mock</Bucket>"
+                 "<Key>%s</Key><ETag>&quot;%08x-mock&quot;</ETag>"
+                 "</CompleteMultipartUploadResult>", key, hash_key(key));
+    return send_response(fd, 200, "OK",
+                         "Content-Type: application/xml\r\n", body, n);
+}
+
+static int handle_object(int fd, const char *method, const char *key,
+                         const char *query, const char *headers,
+                         uint64_t bodyLen)
+{
+    char hdrs[512];
+
+    if (query && (strstr(query, "uploads") || strstr(query, "uploadId"))) {
+        return handle_multipart(fd, method, key, query, headers, bodyLen);
+    }
+
+    if (!strcmp(method, "PUT") && find_header(headers, "x-amz-copy-source")) {
+        int64_t copySize = copy_source_size(headers);
+        if (copySize < 0) {
+            return send_error(fd, 404, "Not Found", "NoSuchKey");
+        }
+        mock_s3_set_object(key, copySize);
+        char body[512];
+        int n = snprintf(body, sizeof(body),
+                         "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                         "<CopyObjectResult>"
+                         "<LastModified>2012-01-01T00:00:00.000Z"
+                         "</LastModified><ETag>&quot;%08x%016llx&quot;</ETag>"
+                         "</CopyObjectResult>", hash_key(key),
+                         (unsigned long long) copySize);
+        return send_response(fd, 200, "OK",
+                             "Content-Type: application/xml\r\n", body, n);
+    }
+    if (!strcmp(method, "PUT")) {
+        mock_s3_set_object(key, bodyLen);
+        etag_header(hdrs, sizeof(hdrs), key, bodyLen);
+        return send_response(fd, 200, "OK", hdrs, NULL, 0);
+    }
+    if (!strcmp(method, "DELETE")) {
+        remove_object(key);
+        return send_response(fd, 204, "No Content", NULL, NULL, 0);
+    }
+
+    int64_t size = lookup_object(key);
+    if (size < 0) {
+        if (!strcmp(method, "HEAD")) {
+            return send_response(fd, 404, "Not Found", NULL, NULL, 0);
+        }
+        return send_error(fd, 404, "Not Found", "NoSuchKey");
+    }
+
+    uint64_t start = 0, count = size;
+    int code = 200;
+    const char *range = find_header(headers, "Range");
+    if (range) {
+        unsigned long long first = 0, last = 0;
+        if (sscanf(range, "bytes=%llu-%llu", &first, &last) == 2 &&
+            first <= last && first < (uint64_t) size) {
+            if (last >= (uint64_t) size) {
+                last = size - 1;
+            }
+            start = first;
+            count = last - first + 1;
+            code = 206;
+        }
+        else {
+            return send_error(fd, 416, "Requested Range Not Satisfiable",
+                              "InvalidRange");
+        }
+    }
+
+    int n = 0;
+    etag_header(hdrs, sizeof(hdrs), key, size);
+    n = strlen(hdrs);
+
+    // If-None-Match: a client revalidating a copy whose ETag still matches
+    const char *ifNoneMatch = find_header(headers, "If-None-Match");
+    const char *etag = hdrs + strlen("ETag: ");
+    size_t etagLen = strcspn(etag, "\r");
+    if (ifNoneMatch && !strncmp(ifNoneMatch, etag, etagLen) &&
+        ifNoneMatch[etagLen] == '\r') {
+        return send_response(fd, 304, "Not Modified", hdrs, NULL, 0);
+    }
+    if (code == 206) {
+        snprintf(hdrs + n, sizeof(hdrs) - n,
+                 "Content-Range: bytes %llu-%llu/%llu\r\n",
+                 (unsigned long long) start,
+                 (unsigned long long) (start + count - 1),
+                 (unsigned long long) size);
+    }
+    if (send_response(fd, code, code == 206 ? "Partial Content" : "OK",
+                      hdrs, NULL, count) < 0) {
+        return -1;
+    }
+    return strcmp(method, "HEAD") ? send_pattern(fd, start, count) : 0;
+}
+
+static void *serve_connection(void *arg)
+{
+    struct mock_conn *conn = arg;
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    for (;;) {
+        ssize_t headerLen = read_headers(conn);
+        if (headerLen <= 0) {
+            break;
+        }
+        char headers[MOCK_IOBUF_SIZE];
+        memcpy(headers, conn->buf, headerLen);
+        headers[headerLen] = 0;
+
+        char method[16], uri[4096];
+        if (sscanf(headers, "%15s %4095s", method, uri) != 2) {
+            break;
+        }
+        const char *lenHeader = find_header(headers, "Content-Length");
+        uint64_t bodyLen = lenHeader ? strtoull(lenHeader, NULL, 10) : 0;
+        const char *expect = find_header(headers, "Expect");
+        if (expect && !strncasecmp(expect, "100-continue", 12)) {
+            const char *cont = "HTTP/1.1 100 Continue\r\n\r\n";
+            send_all(conn->fd, cont, strlen(cont));
+        }
+        if (consume_request(conn, headerLen, bodyLen) < 0) {
+            break;
+        }
+
+        __sync_fetch_and_add(&requestsG, 1);
+        if (latencyG > 0) {
+            usleep(latencyG);
+        }
+
+        // path-style: /bucket[/key][?query]
+        char *query = strchr(uri, '?');
+        if (query) {
+            *query++ = 0;
+        }
+        char *key = strchr(uri + 1, '/');
+        if (key) {
+            key++;
+            url_decode(key);
+        }
+        int rv = (!key || !*key) ?
+            handle_bucket(conn->fd, method, query) :
+            handle_object(conn->fd, method, key, query, headers, bodyLen);
+        if (rv < 0) {
+            break;
+        }
+    }
+
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+static void *accept_loop(void *arg)
+{
+    (void) arg;
+    for (;;) {
+        int fd = accept(listenFdG, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        struct mock_conn *conn = malloc(sizeof(struct mock_conn));
+        conn->fd = fd;
+        conn->len = 0;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, conn) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+int mock_s3_start(int latency_us) {
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int one = 1;
+
+    latencyG = latency_us;
+    listenFdG = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFdG < 0) {
+        return -1;
+    }
+    setsockopt(listenFdG, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(listenFdG, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(listenFdG, 128) < 0 ||
+        getsockname(listenFdG, (struct sockaddr *) &addr, &addrLen) < 0) {
+        close(listenFdG);
+        listenFdG = -1;
+        return -1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, accept_loop, NULL) != 0) {
+        close(listenFdG);
+        listenFdG = -1;
+        return -1;
+    }
+    pthread_detach(thread);
+    return ntohs(addr.sin_port);
+}
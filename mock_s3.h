@@ -0,0 +1,39 @@
+/*
+ * A tiny in-process S3 endpoint for benchmarking the libs3 wrapper
+ * without a network or an AWS account.
+ *
+ * It speaks just enough path-style HTTP/1.1 S3 for the wrapper:
+ * bucket location/listing, GET (with Range and If-None-Match), HEAD, PUT
+ * and DELETE of objects, server-side copies, and multipart uploads.
+ * Object bodies are not stored; an object is a size, and its contents are
+ * generated on the fly by mock_s3_byte().  Connections are kept alive, so
+ * the benchmark measures connection reuse as well.
+ */
+#ifndef __MOCK_S3_H__
+#define __MOCK_S3_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Content of every mock object at byte offset off. */
+#define mock_s3_byte(off) ((uint8_t) ((off) * 131 + 7))
+
+/*
+ * Start serving on 127.0.0.1 from a background thread.  Every response is
+ * delayed by latency_us microseconds to stand in for a network round trip.
+ * Returns the port number, or -1 on error.
+ */
+int mock_s3_start(int latency_us);
+
+/*
+ * Create (or resize) an object with the given key and size, as if it had
+ * been PUT.
+ */
+void mock_s3_set_object(const char *key, uint64_t size);
+
+/*
+ * Number of requests served since mock_s3_start.
+ */
+uint64_t mock_s3_requests();
+
+#endif // __MOCK_S3_H__
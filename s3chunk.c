@@ -0,0 +1,137 @@
+/*
+ * s3chunk.c, chunked file helpers for the s3fs project.  See s3chunk.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "s3chunk.h"
+
+#define HEADER_SIZE 24
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    p = put_u16(p, v);
+    return put_u16(p, v >> 16);
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v)
+{
+    p = put_u32(p, v);
+    return put_u32(p, v >> 32);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | (uint16_t) p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | (uint32_t) get_u16(p + 2) << 16;
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+    return get_u32(p) | (uint64_t) get_u32(p + 4) << 32;
+}
+
+
+uint32_t s3chunk_count(uint64_t size, uint32_t chunk_size)
+{
+    return (size + chunk_size - 1) / chunk_size;
+}
+
+void s3chunk_key(char *key, size_t size, uint64_t ino, uint64_t id)
+{
+    // under the file's own key, and without a "//", so it can be neither
+    // an object key nor a shard key
+    snprintf(key, size, "/ino/%016llx/%016llx", (unsigned long long) ino,
+             (unsigned long long) id);
+}
+
+ssize_t s3chunk_encode(const s3chunk_manifest_t *manifest, uint8_t **buf)
+{
+    size_t len = HEADER_SIZE + (size_t) manifest->count * 8;
+    uint8_t *p = *buf = malloc(len);
+    if (!p) {
+        return -1;
+    }
+
+    memcpy(p, S3CHUNK_MAGIC, 4);
+    p = put_u16(p + 4, S3CHUNK_VERSION);
+    p = put_u16(p, 0);
+    p = put_u32(p, manifest->chunk_size);
+    p = put_u64(p, manifest->size);
+    p = put_u32(p, manifest->count);
+
+    uint32_t i;
+    for (i = 0; i < manifest->count; i++) {
+        p = put_u64(p, manifest->ids[i]);
+    }
+    return len;
+}
+
+int s3chunk_decode(const uint8_t *buf, size_t len,
+                   s3chunk_manifest_t *manifest)
+{
+    if (len < HEADER_SIZE || memcmp(buf, S3CHUNK_MAGIC, 4) ||
+        get_u16(buf + 4) != S3CHUNK_VERSION) {
+        return -1;
+    }
+    uint32_t chunkSize = get_u32(buf + 8);
+    uint64_t size = get_u64(buf + 12);
+    uint32_t count = get_u32(buf + 20);
+    if (chunkSize == 0 || count != s3chunk_count(size, chunkSize) ||
+        len != HEADER_SIZE + (size_t) count * 8) {
+        return -1;
+    }
+
+    uint64_t *ids = calloc(count ? count : 1, sizeof(uint64_t));
+    if (!ids) {
+        return -1;
+    }
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        ids[i] = get_u64(buf + HEADER_SIZE + 8 * (size_t) i);
+    }
+    manifest->chunk_size = chunkSize;
+    manifest->size = size;
+    manifest->count = count;
+    manifest->ids = ids;
+    return 0;
+}
+
+int s3chunk_resize(s3chunk_manifest_t *manifest, uint64_t size)
+{
+    uint32_t count = s3chunk_count(size, manifest->chunk_size);
+    if (count != manifest->count) {
+        uint64_t *ids = realloc(manifest->ids,
+                                (count ? count : 1) * sizeof(uint64_t));
+        if (!ids) {
+            return -1;
+        }
+        if (count > manifest->count) {
+            memset(ids + manifest->count, 0,
+                   (count - manifest->count) * sizeof(uint64_t));
+        }
+        manifest->ids = ids;
+        manifest->count = count;
+    }
+    manifest->size = size;
+    return 0;
+}
+
+void s3chunk_free(s3chunk_manifest_t *manifest)
+{
+    free(manifest->ids);
+    manifest->ids = NULL;
+    manifest->count = 0;
+}
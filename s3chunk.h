@@ -0,0 +1,84 @@
+/*
+ * Chunked file helpers for the s3fs project.
+ *
+ * A file whose dirent has a nonzero st_chunk is stored in chunks of that
+ * many bytes rather than as one object, so that changing part of it
+ * rewrites only the chunks it touches.  Its own object (the one
+ * s3dir_object_key gives for its inode number) then holds its manifest,
+ * which maps each chunk to the object holding it.  All integers are
+ * little-endian:
+ *
+ *   header   "S3CM", u16 version (1), u16 flags (0), u32 chunk size,
+ *            u64 file size, u32 count
+ *   ids      count u64s, one per chunk: the id of the object holding it,
+ *            or 0 for a hole
+ *
+ * count is the number of chunks the file's size covers.  A hole reads as
+ * zeroes, and is not stored at all.  A chunk object holds only the bytes
+ * of its chunk that lie below the end of the file when it was stored;
+ * any after those read as zeroes.
+ *
+ * Chunk objects are never overwritten.  A changed chunk is stored under a
+ * new id, and takes effect when the manifest naming it is stored, after
+ * which the object it replaced is removed, once no read of it is in
+ * flight.  So a reader sees each chunk as of one manifest or another, and
+ * cached blocks of a chunk object (which are keyed by its id) never go
+ * stale.  All the handles that have the file open share the one copy of
+ * its manifest, so none of them is left naming a removed object.
+ */
+#ifndef __S3CHUNK_H__
+#define __S3CHUNK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define S3CHUNK_MAGIC "S3CM"
+#define S3CHUNK_VERSION 1
+
+typedef struct {
+    uint32_t chunk_size; // bytes in each chunk
+    uint64_t size;       // the file's size
+    uint32_t count;      // chunks the size covers, and entries in ids
+    uint64_t *ids;       // each chunk's object id, or 0 for a hole
+} s3chunk_manifest_t;
+
+/*
+ * Number of chunk_size-byte chunks covering size bytes.
+ */
+uint32_t s3chunk_count(uint64_t size, uint32_t chunk_size);
+
+/*
+ * Write the key of the object with id id, holding a chunk of the file
+ * with inode number ino, to key (of size bytes).
+ */
+void s3chunk_key(char *key, size_t size, uint64_t ino, uint64_t id);
+
+/*
+ * Encode manifest into a malloc'ed buffer, which *buf is set to (the
+ * caller must free it).  Returns the buffer's length, or -1 if out of
+ * memory.
+ */
+ssize_t s3chunk_encode(const s3chunk_manifest_t *manifest, uint8_t **buf);
+
+/*
+ * Decode the len-byte manifest in buf into *manifest, whose ids are
+ * malloc'ed (release them with s3chunk_free).  Returns 0 on success, or
+ * -1 if buf is not a manifest this version can read or out of memory.
+ */
+int s3chunk_decode(const uint8_t *buf, size_t len,
+                   s3chunk_manifest_t *manifest);
+
+/*
+ * Set manifest's size, and its count to match; chunks added are holes,
+ * and ids of chunks cut off are forgotten (collect them first).  Returns
+ * 0 on success and -1 if out of memory.
+ */
+int s3chunk_resize(s3chunk_manifest_t *manifest, uint64_t size);
+
+/*
+ * Release manifest's ids.
+ */
+void s3chunk_free(s3chunk_manifest_t *manifest);
+
+#endif // __S3CHUNK_H__
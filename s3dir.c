@@ -0,0 +1,305 @@
+/*
+ * s3dir.c, directory object helpers for the s3fs project.  See s3dir.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "s3dir.h"
+
+#define HEADER_SIZE 16
+#define ENTRY_SIZE_V1 22 // bytes of columns per dirent, in version 1
+#define ENTRY_SIZE_V2 30 // in version 2
+#define ENTRY_SIZE 34    // and in the current version
+
+// a dirent as objects written before the encoding held them
+typedef struct {
+    unsigned char type;
+    char name[256];
+    mode_t st_mode;
+    uid_t st_uid;
+    gid_t st_gid;
+    off_t st_size;
+} legacy_dirent_t;
+
+// encoding ------------------------------------------------------------------
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    p = put_u16(p, v);
+    return put_u16(p, v >> 16);
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v)
+{
+    p = put_u32(p, v);
+    return put_u32(p, v >> 32);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | (uint16_t) p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | (uint32_t) get_u16(p + 2) << 16;
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+    return get_u32(p) | (uint64_t) get_u32(p + 4) << 32;
+}
+
+ssize_t s3dir_encode(const s3dirent_t *dir, int count, uint8_t **buf)
+{
+    size_t heapBytes = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        heapBytes += strnlen(dir[i].name, sizeof(dir[i].name) - 1);
+    }
+    size_t len = HEADER_SIZE + (size_t) count * ENTRY_SIZE + heapBytes;
+    uint8_t *p = *buf = malloc(len);
+    if (!p) {
+        return -1;
+    }
+
+    memcpy(p, S3DIR_MAGIC, 4);
+    p = put_u16(p + 4, S3DIR_VERSION);
+    p = put_u16(p, 0);
+    p = put_u32(p, count);
+    p = put_u32(p, heapBytes);
+
+    for (i = 0; i < count; i++) {
+        *p++ = dir[i].type;
+    }
+    for (i = 0; i < count; i++) {
+        p = put_u32(p, dir[i].st_mode);
+    }
+    for (i = 0; i < count; i++) {
+        p = put_u32(p, dir[i].st_uid);
+    }
+    for (i = 0; i < count; i++) {
+        p = put_u32(p, dir[i].st_gid);
+    }
+    for (i = 0; i < count; i++) {
+        p = put_u64(p, dir[i].st_size);
+    }
+    for (i = 0; i < count; i++) {
+        p = put_u64(p, dir[i].st_ino);
+    }
+    for (i = 0; i < count; i++) {
+        p = put_u32(p, dir[i].st_chunk);
+    }
+    for (i = 0; i < count; i++) {
+        *p++ = strnlen(dir[i].name, sizeof(dir[i].name) - 1);
+    }
+    for (i = 0; i < count; i++) {
+        size_t nameLen = strnlen(dir[i].name, sizeof(dir[i].name) - 1);
+        memcpy(p, dir[i].name, nameLen);
+        p += nameLen;
+    }
+    return len;
+}
+
+static int decode_legacy(const uint8_t *buf, size_t len, s3dirent_t **dir)
+{
+    if (len % sizeof(legacy_dirent_t)) {
+        return -1;
+    }
+    int count = len / sizeof(legacy_dirent_t);
+    s3dirent_t *d = calloc(count ? count : 1, sizeof(s3dirent_t));
+    if (!d) {
+        return -1;
+    }
+    int i;
+    for (i = 0; i < count; i++) {
+        legacy_dirent_t old;
+        memcpy(&old, buf + i * sizeof(legacy_dirent_t), sizeof(old));
+        d[i].type = old.type;
+        memcpy(d[i].name, old.name, sizeof(d[i].name));
+        d[i].name[sizeof(d[i].name) - 1] = '\0';
+        d[i].st_mode = old.st_mode;
+        d[i].st_uid = old.st_uid;
+        d[i].st_gid = old.st_gid;
+        d[i].st_size = old.st_size;
+    }
+    *dir = d;
+    return count;
+}
+
+int s3dir_decode(const uint8_t *buf, size_t len, s3dirent_t **dir)
+{
+    if (len < HEADER_SIZE || memcmp(buf, S3DIR_MAGIC, 4)) {
+        // a legacy array starts with its "." dirent, of type 'D'
+        return decode_legacy(buf, len, dir);
+    }
+    uint16_t version = get_u16(buf + 4);
+    if (version < 1 || version > S3DIR_VERSION) {
+        return -1;
+    }
+    // version 1 had no st_ino column, and versions 1 and 2 no st_chunk one
+    size_t entrySize = version == 1 ? ENTRY_SIZE_V1 :
+                       version == 2 ? ENTRY_SIZE_V2 : ENTRY_SIZE;
+    uint32_t count = get_u32(buf + 8);
+    uint32_t heapBytes = get_u32(buf + 12);
+    if (count > (len - HEADER_SIZE) / entrySize ||
+        len != HEADER_SIZE + (size_t) count * entrySize + heapBytes) {
+        return -1;
+    }
+
+    s3dirent_t *d = calloc(count ? count : 1, sizeof(s3dirent_t));
+    if (!d) {
+        return -1;
+    }
+    const uint8_t *types = buf + HEADER_SIZE;
+    const uint8_t *modes = types + count;
+    const uint8_t *uids = modes + 4 * (size_t) count;
+    const uint8_t *gids = uids + 4 * (size_t) count;
+    const uint8_t *sizes = gids + 4 * (size_t) count;
+    const uint8_t *inos = sizes + 8 * (size_t) count;
+    const uint8_t *chunks = version == 1 ? inos : inos + 8 * (size_t) count;
+    const uint8_t *nameLens = version < 3 ? chunks : chunks + 4 * (size_t) count;
+    const uint8_t *heap = nameLens + count;
+    size_t heapOffset = 0;
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        d[i].type = types[i];
+        d[i].st_mode = get_u32(modes + 4 * (size_t) i);
+        d[i].st_uid = get_u32(uids + 4 * (size_t) i);
+        d[i].st_gid = get_u32(gids + 4 * (size_t) i);
+        d[i].st_size = get_u64(sizes + 8 * (size_t) i);
+        d[i].st_ino = version == 1 ? 0 : get_u64(inos + 8 * (size_t) i);
+        d[i].st_chunk = version < 3 ? 0 : get_u32(chunks + 4 * (size_t) i);
+        if (heapOffset + nameLens[i] > heapBytes) {
+            free(d);
+            return -1;
+        }
+        memcpy(d[i].name, heap + heapOffset, nameLens[i]);
+        heapOffset += nameLens[i];
+    }
+    *dir = d;
+    return count;
+}
+
+// shards --------------------------------------------------------------------
+
+int s3dir_shard_of(const char *name, int shards)
+{
+    // FNV-1a's high bits hardly depend on a name's last few characters,
+    // so mix them in first (this is murmur3's finalizer)
+    uint32_t hash = s3dir_hash(name);
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return (hash >> 16) & (shards - 1);
+}
+
+void s3dir_shard_key(char *key, size_t size, const char *dirkey, int shards,
+                     int shard)
+{
+    // the shard count is part of the key, so the shards written when a
+    // directory is split again never overwrite the ones still in use
+    snprintf(key, size, "%s//shard-%d-%d", dirkey, shards, shard);
+}
+
+// object keys ---------------------------------------------------------------
+
+void s3dir_object_key(char *key, size_t size, uint64_t ino)
+{
+    snprintf(key, size, "/ino/%016llx", (unsigned long long) ino);
+}
+
+// index ---------------------------------------------------------------------
+
+// 32-bit FNV-1a
+uint32_t s3dir_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int s3dir_index_build(s3dir_index_t *index, const s3dirent_t *dir, int count)
+{
+    // at most half full, so probe sequences stay short
+    uint32_t size = 8;
+    while (size < (uint32_t) count * 2) {
+        size *= 2;
+    }
+    index->slots = malloc(size * sizeof(int32_t));
+    if (!index->slots) {
+        index->mask = 0;
+        return -1;
+    }
+    memset(index->slots, 0xff, size * sizeof(int32_t));
+    index->mask = size - 1;
+
+    int i;
+    for (i = 0; i < count; i++) {
+        uint32_t slot = s3dir_hash(dir[i].name) & index->mask;
+        while (index->slots[slot] >= 0) {
+            slot = (slot + 1) & index->mask;
+        }
+        index->slots[slot] = i;
+    }
+    return 0;
+}
+
+int s3dir_index_find(const s3dir_index_t *index, const s3dirent_t *dir,
+                     const char *name)
+{
+    if (!index->slots) {
+        return -1;
+    }
+    uint32_t slot = s3dir_hash(name) & index->mask;
+    while (index->slots[slot] >= 0) {
+        int i = index->slots[slot];
+        if (!strcmp(dir[i].name, name)) {
+            return i;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+    return -1;
+}
+
+int s3dir_index_copy(s3dir_index_t *to, const s3dir_index_t *from)
+{
+    size_t bytes = s3dir_index_bytes(from);
+    to->mask = 0;
+    to->slots = NULL;
+    if (!bytes) {
+        return 0;
+    }
+    to->slots = malloc(bytes);
+    if (!to->slots) {
+        return -1;
+    }
+    memcpy(to->slots, from->slots, bytes);
+    to->mask = from->mask;
+    return 0;
+}
+
+size_t s3dir_index_bytes(const s3dir_index_t *index)
+{
+    return index->slots ? (index->mask + 1) * sizeof(int32_t) : 0;
+}
+
+void s3dir_index_free(s3dir_index_t *index)
+{
+    free(index->slots);
+    index->slots = NULL;
+    index->mask = 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Directory object helpers for the s3fs project.
+ *
+ * The encoding of directory objects on s3.  In memory a directory is an
+ * array of s3dirent_t, whose fixed 256-byte names make it mostly padding,
+ * so it is stored in a compact, versioned form instead.  All integers are
+ * little-endian:
+ *
+ *   header   "S3DR", u16 version (3), u16 flags (0), u32 count,
+ *            u32 heap bytes
+ *   columns  count of each, one column after another: u8 type,
+ *            u32 st_mode, u32 st_uid, u32 st_gid, u64 st_size,
+ *            u64 st_ino, u32 st_chunk, u8 name length
+ *   heap     the names, back to back, without terminators
+ *
+ * Version 1 had no st_ino column, version 2 no st_chunk column, and
+ * objects written before this format are raw arrays of the old,
+ * inode-less s3dirent_t; all are still read (with st_ino and st_chunk 0),
+ * and are rewritten in the current form when next stored.
+ *
+ * Every file and directory has a 64-bit inode number, fixed when it is
+ * created, and its contents (a file's bytes, or a directory's dirents) are
+ * stored under the key s3dir_object_key gives for it; a file whose dirent
+ * has a nonzero st_chunk is stored in chunks instead, and that key holds
+ * its manifest (see s3chunk.h).  A dirent holds only its entry's name
+ * within the directory, and the entry's inode number, so renaming or
+ * moving anything, however much lies below it, rewrites just the dirents
+ * naming it.  The root directory's inode number is S3DIR_ROOT_INO.
+ *
+ * A directory with more than S3DIR_SHARD_ENTRIES dirents is split into
+ * shards, by a hash of the dirents' names.  Its own object then becomes a
+ * manifest holding just its "." dirent and a marker dirent, named
+ * S3DIR_SHARDS_NAME and of type S3DIR_SHARDS_TYPE, whose st_size is the
+ * number of shards (a power of 2).  Each shard is an ordinary directory
+ * object, without a "." dirent, stored under the key s3dir_shard_key
+ * gives.  The marker's name can't be a file's name, since it contains a
+ * "/", and a shard key can't be an object key, since it contains "//".
+ *
+ * Also a hash index over the names in an array of s3dirent_t, so that a
+ * dirent can be found by name without comparing it against every entry.
+ * The index is built once when a directory object is loaded, kept with it
+ * in the cache (see dircache.c), and copied out along with the dirents
+ * to whatever changes them; it uses open addressing with linear probing,
+ * and is kept at most half full.
+ */
+#ifndef __S3DIR_H__
+#define __S3DIR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "s3fs.h"
+
+#define S3DIR_MAGIC "S3DR"
+#define S3DIR_VERSION 3
+
+#define S3DIR_ROOT_INO 1
+#define S3DIR_KEY_SIZE 64 // enough for any object or shard key
+
+/*
+ * Write the key of the object holding the contents of inode number ino to
+ * key (of size bytes).
+ */
+void s3dir_object_key(char *key, size_t size, uint64_t ino);
+
+/*
+ * Encode count dirents into a malloc'ed buffer, which *buf is set to (the
+ * caller must free it).  Returns the buffer's length, or -1 if out of
+ * memory.
+ */
+ssize_t s3dir_encode(const s3dirent_t *dir, int count, uint8_t **buf);
+
+/*
+ * Decode the len-byte directory object in buf, in either the current or
+ * the legacy format.  Sets *dir to a malloc'ed array of its dirents (the
+ * caller must free it) and returns their number, or returns -1 if buf is
+ * not a directory object this version can read.
+ */
+int s3dir_decode(const uint8_t *buf, size_t len, s3dirent_t **dir);
+
+#define S3DIR_SHARD_ENTRIES 4096 // most dirents in one object
+#define S3DIR_MIN_SHARDS 16
+#define S3DIR_SHARDS_NAME "//shards"
+#define S3DIR_SHARDS_TYPE 'S'
+
+/*
+ * The shard (0 to shards - 1) holding the dirent called name.
+ */
+int s3dir_shard_of(const char *name, int shards);
+
+/*
+ * Write the key of shard number shard, of the directory whose object key
+ * is dirkey split into shards shards, to key (of size bytes).
+ */
+void s3dir_shard_key(char *key, size_t size, const char *dirkey, int shards,
+                     int shard);
+
+typedef struct {
+    uint32_t mask;  // number of slots - 1; the number of slots is a power of 2
+    int32_t *slots; // index of a dirent, or -1 for an empty slot
+} s3dir_index_t;
+
+/*
+ * Hash of a dirent name.
+ */
+uint32_t s3dir_hash(const char *name);
+
+/*
+ * Build an index over the count dirents in dir.  Returns 0 on success and
+ * -1 if out of memory.
+ */
+int s3dir_index_build(s3dir_index_t *index, const s3dirent_t *dir, int count);
+
+/*
+ * Index (into the dir the index was built over) of the dirent called name,
+ * or -1 if there is none.
+ */
+int s3dir_index_find(const s3dir_index_t *index, const s3dirent_t *dir,
+                     const char *name);
+
+/*
+ * Make *to a copy of *from.  Returns 0 on success and -1 if out of memory.
+ */
+int s3dir_index_copy(s3dir_index_t *to, const s3dir_index_t *from);
+
+/*
+ * Memory used by an index, in bytes.
+ */
+size_t s3dir_index_bytes(const s3dir_index_t *index);
+
+/*
+ * Release an index.
+ */
+void s3dir_index_free(s3dir_index_t *index);
+
+#endif // __S3DIR_H__
@@ -0,0 +1,267 @@
+/*
+ * Simple tests for the encodings the s3fs project stores on s3: directory
+ * objects (s3dir.h) and chunk manifests (s3chunk.h).
+ *
+ * These need no bucket; they check that what is encoded decodes to the
+ * same thing, that objects written by older versions still decode, and
+ * that anything else is refused rather than misread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "s3chunk.h"
+#include "s3dir.h"
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    if (ok) {
+        printf("Successfully %s\n", what);
+    } else {
+        printf("Failed: %s\n", what);
+        failures++;
+    }
+}
+
+// directories ---------------------------------------------------------------
+
+#define DIR_COUNT 3
+
+static void make_dir(s3dirent_t *dir)
+{
+    memset(dir, 0, DIR_COUNT * sizeof(s3dirent_t));
+    dir[0].type = 'D';
+    strcpy(dir[0].name, ".");
+    dir[0].st_mode = 040755;
+    dir[0].st_size = 3 * sizeof(s3dirent_t);
+    dir[0].st_ino = 0x0123456789abcdefULL;
+    dir[1].type = 'F';
+    strcpy(dir[1].name, "a file");
+    dir[1].st_mode = 0100644;
+    dir[1].st_uid = 1000;
+    dir[1].st_gid = 100;
+    dir[1].st_size = 5000000000LL;
+    dir[1].st_ino = 42;
+    dir[1].st_chunk = 4 * 1024 * 1024;
+    dir[2].type = 'D';
+    memset(dir[2].name, 'n', 255); // the longest name there can be
+    dir[2].st_mode = 040700;
+    dir[2].st_ino = 43;
+}
+
+// Whether a and b match in all but st_ino (unless with_ino is set) and
+// st_chunk (unless with_chunk is set), which older versions didn't keep.
+static int same_dir(const s3dirent_t *a, const s3dirent_t *b, int count,
+                    int with_ino, int with_chunk)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        if (a[i].type != b[i].type || strcmp(a[i].name, b[i].name) ||
+            a[i].st_mode != b[i].st_mode || a[i].st_uid != b[i].st_uid ||
+            a[i].st_gid != b[i].st_gid || a[i].st_size != b[i].st_size ||
+            a[i].st_ino != (with_ino ? b[i].st_ino : 0) ||
+            a[i].st_chunk != (with_chunk ? b[i].st_chunk : 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Rewrite a current (version 3) directory object of count dirents in
+// place as the given older version, by cutting out the columns it lacked.
+// Returns its new length.
+static size_t downgrade_dir(uint8_t *buf, size_t len, int count, int version)
+{
+    const size_t header = 16;
+    size_t inos = header + (size_t) count * (1 + 4 + 4 + 4 + 8);
+    size_t chunks = inos + (size_t) count * 8;
+    size_t cutFrom = version == 1 ? inos : chunks;
+    size_t cutTo = chunks + (size_t) count * 4;
+    memmove(buf + cutFrom, buf + cutTo, len - cutTo);
+    buf[4] = version;
+    buf[5] = 0;
+    return len - (cutTo - cutFrom);
+}
+
+static void test_dir()
+{
+    s3dirent_t dir[DIR_COUNT];
+    make_dir(dir);
+    uint8_t *buf = NULL;
+    ssize_t len = s3dir_encode(dir, DIR_COUNT, &buf);
+    s3dirent_t *decoded = NULL;
+    int count = len < 0 ? -1 : s3dir_decode(buf, len, &decoded);
+    check(count == DIR_COUNT && same_dir(decoded, dir, count, 1, 1),
+          "round-tripped a directory (s3dir_encode, s3dir_decode)");
+    free(decoded);
+
+    uint8_t *empty = NULL;
+    ssize_t emptyLen = s3dir_encode(dir, 0, &empty);
+    decoded = NULL;
+    check(emptyLen >= 0 && s3dir_decode(empty, emptyLen, &decoded) == 0,
+          "round-tripped an empty shard");
+    free(decoded);
+    free(empty);
+
+    // every prefix of a valid object is refused, and so is one byte more
+    int refused = 1;
+    ssize_t cut;
+    for (cut = 4; cut < len && refused; cut++) {
+        decoded = NULL;
+        refused = s3dir_decode(buf, cut, &decoded) < 0;
+        free(decoded);
+    }
+    uint8_t *longer = calloc(1, len + 1);
+    memcpy(longer, buf, len);
+    decoded = NULL;
+    refused = refused && s3dir_decode(longer, len + 1, &decoded) < 0;
+    free(decoded);
+    free(longer);
+    check(refused, "refused truncated and overlong directory objects");
+
+    // a version from the future, and names running past the heap
+    uint8_t *bad = malloc(len);
+    memcpy(bad, buf, len);
+    bad[4] = S3DIR_VERSION + 1;
+    decoded = NULL;
+    check(s3dir_decode(bad, len, &decoded) < 0,
+          "refused a directory object of an unknown version");
+    free(decoded);
+    memcpy(bad, buf, len);
+    size_t heapBytes = 1 + 6 + 255;
+    bad[len - heapBytes - DIR_COUNT] = 200; // "."'s name length
+    decoded = NULL;
+    check(s3dir_decode(bad, len, &decoded) < 0,
+          "refused a directory object whose names overrun its heap");
+    free(decoded);
+    free(bad);
+
+    // versions 2 (no st_chunk) and 1 (no st_ino either)
+    int version;
+    for (version = 2; version >= 1; version--) {
+        uint8_t *old = malloc(len);
+        memcpy(old, buf, len);
+        size_t oldLen = downgrade_dir(old, len, DIR_COUNT, version);
+        decoded = NULL;
+        count = s3dir_decode(old, oldLen, &decoded);
+        check(count == DIR_COUNT &&
+              same_dir(decoded, dir, count, version >= 2, 0),
+              version == 2 ? "decoded a version 2 directory object" :
+                             "decoded a version 1 directory object");
+        free(decoded);
+        free(old);
+    }
+    free(buf);
+}
+
+// chunk manifests -----------------------------------------------------------
+
+static int same_manifest(const s3chunk_manifest_t *a,
+                         const s3chunk_manifest_t *b)
+{
+    return a->chunk_size == b->chunk_size && a->size == b->size &&
+        a->count == b->count &&
+        !memcmp(a->ids, b->ids, a->count * sizeof(uint64_t));
+}
+
+static void test_manifest()
+{
+    check(s3chunk_count(0, 4096) == 0 && s3chunk_count(1, 4096) == 1 &&
+          s3chunk_count(4096, 4096) == 1 && s3chunk_count(4097, 4096) == 2,
+          "counted chunks (s3chunk_count)");
+
+    uint64_t ids[3] = { 7, 0, 0xfedcba9876543210ULL };
+    s3chunk_manifest_t manifest = { 4096, 2 * 4096 + 1, 3, ids };
+    uint8_t *buf = NULL;
+    ssize_t len = s3chunk_encode(&manifest, &buf);
+    s3chunk_manifest_t decoded = { 0, 0, 0, NULL };
+    check(len == 24 + 3 * 8 && s3chunk_decode(buf, len, &decoded) == 0 &&
+          same_manifest(&decoded, &manifest),
+          "round-tripped a manifest (s3chunk_encode, s3chunk_decode)");
+    s3chunk_free(&decoded);
+
+    s3chunk_manifest_t empty = { 4096, 0, 0, NULL };
+    uint8_t *emptyBuf = NULL;
+    ssize_t emptyLen = s3chunk_encode(&empty, &emptyBuf);
+    check(emptyLen == 24 && s3chunk_decode(emptyBuf, emptyLen, &decoded) == 0 &&
+          decoded.size == 0 && decoded.count == 0,
+          "round-tripped an empty file's manifest");
+    s3chunk_free(&decoded);
+    free(emptyBuf);
+
+    // prefixes, one byte more, and each header field made invalid
+    int refused = 1;
+    ssize_t cut;
+    for (cut = 0; cut < len && refused; cut++) {
+        refused = s3chunk_decode(buf, cut, &decoded) < 0;
+    }
+    uint8_t *bad = calloc(1, len + 1);
+    memcpy(bad, buf, len);
+    refused = refused && s3chunk_decode(bad, len + 1, &decoded) < 0;
+    check(refused, "refused truncated and overlong manifests");
+
+    struct { size_t at; uint8_t value; const char *what; } corrupt[] = {
+        { 0, 'X', "refused a manifest with the wrong magic" },
+        { 4, S3CHUNK_VERSION + 1, "refused a manifest of an unknown version" },
+        { 9, 0, "refused a manifest with no chunk size" },  // 4096 -> 0
+        { 12, 0, "refused a manifest whose count doesn't fit its size" },
+    };
+    size_t i;
+    for (i = 0; i < sizeof(corrupt) / sizeof(corrupt[0]); i++) {
+        memcpy(bad, buf, len);
+        bad[corrupt[i].at] = corrupt[i].value;
+        check(s3chunk_decode(bad, len, &decoded) < 0, corrupt[i].what);
+    }
+    free(bad);
+
+    // resizing keeps the chunks it can, and adds holes
+    s3chunk_decode(buf, len, &decoded);
+    int ok = s3chunk_resize(&decoded, 5 * 4096) == 0 && decoded.count == 5 &&
+        decoded.size == 5 * 4096 && decoded.ids[0] == 7 &&
+        decoded.ids[2] == ids[2] && decoded.ids[3] == 0 && decoded.ids[4] == 0;
+    ok = ok && s3chunk_resize(&decoded, 4096 + 1) == 0 &&
+        decoded.count == 2 && decoded.size == 4097 && decoded.ids[0] == 7;
+    ok = ok && s3chunk_resize(&decoded, 0) == 0 && decoded.count == 0 &&
+        decoded.size == 0;
+    ok = ok && s3chunk_resize(&decoded, 3) == 0 && decoded.count == 1 &&
+        decoded.ids[0] == 0;
+    check(ok, "resized a manifest (s3chunk_resize)");
+
+    uint8_t *resized = NULL;
+    ssize_t resizedLen = s3chunk_encode(&decoded, &resized);
+    s3chunk_manifest_t again = { 0, 0, 0, NULL };
+    check(resizedLen > 0 && s3chunk_decode(resized, resizedLen, &again) == 0 &&
+          same_manifest(&again, &decoded),
+          "round-tripped a resized manifest");
+    s3chunk_free(&again);
+    s3chunk_free(&decoded);
+    free(resized);
+    free(buf);
+}
+
+int main(int argc, char **argv) {
+
+    /*
+     * Tests:
+     *  - Round-trip a directory, and an empty shard
+     *  - Refuse truncated, overlong, future and corrupt directory objects
+     *  - Decode version 2 and version 1 directory objects
+     *  - Count the chunks covering a size
+     *  - Round-trip a manifest, and an empty file's
+     *  - Refuse truncated, overlong and corrupt manifests
+     *  - Resize a manifest up, down, to nothing and back
+     *  - Done.
+     */
+
+    test_dir();
+    test_manifest();
+
+    if (failures) {
+        printf("%d s3 format tests failed.\n", failures);
+        return 1;
+    }
+    printf("Done with s3 format tests.  Share and enjoy.\n");
+    return 0;
+}
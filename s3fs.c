@@ -3,32 +3,1431 @@
 
 #include "s3fs.h"
 #include "libs3_wrapper.h"
+#include "dircache.h"
+#include "blockcache.h"
+#include "diskcache.h"
+#include "attrcache.h"
+#include "dirlock.h"
+#include "dirops.h"
+#include "inodetab.h"
+#include "s3dir.h"
+#include "workpool.h"
 
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/xattr.h>
 
-#define GET_PRIVATE_DATA ((s3context_t *) fuse_get_context()->private_data)
+/*
+ * The low-level API (see ll_main) has no fuse_get_context, so there the
+ * context is kept here instead.
+ */
+static s3context_t *contextG = NULL;
+
+#define GET_PRIVATE_DATA (contextG ? contextG : (s3context_t *) fuse_get_context()->private_data)
+
+/*
+ * For each function below, if you need to return an error,
+ * read the appropriate man page for the call and see what
+ * error codes make sense for the type of failure you want
+ * to convey.  For example, many of the calls below return
+ * -EIO (an I/O error), since there are no S3 calls yet
+ * implemented.  (Note that you need to return the negative
+ * value for an error code.)
+ */
+
+/*
+ * Directories are read and changed only through the dir_* functions of
+ * dirops.h, which keep them sharded, cached and locked.
+ */
+
+/*
+ * Fill *st from dirent, a dirent in the directory at path looked up in
+ * the attribute cache's epoch, and cache it as that entry's attributes
+ * (unless path is NULL).
+ * A subdirectory's attributes are kept in its own "." dirent, not its
+ * parent's, so for one only the type is filled in (and nothing is cached).
+ */
+static void dirent_stat(const char *path, const s3dirent_t *dirent, struct stat *st, uint64_t epoch)
+{
+	memset(st, 0, sizeof(struct stat));
+	st->st_ino = dirent->st_ino;
+	if (dirent->type == 'D' && strcmp(dirent->name, ".") != 0)
+	{
+		st->st_mode = S_IFDIR;
+		return;
+	}
+	st->st_mode = dirent->st_mode;
+	st->st_uid = dirent->st_uid;
+	st->st_gid = dirent->st_gid;
+	st->st_size = dirent->st_size;
+	if (path != NULL)
+	{
+		char child[PATH_MAX];
+		path_join(child, path, dirent->name);
+		attrcache_put(child, st, epoch);
+	}
+}
+
+/*
+ * Open files are buffered in an s3file_t (see s3fs.h), kept in the
+ * handle's fi->fh.  The first write loads the file's contents into it
+ * (a new file has none to load), later writes just change the buffer,
+ * and the whole file is uploaded once, along with its size in the
+ * parent's dirent, when the handle is flushed, synced or released.
+ *
+ * A chunked file (see s3chunk.h) is never loaded whole.  Writes load just
+ * the chunks they touch, and only those are uploaded, followed by the
+ * file's manifest; see the chunk_* functions below.  Storing one replaces
+ * chunk objects that any other handle of it would still name, so all its
+ * handles share a single state, found through the table of open chunked
+ * files (see file_share).
+ */
+
+#define FILE_MIN_CAPACITY 4096
+
+static uint32_t chunkSizeG = 0; // chunk size of new files, or 0 to store them whole
+
+static void file_free(s3file_t *file)
+{
+	pthread_mutex_destroy(&file->lock);
+	free(file->data);
+	if (file->chunks != NULL)
+	{
+		uint32_t i = 0;
+		for (; i < file->manifest.count; i++)
+		{
+			free(file->chunks[i]);
+		}
+		free(file->chunks);
+	}
+	s3chunk_free(&file->manifest);
+	free(file->dropped);
+	free(file->stale);
+	free(file);
+}
+
+/*
+ * A new open-file state for the file with inode number ino, of size
+ * bytes, already loaded if it's empty.  chunk is the file's chunk size,
+ * or 0 if it is stored whole; a chunked file starts out all holes, until
+ * file_open fills in its chunks.  Its one handle holds the only reference
+ * to it.  Returns NULL if out of memory.
+ */
+static s3file_t *file_new(uint64_t ino, size_t size, uint32_t chunk)
+{
+	s3file_t *file = calloc(1, sizeof(s3file_t));
+	if (file == NULL)
+	{
+		return NULL;
+	}
+	pthread_mutex_init(&file->lock, NULL);
+	file->ino = ino;
+	file->size = size;
+	file->loaded = size == 0;
+	file->chunk = chunk;
+	file->refs = 1;
+	if (chunk != 0)
+	{
+		file->manifest.chunk_size = chunk;
+		if (s3chunk_resize(&file->manifest, size) != 0 || (file->chunks = calloc(file->manifest.count + 1, sizeof(char*))) == NULL)
+		{
+			file_free(file);
+			return NULL;
+		}
+	}
+	return file;
+}
+
+/*
+ * Make room for at least size bytes at file->data, zero-filling from the
+ * current size.  Returns 0 on success and -ENOMEM if out of memory.
+ */
+static int file_reserve(s3file_t *file, size_t size)
+{
+	if (size > file->capacity)
+	{
+		size_t capacity = file->capacity ? file->capacity : FILE_MIN_CAPACITY;
+		while (capacity < size)//grow geometrically, so appends don't copy the file each time
+		{
+			capacity *= 2;
+		}
+		char *data = realloc(file->data, capacity);
+		if (data == NULL)
+		{
+			return -ENOMEM;
+		}
+		file->data = data;
+		file->capacity = capacity;
+	}
+	if (size > file->size)
+	{
+		memset(file->data + file->size, 0, size - file->size);
+	}
+	return 0;
+}
+
+/*
+ * Load the contents of file, if they aren't there yet; with file's lock
+ * held.  Returns 0 on success and -EIO on failure.
+ */
+static int file_load(s3file_t *file)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	if (file->loaded)
+	{
+		return 0;
+	}
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), file->ino);
+	uint8_t *data = NULL;
+	ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), key, &data, 0, 0);
+	if (getsuccess < 0)
+	{
+		free(data);
+		return -EIO;
+	}
+	free(file->data);
+	file->data = (char*)data;
+	file->size = getsuccess;
+	file->capacity = getsuccess;
+	file->loaded = 1;
+	return 0;
+}
+
+/*
+ * The chunk_* functions do the work of the file_* ones around them, for
+ * chunked files (see s3chunk.h).  file->chunks holds the chunks its
+ * handles are changing, loaded by the writes that touch them; everything else
+ * is read through the block cache, chunk by chunk, and holes read as
+ * zeroes without a request.  Storing the file puts just the loaded chunks
+ * and the manifest, so a small write to a large file costs a chunk, not
+ * the file.
+ */
+
+/*
+ * Bytes of chunk number c of file that lie below its end.
+ */
+static size_t chunk_len(const s3file_t *file, uint32_t c)
+{
+	uint64_t start = (uint64_t)c * file->chunk;
+	return file->size - start < file->chunk ? file->size - start : file->chunk;
+}
+
+/*
+ * Whether the len bytes at data are all zeroes.
+ */
+static int chunk_zero(const char *data, size_t len)
+{
+	return len == 0 || (data[0] == 0 && memcmp(data, data + 1, len - 1) == 0);
+}
+
+/*
+ * Load chunk number c of file into file->chunks[c], if it isn't there yet;
+ * with file's lock held.  Bytes past the end of its object (all of them,
+ * for a hole) are zeroes.  Returns 0 on success, and -EIO or -ENOMEM on
+ * failure.
+ */
+static int chunk_load(s3file_t *file, uint32_t c)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	if (file->chunks[c] != NULL)
+	{
+		return 0;
+	}
+	char *data = calloc(1, file->chunk);
+	if (data == NULL)
+	{
+		return -ENOMEM;
+	}
+	if (file->manifest.ids[c] != 0)
+	{
+		char key[S3DIR_KEY_SIZE];
+		s3chunk_key(key, sizeof(key), file->ino, file->manifest.ids[c]);
+		size_t len = chunk_len(file, c);
+		if (blockcache_read((const char*)(ctx->s3bucket), key, (uint8_t*)data, len, 0, len, NULL, NULL) < 0)
+		{
+			free(data);
+			return -EIO;
+		}
+	}
+	file->chunks[c] = data;
+	return 0;
+}
+
+/*
+ * file_truncate, for a chunked file; with file's lock held.  Chunks wholly
+ * past the new end are dropped (their objects are removed once the file is
+ * stored), and the rest of the new last chunk is zeroed, so it reads as
+ * zeroes if the file grows again.  New chunks are holes.
+ */
+static int chunk_resize(s3file_t *file, size_t size)
+{
+	uint32_t count = s3chunk_count(size, file->chunk);
+	//STEP 1: ZERO THE REST OF THE NEW LAST CHUNK, IF THE FILE SHRINKS INTO IT
+	if (size < file->size && size % file->chunk != 0)
+	{
+		uint32_t last = size / file->chunk;
+		int rv = chunk_load(file, last);
+		if (rv != 0)
+		{
+			return rv;
+		}
+		memset(file->chunks[last] + size % file->chunk, 0, file->chunk - size % file->chunk);
+	}
+	//STEP 2: DROP THE CHUNKS PAST THE NEW END
+	uint32_t c = count;
+	for (; c < file->manifest.count; c++)
+	{
+		if (file->manifest.ids[c] != 0)
+		{
+			uint64_t *dropped = realloc(file->dropped, (file->ndropped + 1) * sizeof(uint64_t));
+			if (dropped == NULL)
+			{
+				return -ENOMEM;
+			}
+			file->dropped = dropped;
+			file->dropped[file->ndropped++] = file->manifest.ids[c];
+			file->manifest.ids[c] = 0;
+		}
+		free(file->chunks[c]);
+		file->chunks[c] = NULL;
+	}
+	//STEP 3: RESIZE THE MAP OF CHUNKS, AND THE TABLE OF LOADED ONES
+	if (count > file->manifest.count)
+	{
+		char **chunks = realloc(file->chunks, (count + 1) * sizeof(char*));
+		if (chunks == NULL)
+		{
+			return -ENOMEM;
+		}
+		memset(chunks + file->manifest.count, 0, (count - file->manifest.count) * sizeof(char*));
+		file->chunks = chunks;
+	}
+	if (s3chunk_resize(&file->manifest, size) != 0)
+	{
+		return -ENOMEM;
+	}
+	file->size = size;
+	file->dirty = 1;
+	return 0;
+}
+
+/*
+ * file_read, for a chunked file.
+ */
+static int chunk_read(s3file_t *file, char *buf, size_t size, off_t offset)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	size_t done = 0;
+	while (done < size)
+	{
+		//STEP 1: FIND THE CHUNK THE NEXT BYTE IS IN, STOPPING AT EOF
+		pthread_mutex_lock(&file->lock);
+		uint64_t pos = (uint64_t)offset + done;
+		if (pos >= file->size)
+		{
+			pthread_mutex_unlock(&file->lock);
+			break;
+		}
+		uint32_t c = pos / file->chunk;
+		size_t at = pos % file->chunk;
+		size_t len = chunk_len(file, c);
+		size_t n = len - at < size - done ? len - at : size - done;
+		//STEP 2: COPY IT FROM THE HANDLE IF IT IS LOADED (BEING CHANGED), OR ZEROES FOR A HOLE
+		if (file->chunks[c] != NULL || file->manifest.ids[c] == 0)
+		{
+			if (file->chunks[c] != NULL)
+			{
+				memcpy(buf + done, file->chunks[c] + at, n);
+			}
+			else
+			{
+				memset(buf + done, 0, n);
+			}
+			pthread_mutex_unlock(&file->lock);
+			done += n;
+			continue;
+		}
+		//STEP 3: OTHERWISE READ ITS OBJECT THROUGH THE BLOCK CACHE, WITH READ-AHEAD KEPT GOING FROM ONE CHUNK INTO THE NEXT
+		char key[S3DIR_KEY_SIZE];
+		s3chunk_key(key, sizeof(key), file->ino, file->manifest.ids[c]);
+		uint64_t start = pos - at;
+		blockcache_stream_t stream = file->stream;
+		stream.next = stream.next >= start ? stream.next - start : UINT64_MAX;
+		file->reading++;//so a store meanwhile keeps the object, even if it replaces the chunk
+		pthread_mutex_unlock(&file->lock);
+		ssize_t getsuccess = blockcache_read((const char*)(ctx->s3bucket), key, (uint8_t*)buf + done, n, at, len, NULL, &stream);
+		pthread_mutex_lock(&file->lock);
+		file->reading--;
+		if (getsuccess < 0)
+		{
+			pthread_mutex_unlock(&file->lock);
+			return -EIO;
+		}
+		if ((size_t)getsuccess < n)//the object ends before the chunk does
+		{
+			memset(buf + done + getsuccess, 0, n - getsuccess);
+		}
+		file->stream.next = stream.next + start;
+		file->stream.window = stream.window;
+		pthread_mutex_unlock(&file->lock);
+		done += n;
+	}
+	return (int)done;
+}
+
+/*
+ * file_write, for a chunked file; with file's lock held.
+ */
+static int chunk_write(s3file_t *file, const char *buf, size_t size, off_t offset)
+{
+	//STEP 1: GROW THE FILE IF THE WRITE GOES PAST ITS END (A GAP BEFORE IT IS A HOLE)
+	if ((size_t)offset + size > file->size)
+	{
+		int rv = chunk_resize(file, (size_t)offset + size);
+		if (rv != 0)
+		{
+			return rv;
+		}
+	}
+	//STEP 2: COPY THE NEW INPUT INTO EACH CHUNK IT TOUCHES, LOADING ONLY THOSE IT DOESN'T COVER WHOLE
+	size_t done = 0;
+	while (done < size)
+	{
+		uint64_t pos = (uint64_t)offset + done;
+		uint32_t c = pos / file->chunk;
+		size_t at = pos % file->chunk;
+		size_t n = file->chunk - at < size - done ? file->chunk - at : size - done;
+		if (file->chunks[c] == NULL && n == file->chunk)
+		{
+			file->chunks[c] = malloc(file->chunk);
+			if (file->chunks[c] == NULL)
+			{
+				return -ENOMEM;
+			}
+		}
+		else
+		{
+			int rv = chunk_load(file, c);
+			if (rv != 0)
+			{
+				return rv;
+			}
+		}
+		memcpy(file->chunks[c] + at, buf + done, n);
+		done += n;
+	}
+	file->dirty = 1;
+	return (int)size;
+}
+
+// chunk objects to put or remove, shared by chunk_io's workers
+typedef struct {
+	const char *bucket;
+	uint64_t ino;        //the file they are chunks of
+	const uint64_t *ids; //their ids
+	char **data;         //their contents, to put them, or NULL to remove them
+	const size_t *lens;  //and the lengths of those
+	int failed;
+	pthread_mutex_t lock;
+} chunk_io_t;
+
+static void chunk_io_item(void *arg, int i)
+{
+	chunk_io_t *io = arg;
+	pthread_mutex_lock(&io->lock);
+	int failed = io->failed;
+	pthread_mutex_unlock(&io->lock);
+	if (failed && io->data != NULL)//no point putting the rest; removals carry on regardless
+	{
+		return;
+	}
+	char key[S3DIR_KEY_SIZE];
+	s3chunk_key(key, sizeof(key), io->ino, io->ids[i]);
+	int ok = 0;
+	if (io->data != NULL)
+	{
+		ok = s3fs_put_object(io->bucket, key, (const uint8_t*)io->data[i], io->lens[i]) >= 0;
+	}
+	else
+	{
+		ok = s3fs_remove_object(io->bucket, key) == 0;
+	}
+	if (!ok)
+	{
+		pthread_mutex_lock(&io->lock);
+		io->failed = 1;
+		pthread_mutex_unlock(&io->lock);
+	}
+}
+
+/*
+ * Put the count chunk objects of the file with inode number ino with the
+ * given ids, from data and lens (or, if data is NULL, remove them), an
+ * object to each of the workers (workpool.h) at once.  Returns 0 on
+ * success and -1 if any failed.
+ */
+static int chunk_io(const char *bucket, uint64_t ino, const uint64_t *ids, char **data, const size_t *lens, int count)
+{
+	chunk_io_t io = { bucket, ino, ids, data, lens, 0, PTHREAD_MUTEX_INITIALIZER };
+	workpool_run(chunk_io_item, &io, count);
+	pthread_mutex_destroy(&io.lock);
+	return io.failed ? -1 : 0;
+}
+
+/*
+ * Upload file's chunk size, size and chunk ids as its manifest; with
+ * file's lock held.  Returns 0 on success and -1 on failure.
+ */
+static int chunk_put_manifest(s3file_t *file, uint64_t *ids)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	s3chunk_manifest_t manifest = { file->chunk, file->size, file->manifest.count, ids };
+	uint8_t *buf = NULL;
+	ssize_t len = s3chunk_encode(&manifest, &buf);
+	if (len < 0)
+	{
+		return -1;
+	}
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), file->ino);
+	s3fs_object_info_t info;
+	ssize_t putsuccess = s3fs_put_object_info((const char*)(ctx->s3bucket), key, buf, len, &info);
+	free(buf);
+	if (putsuccess < 0)
+	{
+		file->etag[0] = '\0';
+		return -1;
+	}
+	memcpy(file->etag, info.etag, S3FS_ETAG_SIZE);
+	return 0;
+}
+
+/*
+ * The upload half of file_store, for a chunked file: put each loaded
+ * chunk under a new id (or, if it is all zeroes, make it a hole), then the
+ * manifest naming them, which is when the changes take effect, and then
+ * remove the objects of the chunks replaced or dropped (once no read of
+ * them is in flight).  With file's lock held.  Returns 0 on success and
+ * -EIO or -ENOMEM on failure (the changes are then kept, for another try).
+ */
+static int chunk_store(s3file_t *file)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	const char *bucket = (const char*)(ctx->s3bucket);
+	uint32_t count = file->manifest.count;
+	uint64_t *ids = malloc((count + 1) * sizeof(uint64_t));        //the new manifest's
+	uint64_t *putids = malloc((count + 1) * sizeof(uint64_t));     //the chunk objects to put
+	char **putdata = malloc((count + 1) * sizeof(char*));
+	size_t *putlens = malloc((count + 1) * sizeof(size_t));
+	uint64_t *oldids = malloc((count + file->ndropped + file->nstale + 1) * sizeof(uint64_t)); //and those to remove after
+	int rv = ids && putids && putdata && putlens && oldids ? 0 : -ENOMEM;
+	int nput = 0;
+	int nold = 0;
+	//STEP 1: GIVE EACH LOADED CHUNK A NEW ID, OR 0 IF IT IS ALL ZEROES, AND PUT THE ONES THAT HAVE IDS
+	if (rv == 0)
+	{
+		memcpy(ids, file->manifest.ids, count * sizeof(uint64_t));
+		uint32_t c = 0;
+		for (; c < count; c++)
+		{
+			if (file->chunks[c] == NULL)
+			{
+				continue;
+			}
+			if (ids[c] != 0)
+			{
+				oldids[nold++] = ids[c];
+			}
+			size_t len = chunk_len(file, c);
+			ids[c] = chunk_zero(file->chunks[c], len) ? 0 : new_ino();
+			if (ids[c] != 0)
+			{
+				putids[nput] = ids[c];
+				putdata[nput] = file->chunks[c];
+				putlens[nput] = len;
+				nput++;
+			}
+		}
+		if (chunk_io(bucket, file->ino, putids, putdata, putlens, nput) != 0)
+		{
+			chunk_io(bucket, file->ino, putids, NULL, NULL, nput);//nothing names them, so remove them
+			rv = -EIO;
+		}
+	}
+	//STEP 2: PUT THE MANIFEST NAMING THEM (IF THIS FAILS THEY ARE KEPT, IN CASE IT WAS STORED AFTER ALL)
+	if (rv == 0 && chunk_put_manifest(file, ids) != 0)
+	{
+		rv = -EIO;
+	}
+	//STEP 3: REMOVE THE OBJECTS OF THE CHUNKS REPLACED OR DROPPED (A FAILURE JUST LEAVES THEM BEHIND), OR KEEP THEM FOR LATER IF A READ MAY STILL BE USING THEM
+	if (rv == 0)
+	{
+		memcpy(oldids + nold, file->dropped, file->ndropped * sizeof(uint64_t));
+		nold += file->ndropped;
+		memcpy(oldids + nold, file->stale, file->nstale * sizeof(uint64_t));
+		nold += file->nstale;
+		free(file->dropped);
+		file->dropped = NULL;
+		file->ndropped = 0;
+		free(file->stale);
+		file->stale = NULL;
+		file->nstale = 0;
+		if (file->reading == 0)
+		{
+			chunk_io(bucket, file->ino, oldids, NULL, NULL, nold);
+		}
+		else if (nold > 0)
+		{
+			file->stale = oldids;
+			file->nstale = nold;
+			oldids = NULL;
+		}
+		//STEP 4: THE LOADED CHUNKS ARE STORED NOW, SO LATER READS OF THEM CAN GO THROUGH THE BLOCK CACHE
+		uint32_t c = 0;
+		for (; c < count; c++)
+		{
+			free(file->chunks[c]);
+			file->chunks[c] = NULL;
+		}
+		free(file->manifest.ids);
+		file->manifest.ids = ids;
+		ids = NULL;
+	}
+	free(ids);
+	free(putids);
+	free(putdata);
+	free(putlens);
+	free(oldids);
+	return rv;
+}
+
+/*
+ * The chunked files open, each with the state its handles share.  A file
+ * is in the table from the first handle's open to the last one's release.
+ */
+static s3file_t *openfilesG = NULL;
+static pthread_mutex_t openfiles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Take another reference to the state of the open chunked file with inode
+ * number ino, or return NULL if it isn't open; with openfiles_lock held.
+ */
+static s3file_t *file_find(uint64_t ino)
+{
+	s3file_t *file = openfilesG;
+	for (; file != NULL; file = file->next)
+	{
+		if (file->ino == ino)
+		{
+			file->refs++;
+			return file;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Share file, a new state for a handle, with the handles that open the
+ * same chunked file later; or, if another open of it got in first, free
+ * file and return a reference to that one's state instead.  A file stored
+ * whole isn't shared, so its state is returned as it is.
+ */
+static s3file_t *file_share(s3file_t *file)
+{
+	if (file->chunk == 0)
+	{
+		return file;
+	}
+	pthread_mutex_lock(&openfiles_lock);
+	s3file_t *shared = file_find(file->ino);
+	if (shared == NULL)
+	{
+		file->next = openfilesG;
+		openfilesG = file;
+	}
+	pthread_mutex_unlock(&openfiles_lock);
+	if (shared != NULL)
+	{
+		file_free(file);
+		return shared;
+	}
+	return file;
+}
+
+/*
+ * Drop a handle's reference to file, freeing it once no handle is left
+ * (and, for a chunked file, removing any chunk objects its stores kept for
+ * reads that were in flight).  Its changes must already be stored.
+ */
+static void file_close(s3file_t *file)
+{
+	if (file->chunk != 0)
+	{
+		pthread_mutex_lock(&openfiles_lock);
+		int last = --file->refs == 0;
+		if (last)
+		{
+			s3file_t **slot = &openfilesG;
+			while (*slot != file)
+			{
+				slot = &(*slot)->next;
+			}
+			*slot = file->next;
+		}
+		pthread_mutex_unlock(&openfiles_lock);
+		if (!last)
+		{
+			return;
+		}
+		if (file->nstale > 0)
+		{
+			s3context_t *ctx = GET_PRIVATE_DATA;
+			chunk_io((const char*)(ctx->s3bucket), file->ino, file->stale, NULL, NULL, file->nstale);
+		}
+	}
+	file_free(file);
+}
+
+/*
+ * file_open, for a chunked file: if another handle has it open, share its
+ * state, which may hold changes not stored yet; otherwise fetch its
+ * manifest, which is small, whole rather than just check for it.  Returns
+ * 0 on success, -ENOENT if there is no such file, and -EIO or -ENOMEM on
+ * failure.
+ */
+static int chunk_open(const s3dirent_t *dirent, s3file_t **file)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	//STEP 1: SHARE THE STATE OF ANY HANDLE ALREADY OPEN
+	if (file != NULL)
+	{
+		pthread_mutex_lock(&openfiles_lock);
+		*file = file_find(dirent->st_ino);
+		pthread_mutex_unlock(&openfiles_lock);
+		if (*file != NULL)
+		{
+			return 0;
+		}
+	}
+	//STEP 2: FETCH AND DECODE THE MANIFEST
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), dirent->st_ino);
+	uint8_t *buf = NULL;
+	s3fs_object_info_t info;
+	ssize_t getsuccess = s3fs_get_object_info((const char*)(ctx->s3bucket), key, &buf, 0, 0, &info);
+	if (getsuccess < 0)
+	{
+		free(buf);
+		return -ENOENT;
+	}
+	s3chunk_manifest_t manifest;
+	int decodesuccess = s3chunk_decode(buf, getsuccess, &manifest);
+	free(buf);
+	if (decodesuccess != 0)
+	{
+		return -EIO;
+	}
+	//STEP 3: GIVE THE HANDLE (IF THERE IS ONE) A STATE WITH THE MANIFEST'S CHUNKS, SHARED WITH THE FILE'S LATER HANDLES
+	int rv = 0;
+	if (file != NULL)
+	{
+		*file = file_new(dirent->st_ino, manifest.size, manifest.chunk_size);
+		if (*file == NULL)
+		{
+			rv = -ENOMEM;
+		}
+		else
+		{
+			memcpy((*file)->manifest.ids, manifest.ids, manifest.count * sizeof(uint64_t));
+			memcpy((*file)->etag, info.etag, S3FS_ETAG_SIZE);
+			*file = file_share(*file);
+		}
+	}
+	s3chunk_free(&manifest);
+	return rv;
+}
+
+/*
+ * Remove every chunk object of the chunked file with inode number ino, but
+ * not its manifest.  Returns 0 on success and -1 on failure.
+ */
+static int chunk_remove(uint64_t ino)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), ino);
+	uint8_t *buf = NULL;
+	ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), key, &buf, 0, 0);
+	s3chunk_manifest_t manifest;
+	int rv = getsuccess >= 0 ? s3chunk_decode(buf, getsuccess, &manifest) : -1;
+	free(buf);
+	if (rv != 0)
+	{
+		return -1;
+	}
+	//HOLES HAVE NO OBJECTS, SO SKIP THEM
+	int count = 0;
+	uint32_t c = 0;
+	for (; c < manifest.count; c++)
+	{
+		if (manifest.ids[c] != 0)
+		{
+			manifest.ids[count++] = manifest.ids[c];
+		}
+	}
+	rv = chunk_io((const char*)(ctx->s3bucket), ino, manifest.ids, NULL, NULL, count);
+	s3chunk_free(&manifest);
+	return rv;
+}
+
+/*
+ * Upload file's contents, if they have changed, and record its new size in
+ * its dirent, called name in the directory at path whose object is at
+ * direckey; with file's lock held.  Returns 0 on success and -EIO on
+ * failure (the changes are then kept, for another try).
+ */
+static int file_store(s3file_t *file, const char *path, const char *direckey, const char *name)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	if (!file->dirty)
+	{
+		return 0;
+	}
+	//STEP 1: PUT THE WHOLE FILE INTO S3 (OR, IF IT IS CHUNKED, JUST THE CHUNKS THAT CHANGED AND ITS MANIFEST)
+	if (file->chunk != 0)
+	{
+		if (chunk_store(file) != 0)
+		{
+			return -EIO;
+		}
+	}
+	else
+	{
+		char key[S3DIR_KEY_SIZE];
+		s3dir_object_key(key, sizeof(key), file->ino);
+		s3fs_object_info_t info;
+		ssize_t putsuccess = s3fs_put_object_info((const char*)(ctx->s3bucket), key, (uint8_t*)file->data, file->size, &info);
+		blockcache_invalidate(key, NULL);
+		if (putsuccess < 0)
+		{
+			file->etag[0] = '\0';
+			return -EIO;
+		}
+		memcpy(file->etag, info.etag, S3FS_ETAG_SIZE);
+	}
+	//STEP 2: CHANGE THE SIZE IN THE PARENT'S DIRENT IF NECESSARY (LOCKED, SO NO OTHER CHANGE TO IT IS LOST)
+	dirlock_lock(direckey);
+	s3dirent_t dirent;
+	int rv = dir_lookup(direckey, name, &dirent);
+	if (rv == 0 && dirent.st_ino != file->ino)//the name now belongs to some other file
+	{
+		rv = -ENOENT;
+	}
+	if (rv == 0 && dirent.st_size != (off_t)file->size)
+	{
+		dirent.st_size = file->size;
+		rv = dir_update(path, direckey, &dirent);
+	}
+	dirlock_unlock(direckey);
+	if (rv != 0)
+	{
+		return -EIO;
+	}
+	file->dirty = 0;
+	return 0;
+}
+
+/*
+ * file_store, for the file at path.
+ */
+static int file_flush(s3file_t *file, const char *path)
+{
+	if (!file->dirty)
+	{
+		return 0;
+	}
+	char direcname[PATH_MAX];
+	char name[256];
+	char direckey[S3DIR_KEY_SIZE];
+	if (path_split(path, direcname, name) != 0 || dir_key(direcname, direckey) != 0)
+	{
+		return -EIO;
+	}
+	return file_store(file, direcname, direckey, name);
+}
+
+/*
+ * A file's contents move through its s3file_t (see above) the same way on
+ * either API; file_open, file_read, file_write and file_truncate do the
+ * work of the operations of those names below, for both.
+ */
+
+/*
+ * Open the file dirent names: ensure that its object exists, drop any
+ * cached blocks of it from before it last changed and, if file isn't
+ * NULL, set *file to an open-file state for it (shared with its other
+ * handles, if it is chunked), to release with file_close.  Returns 0 on success,
+ * -ENOENT if there is no such object and -ENOMEM if out of memory (or, for
+ * a chunked file, -EIO if its manifest can't be read).
+ */
+static int file_open(const s3dirent_t *dirent, s3file_t **file)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	if (dirent->st_chunk != 0)
+	{
+		return chunk_open(dirent, file);
+	}
+	//STEP 1: ENSURE THAT THE FILE EXISTS
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), dirent->st_ino);
+	s3fs_object_info_t info;
+	int headsuccess = s3fs_head_object((const char*)(ctx->s3bucket), key, &info); //HEAD only, so the file's contents aren't downloaded
+	if (headsuccess < 0)//ensures that the object exists
+	{
+		return -ENOENT;
+	}
+	//STEP 2: DROP ANY CACHED BLOCKS OF THE FILE FROM BEFORE IT LAST CHANGED
+	blockcache_invalidate(key, info.etag);
+	//STEP 3: GIVE THE HANDLE (IF THERE IS ONE) ITS OWN STATE, TO BUFFER WRITES IN
+	if (file != NULL)
+	{
+		*file = file_new(dirent->st_ino, info.content_length, 0);
+		if (*file == NULL)
+		{
+			return -ENOMEM;
+		}
+		memcpy((*file)->etag, info.etag, S3FS_ETAG_SIZE);
+	}
+	return 0;
+}
 
 /*
- * For each function below, if you need to return an error,
- * read the appropriate man page for the call and see what
- * error codes make sense for the type of failure you want
- * to convey.  For example, many of the calls below return
- * -EIO (an I/O error), since there are no S3 calls yet
- * implemented.  (Note that you need to return the negative
- * value for an error code.)
+ * Read up to size bytes at offset from the file whose object is at key,
+ * through file (its open-file state, or NULL if it has none, which a
+ * chunked file must).  Returns the number of bytes read (short only at
+ * EOF) or -EIO.
+ */
+static int file_read(s3file_t *file, const char *key, char *buf, size_t size, off_t offset)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	if (file != NULL && file->chunk != 0)
+	{
+		return chunk_read(file, buf, size, offset);
+	}
+	//STEP 1: IF THE HANDLE HAS THE FILE LOADED (IT HAS BEEN WRITTEN TO), READ FROM THERE, SO THE READ SEES THOSE WRITES
+	int64_t filesize = -1;
+	char etag[S3FS_ETAG_SIZE] = "";
+	if (file != NULL)
+	{
+		pthread_mutex_lock(&file->lock);
+		filesize = file->size;
+		memcpy(etag, file->etag, S3FS_ETAG_SIZE);
+		if (file->loaded)
+		{
+			size_t count = 0;
+			if ((size_t)offset < file->size)
+			{
+				count = file->size - offset < size ? file->size - offset : size;
+				memcpy(buf, file->data + offset, count);
+			}
+			pthread_mutex_unlock(&file->lock);
+			return (int)count;
+		}
+		pthread_mutex_unlock(&file->lock);
+	}
+	//STEP 2: OTHERWISE READ THROUGH THE BLOCK CACHE (SHORT ONLY AT EOF), READING AHEAD WHILE THE HANDLE READS SEQUENTIALLY
+	ssize_t getsuccess = blockcache_read((const char*)(ctx->s3bucket), key, (uint8_t*)buf, size, offset, filesize, etag, file ? &file->stream : NULL);
+	if (getsuccess < 0)
+	{
+		return -EIO;
+	}
+	return (int)getsuccess;
+}
+
+/*
+ * Write size bytes at offset to file's buffer.  Returns size, or -EIO or
+ * -ENOMEM on failure.
+ */
+static int file_write(s3file_t *file, const char *buf, size_t size, off_t offset)
+{
+	pthread_mutex_lock(&file->lock);
+	if (file->chunk != 0)
+	{
+		int rv = chunk_write(file, buf, size, offset);
+		pthread_mutex_unlock(&file->lock);
+		return rv;
+	}
+	//STEP 1: READ IN THE CONTENTS OF THE FILE TO WRITE TO, THE FIRST TIME ONLY
+	int rv = file_load(file);
+	//STEP 2: GROW THE BUFFER IF THE WRITE GOES PAST THE END OF THE FILE (A GAP BEFORE IT READS AS ZEROES)
+	if (rv == 0)
+	{
+		rv = file_reserve(file, (size_t)offset + size);
+	}
+	//STEP 3: COPY THE NEW INPUT OVER THE OLD CONTENTS; IT IS UPLOADED ON FLUSH/RELEASE
+	if (rv == 0)
+	{
+		memcpy(file->data + offset, buf, size);
+		if ((size_t)offset + size > file->size)
+		{
+			file->size = (size_t)offset + size;
+		}
+		file->dirty = 1;
+		rv = (int)size;
+	}
+	pthread_mutex_unlock(&file->lock);
+	return rv;
+}
+
+/*
+ * Resize file's buffer to size bytes; it is uploaded with its other
+ * writes.  Returns 0, or -EIO or -ENOMEM on failure.
+ */
+static int file_truncate(s3file_t *file, off_t size)
+{
+	pthread_mutex_lock(&file->lock);
+	int rv = 0;
+	if (file->chunk != 0)
+	{
+		rv = chunk_resize(file, size);
+		pthread_mutex_unlock(&file->lock);
+		return rv;
+	}
+	if (size == 0)//nothing of the old contents is kept, so there's no need to load them
+	{
+		file->size = 0;
+		file->loaded = 1;
+	}
+	else
+	{
+		rv = file_load(file);
+	}
+	if (rv == 0)
+	{
+		rv = file_reserve(file, size);
+	}
+	if (rv == 0)
+	{
+		file->size = size;
+		file->dirty = 1;
+	}
+	pthread_mutex_unlock(&file->lock);
+	return rv;
+}
+
+/*
+ * Resize the file dirent names, in the directory at path whose object is
+ * at direckey, to size bytes, through a short-lived open-file state, as
+ * if it were opened, truncated and closed.  Returns 0, or -ENOENT, -EIO
+ * or -ENOMEM on failure.
+ */
+static int file_resize(const char *path, const char *direckey, const s3dirent_t *dirent, off_t size)
+{
+	s3file_t *file = NULL;
+	int rv = file_open(dirent, &file);
+	if (rv == 0)
+	{
+		rv = file_truncate(file, size);
+	}
+	if (rv == 0)
+	{
+		pthread_mutex_lock(&file->lock);
+		rv = file_store(file, path, direckey, dirent->name);
+		pthread_mutex_unlock(&file->lock);
+	}
+	if (file != NULL)
+	{
+		file_close(file);
+	}
+	return rv;
+}
+
+/*
+ * The node_* functions below do the work of the operations that change
+ * directories, on the entry called name in the directory whose object is
+ * at direckey.  The high-level operations find direckey from a path, and
+ * pass the directory's path along so cached attributes can be dropped;
+ * the low-level ones take it straight from a node ID, and pass NULL.
+ */
+
+/*
+ * Fill *st with the attributes of what dirent names: those dirent holds,
+ * for a file, or those a directory's own "." dirent holds.  Returns 0 on
+ * success, -ENOENT if the directory is gone and -EIO if dirent is of no
+ * known type.
+ */
+static int node_stat(const s3dirent_t *dirent, struct stat *st)
+{
+	s3dirent_t self = *dirent;
+	if (self.type == 'D' && strcmp(self.name, ".") != 0)
+	{
+		char key[S3DIR_KEY_SIZE];
+		s3dir_object_key(key, sizeof(key), self.st_ino);
+		if (dir_lookup(key, ".", &self) != 0)
+		{
+			return -ENOENT;
+		}
+	}
+	else if (self.type != 'F' && self.type != 'D')
+	{
+		return -EIO;
+	}
+	memset(st, 0, sizeof(struct stat));
+	st->st_mode = self.st_mode;
+	st->st_uid = self.st_uid;
+	st->st_gid = self.st_gid;
+	st->st_size = self.st_size;
+	st->st_ino = dirent->st_ino;
+	return 0;
+}
+
+/*
+ * Create an empty file called name with the given mode, and set *dirent
+ * to its new dirent.  Returns 0 on success, -EEXIST if the name is taken,
+ * -ENOENT if the directory is gone and -EIO on failure.
+ */
+static int node_mknod(const char *path, const char *direckey, const char *name, mode_t mode, s3dirent_t *dirent)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	//STEP 1: STORE THE NEW FILE (WHICH IS JUST NULL, OR IF CHUNKED AN EMPTY MANIFEST) IN S3 UNDER A NEW INODE NUMBER, BEFORE ANY DIRENT NAMES IT
+	uint64_t ino = new_ino();
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), ino);
+	uint8_t *manifest = NULL;
+	ssize_t len = 0;
+	if (chunkSizeG != 0)
+	{
+		s3chunk_manifest_t empty = { chunkSizeG, 0, 0, NULL };
+		len = s3chunk_encode(&empty, &manifest);
+		if (len < 0)
+		{
+			return -ENOMEM;
+		}
+	}
+	ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), key, manifest, len);
+	free(manifest);
+	if ((int)putsuccess < 0)//ensures that put was successful
+	{
+		return -EIO;
+	}
+	//STEP 2: FILL METADATA INTO A NEW DIRENT AND ADD IT TO THE PARENT DIRECTORY (ONLY THE SHARD THAT HOLDS IT IS REWRITTEN)
+	//dir_add ALSO ENSURES THAT SOME OTHER DIRENT WITH THE SAME NAME DOESN'T ALREADY EXIST HERE
+	memset(dirent, 0, sizeof(s3dirent_t));
+	dirent->type = 'F';
+	strncpy(dirent->name, name, 256);
+	dirent->st_uid = getuid();
+	dirent->st_gid = getgid();
+	dirent->st_mode = mode;
+	dirent->st_size = 0;
+	dirent->st_ino = ino;
+	dirent->st_chunk = chunkSizeG;
+	int addsuccess = dir_add(path, direckey, dirent);
+	if (addsuccess != 0)//ensures that add was successful, or else the new object is unreferenced
+	{
+		s3fs_remove_object((const char*)(ctx->s3bucket), key);
+		return addsuccess;
+	}
+	return 0;
+}
+
+/*
+ * Create an empty directory called name with the given mode (which must
+ * include S_IFDIR), and set *dirent to its new dirent.  Returns 0 on
+ * success, -EEXIST if the name is taken, -ENOENT if the directory is gone
+ * and -EIO on failure.
+ */
+static int node_mkdir(const char *path, const char *direckey, const char *name, mode_t mode, s3dirent_t *dirent)
+{
+	//STEP 1: CREATE NEWDIR AND IT'S METADATA DIRENT AND PLACE THE DIRENT AT NEWDIR[0]
+	uint64_t ino = new_ino();
+	s3dirent_t newdir[1];
+	s3dirent_t newself;
+	memset(&newself, 0, sizeof(s3dirent_t));
+	newself.name[0] = '.';
+	newself.name[1] = '\0';
+	newself.type = 'D';
+	newself.st_uid = getuid();
+	newself.st_gid = getgid();
+	newself.st_mode = mode;
+	newself.st_size = sizeof(s3dirent_t);
+	newself.st_ino = ino;
+	newdir[0] = newself;
+	//STEP 2: PUT NEW CHILD DIRECTORY INTO S3 UNDER ITS INODE NUMBER, BEFORE ANY DIRENT NAMES IT
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), ino);
+	int storesuccess = dir_store(key, newdir, 1);
+	if (storesuccess != 0)
+	{
+		return -EIO;
+	}
+	//STEP 3: FILL METADATA INTO A DIRENT AND ADD IT TO THE PARENT DIRECTORY (ITS ATTRIBUTES ARE KEPT IN ITS . DIRENT)
+	memset(dirent, 0, sizeof(s3dirent_t));
+	strncpy(dirent->name, name, 256);
+	dirent->type = 'D';
+	dirent->st_ino = ino;
+	int addsuccess = dir_add(path, direckey, dirent);
+	if (addsuccess != 0)//the new directory object is unreferenced, so remove it
+	{
+		dir_remove(key);
+		return addsuccess;
+	}
+	return 0;
+}
+
+/*
+ * Remove the file called name.  Returns 0 on success, -ENOENT if there is
+ * no such file and -EIO on failure.
+ */
+static int node_unlink(const char *path, const char *direckey, const char *name)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	//STEP 1: LOCK THE PARENT SO THE FILE CAN'T BE REPLACED BETWEEN FINDING AND REMOVING IT, AND ENSURE THAT IT EXISTS
+	dirlock_lock(direckey);
+	s3dirent_t dirent;
+	int rv = dir_lookup(direckey, name, &dirent);
+	if (rv == 0 && dirent.type != 'F')
+	{
+		rv = -ENOENT;
+	}
+	//STEP 2: REMOVE THE FILE'S DIRENT FROM ITS PARENT DIRECTORY (ONLY THE SHARD THAT HOLDS IT IS REWRITTEN)
+	if (rv == 0)
+	{
+		rv = dir_delete(path, direckey, name);
+	}
+	dirlock_unlock(direckey);
+	if (rv != 0)
+	{
+		return rv == -ENOENT ? -ENOENT : -EIO;
+	}
+	//STEP 3: REMOVE THE FILE FROM S3 (AND ITS BLOCKS FROM THE CACHE), CHUNKS FIRST IF IT HAS THEM (A FAILURE JUST LEAVES THEM BEHIND)
+	if (dirent.st_chunk != 0)
+	{
+		chunk_remove(dirent.st_ino);
+	}
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), dirent.st_ino);
+	blockcache_invalidate(key, NULL);
+	int rmsuccess = s3fs_remove_object((const char*)(ctx->s3bucket), key);
+	if (rmsuccess < 0)
+	{
+		return -EIO;
+	}
+	return 0;
+}
+
+/*
+ * Remove the empty directory called name.  Returns 0 on success, -ENOENT
+ * if there is no such entry, -ENOTDIR if it isn't a directory,
+ * -ENOTEMPTY if it isn't empty and -EIO on failure.
+ */
+static int node_rmdir(const char *path, const char *direckey, const char *name)
+{
+	//STEP 0: FIND THE DIR, AND LOCK IT AND ITS PARENT, SO NOTHING CAN BE CREATED IN THE DIR BETWEEN CHECKING AND REMOVING IT
+	s3dirent_t dirent;
+	if (strcmp(name, ".") == 0)
+	{
+		return -EBUSY;
+	}
+	if (dir_lookup(direckey, name, &dirent) != 0)
+	{
+		return -ENOENT;
+	}
+	if (dirent.type != 'D')
+	{
+		return -ENOTDIR;
+	}
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), dirent.st_ino);
+	dirlock_lock2(direckey, key);
+	int rv = 0;
+	//STEP 1: ENSURE THAT THE DIR IS STILL THERE AND HAS ONLY IT'S SELF ENTRY
+	s3dirent_t current;
+	int numdir = 0;
+	s3dirent_t *dirbuf = NULL;
+	if (dir_lookup(direckey, name, &current) != 0 || current.st_ino != dirent.st_ino)//renamed or removed meanwhile
+	{
+		rv = -ENOENT;
+	}
+	else if ((dirbuf = dir_load(key, &numdir)) == NULL)
+	{
+		rv = -ENOENT;
+	}
+	else if (numdir > 1)
+	{
+		rv = -ENOTEMPTY;
+	}
+	else if (strcmp(".", dirbuf[0].name) != 0)
+	{
+		rv = -EIO;
+	}
+	free(dirbuf);
+	//STEP 2: REMOVE THE DIR'S DIRENT FROM ITS PARENT
+	if (rv == 0)
+	{
+		rv = dir_delete(path, direckey, name);
+		if (rv != 0 && rv != -ENOENT)
+		{
+			rv = -EIO;
+		}
+	}
+	//STEP 3: REMOVE THE DIR
+	if (rv == 0)
+	{
+		rv = dir_remove(key);
+	}
+	dirlock_unlock2(direckey, key);
+	return rv;
+}
+
+/*
+ * Move the entry called name to the directory at newpath (whose object is
+ * at newdireckey), as newname, and set *dirent to its dirent there.  Only
+ * the dirent moves, so a directory costs no more to move than a file,
+ * however much lies below it.  Returns 0 on success, -ENOENT if there is
+ * no such entry, -EBUSY for the root and -EIO on failure or if newname is
+ * taken.
+ */
+static int node_rename(const char *path, const char *direckey, const char *name, const char *newpath, const char *newdireckey, const char *newname, s3dirent_t *dirent)
+{
+	//FIND THE DIRENT IN THE CURRENT PARENT, ENSURE THAT THE NEW NAME ISN'T TAKEN AS EITHER A FILE OR A DIRECTORY,
+	//AND MOVE THE DIRENT UNDER ITS NEW NAME (RENAMING IT IN PLACE IF IT STAYS IN THE SAME DIRECTORY OBJECT), WITH BOTH
+	//PARENTS LOCKED SO NO CHANGE TO THE DIRENT IS LOST
+	dirlock_lock2(direckey, newdireckey);
+	s3dirent_t existing;
+	int movesuccess = dir_lookup(direckey, name, dirent);
+	if (movesuccess == 0 && strcmp(name, ".") == 0)//the root can't be moved
+	{
+		movesuccess = -EBUSY;
+	}
+	else if (movesuccess == 0 && dir_lookup(newdireckey, newname, &existing) == 0)
+	{
+		movesuccess = -EEXIST;
+	}
+	else if (movesuccess == 0)
+	{
+		strncpy(dirent->name, newname, 256);
+		movesuccess = dir_move(path, direckey, name, newpath, newdireckey, dirent);
+	}
+	dirlock_unlock2(direckey, newdireckey);
+	if (movesuccess != 0)
+	{
+		return movesuccess == -ENOENT || movesuccess == -EBUSY ? movesuccess : -EIO;
+	}
+	return 0;
+}
+
+/*
+ * Truncate the file called name to nothing, and set *dirent to its
+ * dirent.  Returns 0 on success, -ENOENT if there is no such file and
+ * -EIO on failure.
+ */
+static int node_truncate(const char *path, const char *direckey, const char *name, s3dirent_t *dirent)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	//STEP 1: FIND METADATA IN PARENT AND CHANGE SIZE TO 0 (LOCKED, SO NO OTHER CHANGE TO IT IS LOST)
+	dirlock_lock(direckey);
+	if (dir_lookup(direckey, name, dirent) != 0 || dirent->type != 'F')
+	{
+		dirlock_unlock(direckey);
+		return -ENOENT;
+	}
+	if (dirent->st_chunk != 0)//a chunked file's chunks are dropped through its manifest, which file_store rewrites with its dirent
+	{
+		dirlock_unlock(direckey);
+		int rv = file_resize(path, direckey, dirent, 0);
+		dirent->st_size = 0;
+		return rv == 0 || rv == -ENOENT ? rv : -EIO;
+	}
+	dirent->st_size = 0;
+	//STEP 2: PUT FIXED PARENT AND 0-LENGTH FILE IN S3
+	int storesuccess = dir_update(path, direckey, dirent); //put parent directory (or the shard holding the dirent) with updated dirent in s3
+	dirlock_unlock(direckey);
+	if (storesuccess != 0)
+	{
+		return -EIO;
+	}
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), dirent->st_ino);
+	blockcache_invalidate(key, NULL);
+	ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), key, NULL, 0); //change file to a zero length NULL
+	if ((int)putsuccess < 0)
+	{
+		return -EIO;
+	}
+	return 0;
+}
+
+/*
+ * List the directory at path (NULL on the low-level API), whose object is
+ * at direckey, to filler from offset on, as fs_readdir describes.  Returns
+ * 0 once the listing ends or filler is full, and -EIO on failure.
  */
+static int dir_list(const char *path, const char *direckey, void *buf, fuse_fill_dir_t filler, off_t offset)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	const char *bucket = (const char*)(ctx->s3bucket);
+	//STEP 1: FIND HOW MANY SHARDS THE DIRECTORY IS SPLIT INTO (0 IF IT ISN'T)
+	int shards = dir_shards(bucket, direckey);
+	if (shards < 0)
+	{
+		return -EIO;
+	}
+	//STEP 2: LIST THE DIRECTORY OBJECT, THEN EACH SHARD, ONE AT A TIME, FROM WHERE THE LAST CALL LEFT OFF
+	//offsets are (part << 32 | next index), where part 0 is the directory object and part n is shard n-1,
+	//so filler can stop us when the kernel's buffer is full and a large directory is never listed whole
+	int part = (int)(offset >> 32);
+	int i = (int)(offset & 0xffffffff);
+	for (; part <= shards; part++, i = 0)
+	{
+		char key[S3DIR_KEY_SIZE];
+		if (part == 0)
+		{
+			strncpy(key, direckey, sizeof(key));
+		}
+		else
+		{
+			s3dir_shard_key(key, sizeof(key), direckey, shards, part - 1);
+		}
+		uint64_t epoch = attrcache_epoch();
+		int count = 0;
+		s3dirent_t *direc = part_load(bucket, key, &count, NULL);
+		if (direc == NULL)
+		{
+			return -EIO;
+		}
+		for (; i < count; i++)
+		{
+			if (strcmp(direc[i].name, S3DIR_SHARDS_NAME) == 0)
+			{
+				continue;
+			}
+			//STEP 3: FILL IN THE ATTRIBUTES THE DIRENT HOLDS, SO THE KERNEL NEEDN'T GETATTR EACH ENTRY
+			struct stat st;
+			dirent_stat(path, &direc[i], &st, epoch);
+			if (filler(buf, direc[i].name, &st, ((off_t)part << 32) | (i + 1)) != 0)//the buffer is full
+			{
+				free(direc);
+				return 0;
+			}
+		}
+		free(direc);
+	}
+	return 0;
+}
 
 /*
  * Open directory
@@ -39,26 +1438,34 @@
 int fs_opendir(const char *path, struct fuse_file_info *fi) 
 {
 	fprintf(stderr, "fs_opendir(path=\"%s\")\n", path);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	uint8_t *direc = NULL;
-	size_t exists = s3fs_get_object((const char*)(ctx->s3bucket), (const char*)path, &direc, 0, 0);
-	if ((int)exists < 0)//ensures that get returned successfuly
+	struct stat st;
+	int cached = attrcache_get(path, &st);
+	if (cached == ATTRCACHE_ABSENT)//probed before and found missing
 	{
 		return -ENOENT;
 	}
-	else if ((int)exists == 0)//ensures that the object retrieved isn't empty (which would be really weird)
+	else if (cached == ATTRCACHE_HIT)
 	{
-		return -EIO;
+		return S_ISDIR(st.st_mode) ? 0 : -ENOENT;
+	}
+	uint64_t epoch = attrcache_epoch();
+	s3dirent_t dirent;
+	int found = path_lookup(path, &dirent);
+	if (found != 0)//ensures that the directory exists
+	{
+		if (found == -ENOENT)
+		{
+			attrcache_put_absent(path, epoch);
+		}
+		return -ENOENT;
 	}
-	s3dirent_t *direcbuff = NULL;
-	direcbuff = (s3dirent_t*)direc;
-	if (direcbuff[0].type == 'D')//ensures that the object retrieved is a directory and returns success if True or -EIO if False
+	if (dirent.type == 'D')//ensures that the object found is a directory and returns success if True or -ENOENT if False
 	{
 		return 0;
 	}
 	else
 	{
-		return -EIO;
+		return -ENOENT;
 	}
 }
 
@@ -74,63 +1481,32 @@ int fs_getattr(const char *path, struct stat *statbuf)
 {
 	//getattr assumes that the file/directory has been successfully opened, and therefore exists
 	fprintf(stderr, "fs_getattr(path=\"%s\")\n", path);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	//STEP 1: ENSURE PARENT DIRECTORY EXISTS
-	char *pathcpy = strdup(path);
-	char *direcname = dirname(pathcpy);
-	uint8_t *metadireccpy = NULL;
-	ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), (const char*)direcname, &metadireccpy, 0, 0);
-	if ((int)getsuccess < 0)//ensure get worked right...
-	{
-		return -ENOENT;
-	}
-	else if ((int)getsuccess == 0)
+	//STEP 1: ANSWER FROM THE ATTRIBUTE CACHE IF A LISTING OR EARLIER LOOKUP LEFT THE TARGET (OR ITS ABSENCE) THERE
+	uint64_t epoch = attrcache_epoch();
+	int cached = attrcache_get(path, statbuf);
+	if (cached != ATTRCACHE_MISS)
 	{
-		return -EIO;
+		return cached == ATTRCACHE_HIT ? 0 : -ENOENT;
 	}
-	//STEP 2: ITERATE THROUGH PARENT DIRECTORY SEARCHING FOR THE TARGET S3DIRENT_T
-	s3dirent_t *metadirec = NULL;
-	metadirec = (s3dirent_t*)metadireccpy;
+	//STEP 2: FIND THE TARGET'S DIRENT IN ITS PARENT DIRECTORY (THE ROOT HAS NO PARENT, SO USE ITS . DIRENT)
 	s3dirent_t currentdirent;
-	int numdir = (int)getsuccess / sizeof(s3dirent_t);
-	int i = 0;
-	for (; i < numdir; i++)
+	int found = path_lookup(path, &currentdirent);
+	if (found != 0)
 	{
-		currentdirent = metadirec[i];
-		if (strcmp(currentdirent.name, path));
+		if (found == -ENOENT)
 		{
-			//STEP 3: CHECK THE FILE TYPE OF THE TARGET, FILE -> FILL METADATA FROM DIRENT IN PARENT/DIRECTORY -> FILL METADATA FROM DIRENT IN . OF ITSELF
-			if (currentdirent.type == 'F')
-			{
-				statbuf->st_mode = currentdirent.st_mode;
-				statbuf->st_uid = currentdirent.st_uid;
-				statbuf->st_gid = currentdirent.st_gid;
-				statbuf->st_size = currentdirent.st_size;
-				return 0;
-			}
-			else if (currentdirent.type == 'D')
-			{
-				uint8_t *utargetdir = NULL;
-				getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), (const char*)path, &utargetdir, 0, 0);
-				if ((int)getsuccess < 0) //ensure get worked right...
-				{
-					return -ENOENT;
-				}
-				else if ((int)getsuccess == 0)
-				{
-					return -EIO;
-				}
-				s3dirent_t *targetdir = NULL;
-				targetdir = (s3dirent_t*)utargetdir;
-				statbuf->st_mode = targetdir[0].st_mode;
-				statbuf->st_uid = targetdir[0].st_uid;
-				statbuf->st_gid = targetdir[0].st_gid;
-				statbuf->st_size = targetdir[0].st_size;
-				return 0;
-			}
+			attrcache_put_absent(path, epoch);
 		}
+		return found;
 	}
-	return -EIO;
+	//STEP 3: CHECK THE FILE TYPE OF THE TARGET, FILE -> FILL METADATA FROM DIRENT IN PARENT/DIRECTORY -> FILL METADATA FROM DIRENT IN . OF ITSELF
+	int statsuccess = node_stat(&currentdirent, statbuf);
+	if (statsuccess != 0)
+	{
+		return statsuccess;
+	}
+	attrcache_put(path, statbuf, epoch);
+	return 0;
 }
 
 
@@ -148,65 +1524,60 @@ int fs_getattr(const char *path, struct stat *statbuf)
  */
 int fs_open(const char *path, struct fuse_file_info *fi)
 {
-	//STEP 1: ENSURE THAT THE FILE EXISTS
+	//STEP 1: GIVE UP AT ONCE ON A PATH PROBED BEFORE AND FOUND MISSING
 	fprintf(stderr, "fs_open(path\"%s\")\n", path);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	uint8_t *placeholder = NULL;
-	size_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), (const char*)path, &placeholder, 0, 0);
-	if ((int)getsuccess < 0)//ensures that the object exists
+	uint64_t epoch = attrcache_epoch();
+	struct stat st;
+	if (attrcache_get(path, &st) == ATTRCACHE_ABSENT)
+	{
+		return -ENOENT;
+	}
+	//STEP 2: ENSURE THAT THE PARENT DIRECTORY (AND THEREFORE METADATA) EXISTS AND FIND THE FILE'S DIRENT
+	//THIS COMES BEFORE THE HEAD, SINCE THE PARENT IS USUALLY CACHED, SO A MISSING FILE COSTS NO REQUEST
+	s3dirent_t dirent;
+	int found = path_lookup(path, &dirent);
+	if (found != 0)
 	{
+		if (found == -ENOENT)
+		{
+			attrcache_put_absent(path, epoch);
+		}
 		return -ENOENT;
 	}
-	//STEP 2: ENSURE THAT THE PARENT DIRECTORY (AND THEREFORE METADATA) EXISTS
-	uint8_t *udirec = NULL;
-	char *pathcpy = strdup(path);
-	char *direcname = dirname(pathcpy);
-	getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), (const char*)direcname, &udirec, 0, 0);
-	if ((int)getsuccess < 0)//ensures that the parent exists and isn't empty (which would be really weird)
+	//STEP 3: ENSURE THAT THE OBJECT IS A FILE
+	if(dirent.type != 'F')
 	{
 		return -ENOENT;
 	}
-	else if ((int)getsuccess == 0)
+	//STEP 4: ENSURE THAT THE FILE EXISTS, AND GIVE THE HANDLE (IF THERE IS ONE) A STATE TO BUFFER WRITES IN
+	s3file_t *file = NULL;
+	int opensuccess = file_open(&dirent, fi != NULL ? &file : NULL);
+	if (opensuccess != 0)
 	{
-		return -EIO;
+		return opensuccess;
 	}
-	//STEP 3: ENSURE THAT THE OBJECT IS A FILE
-	s3dirent_t *direc = NULL;
-	direc = (s3dirent_t*)udirec;
-	int numdirents = (int)getsuccess / sizeof(s3dirent_t);
-	int i = 0;
-	for (; i < numdirents; i++)
+	if (fi != NULL)
 	{
-		if (strcmp(direc[i].name, path) == 0)
-		{
-			if(direc[i].type == 'F')
-			{
-				return 0;
-			}
-			else
-			{
-				return -ENOENT;
-			}
-		}
+		fi->fh = (uint64_t)(uintptr_t)file;
 	}
-	return -EIO;
+	return 0;
 }
 
 
-/* 
- * Create a file "node".  When a new file is created, this
- * function will get called.  
- * This is called for creation of all non-directory, non-symlink
- * nodes.  You *only* need to handle creation of regular
- * files here.  (See the man page for mknod (2).)
+/*
+ * Create the file at path, as fs_mknod does, and set *dirent to its new
+ * dirent.
  */
-int fs_mknod(const char *path, mode_t mode, dev_t dev)
+static int file_create(const char *path, mode_t mode, s3dirent_t *dirent)
 {
-	fprintf(stderr, "fs_mknod(path=\"%s\", mode=0%3o)\n", path, mode);
-	s3context_t *ctx = GET_PRIVATE_DATA;
 	//STEP 1: ENSURE THE PARENT EXISTS AND IS A VALID DIRECTORY AND THAT THE NEW FILE DOESN'T ALREADY EXIST
-	char *pathcpy = strdup(path);
-	char *direcname = dirname(pathcpy);
+	char direcname[PATH_MAX];
+	char name[256];
+	int splitsuccess = path_split(path, direcname, name);
+	if (splitsuccess != 0)
+	{
+		return splitsuccess;
+	}
 	int opensuccess = fs_opendir((const char *)direcname, NULL);
 	if (opensuccess != 0)//ensures that parent direc opened
 	{
@@ -217,60 +1588,56 @@ int fs_mknod(const char *path, mode_t mode, dev_t dev)
 	{
 		return -EEXIST;
 	}
-	//STEP 2: GET THE PARENT DIRECTORY INTO A BUFFER
-	uint8_t *udirarr = NULL;
-	ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), (const char*)direcname, &udirarr, 0, 0);
-	if ((int)getsuccess < 0)//ensures that get was successful
+	char direckey[S3DIR_KEY_SIZE];
+	if (dir_key(direcname, direckey) != 0)
 	{
 		return -ENOENT;
 	}
-	else if ((int)getsuccess == 0)
-	{
-		return -EIO;
-	}
-	s3dirent_t *dirarr = NULL;
-	dirarr = (s3dirent_t*)udirarr;
-	//STEP 3: COPY PARENT DIRECTORY OVER TO A BUFFER WITH SPACE FOR 1 MORE DIRENT, THEN FILL NEWNODE DIRENT INTO THE LAST SPOT IN THE ARRAY
-	//SIMULTANEOUSLY ENSURES THAT SOME OTHER DIRENT WITH THE SAME NAME DOESN'T ALREADY EXIST HERE (IT SHOULDN'T)
-	int numdirent = (int)getsuccess / sizeof(s3dirent_t);
-	s3dirent_t *newdirarr = malloc ((numdirent +1)*(sizeof (s3dirent_t)));
-	int i = 0;
-	for (; i < numdirent ; i++)
-	{
-		if (strcmp(dirarr[i].name,path) == 0) //ensures that the parent doesn't already hold an entry for this file. This is a recoverable error, but it would only happen if something very weird happened previously and the user should get an error so that they know
-		{
-			return -EEXIST;
-		}
-		newdirarr[i] = dirarr[i];
-	}
-	s3dirent_t metadata;
-	//STEP 4: FILL METADATA INTO A NEW DIRENT AND THEN STORE THE NEWLY UPDATED PARENT DIRECTORY IN S3
-	uid_t usr = getuid();
-	gid_t group = getgid();
-	metadata.type = 'F';
-	strncpy(metadata.name, path, 256);
-	metadata.st_uid = usr;
-	metadata.st_gid = group;
-	metadata.st_mode = mode;
-	metadata.st_size = 0;
-	newdirarr[numdirent] = metadata;
-	newdirarr[0].st_size = newdirarr[0].st_size + sizeof(s3dirent_t); //change size of parent
-	ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), (const char*)direcname, (uint8_t*)newdirarr, newdirarr[0].st_size);
-	if ((int)putsuccess <= 0)//ensures that put was successful
+	//STEP 2: CREATE IT
+	return node_mknod(direcname, direckey, name, mode, dirent);
+}
+
+/*
+ * Create a file "node".  When a new file is created, this
+ * function will get called.
+ * This is called for creation of all non-directory, non-symlink
+ * nodes.  You *only* need to handle creation of regular
+ * files here.  (See the man page for mknod (2).)
+ */
+int fs_mknod(const char *path, mode_t mode, dev_t dev)
+{
+	fprintf(stderr, "fs_mknod(path=\"%s\", mode=0%3o)\n", path, mode);
+	s3dirent_t dirent;
+	return file_create(path, mode, &dirent);
+}
+
+
+/*
+ * Create and open a file.  The new file is empty, so its handle starts
+ * out with nothing to load and its writes are buffered from the start.
+ */
+int fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+	fprintf(stderr, "fs_create(path=\"%s\", mode=0%3o)\n", path, mode);
+	//STEP 1: CREATE THE FILE
+	s3dirent_t dirent;
+	int mknodsuccess = file_create(path, mode, &dirent);
+	if (mknodsuccess != 0)
 	{
-		return -EIO;
+		return mknodsuccess;
 	}
-	//STEP 5: STORE THE NEW FILE (WHICH IS JUST NULL) IN S3
-	putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), path, NULL, 0);
-	if ((int)putsuccess <= 0)//ensures that put was successful
+	//STEP 2: OPEN IT, WITHOUT THE HEAD AND LOOKUP FS_OPEN WOULD DO
+	s3file_t *file = file_new(dirent.st_ino, 0, dirent.st_chunk);
+	if (file == NULL)
 	{
-		return -EIO;
+		return -ENOMEM;
 	}
+	fi->fh = (uint64_t)(uintptr_t)file_share(file);
 	return 0;
 }
 
 
-/* 
+/*
  * Create a new directory.
  *
  * Note that the mode argument may not have the type specification
@@ -281,73 +1648,28 @@ int fs_mknod(const char *path, mode_t mode, dev_t dev)
 int fs_mkdir(const char *path, mode_t mode)
 {
 	fprintf(stderr, "fs_mkdir(path=\"%s\", mode=0%3o)\n", path, mode);
-	s3context_t *ctx = GET_PRIVATE_DATA;
 	mode |= S_IFDIR;
-	//STEP 1: ENSURE THAT THE DIRECTORY TO BE CREATED DOESN'T ALREADY EXIST
+	//STEP 1: ENSURE THAT THE DIRECTORY TO BE CREATED DOESN'T ALREADY EXIST, AND THAT ITS PARENT DOES
 	int opensuccess = fs_opendir(path, NULL);
 	if (opensuccess == 0)
 	{
 		return -EEXIST;
 	}
-	//STEP 2: ENSURE THAT THE DIRECTORY'S PARENT EXISTS
-	char *pathcpy = malloc(sizeof(path));
-	strcpy(pathcpy, path);
-	char *direcname = dirname(pathcpy); //uses a copy because dirname command alters input string
-	uint8_t *upardir = NULL;
-	ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), direcname, &upardir, 0, 0);
-	if ((int)getsuccess < 0)
-	{
-		return -ENOENT;
-	}
-	else if ((int)getsuccess == 0)
-	{
-		return -EIO;
-	}
-	s3dirent_t *pardir = NULL;
-	pardir = (s3dirent_t*)upardir;
-	//STEP 3: ITERATE THROUGH PARENT DIRECTORY COPYING OVER DATA TO A 1 DIRENT LARGER BUFFER TO BE STORED AS THE NEW ARRAY WITH THE NEW DIR'S DIRENT INCLUDED
-	int numdirent = (int)getsuccess / sizeof(s3dirent_t);
-	s3dirent_t *tempdir = malloc(sizeof(s3dirent_t) * (numdirent + 1));
-	int i = 0;
-	for (; i < numdirent; i++)
-	{
-		tempdir[i] = pardir[i];
-	}
-	//STEP 4: FLL METADATA INTO A DIRENT AND PUT IT INTO THE NEW PARENT ARRAY
-	s3dirent_t newself;
-	strncpy(newself.name, path, 256);
-	newself.type = 'D';
-	newself.st_uid = 0;
-	newself.st_gid = 0;
-	newself.st_mode = 0;
-	newself.st_size = 0;
-	tempdir[numdirent] = newself;
-	tempdir[0].st_size = tempdir[0].st_size + sizeof(s3dirent_t);
-	//STEP 5: CREATE NEWDIR AND IT'S METADATA DIRENT AND PLACE THE DIRENT AT NEWDIR[0]
-	s3dirent_t* newdir = malloc(sizeof(s3dirent_t));
-	uid_t user = getuid();
-	gid_t group = getgid();
-	newself.name[0] = '.';
-	newself.name[1] = '\0';
-	newself.type = 'D';
-	newself.st_uid = user;
-	newself.st_gid = group;
-	newself.st_mode = mode;
-	newself.st_size = sizeof(s3dirent_t);
-	newdir[0] = newself;
-	//STEP 6: PUT NEW PARENT DIRECTORY AND NEW CHILD DIRECTORY INTO S3
-	tempdir[0].st_size = tempdir[0].st_size + sizeof(s3dirent_t); //update parent directory size
-	ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), direcname, (uint8_t*)tempdir, (sizeof(s3dirent_t) * (numdirent + 1)));
-	if ((int)putsuccess <= 0)
+	char direcname[PATH_MAX];
+	char name[256];
+	int splitsuccess = path_split(path, direcname, name);
+	if (splitsuccess != 0)
 	{
-		return -EIO;
+		return splitsuccess;
 	}
-	putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), path, (uint8_t*)newdir, sizeof(s3dirent_t));
-	if ((int)putsuccess < 0)
+	char direckey[S3DIR_KEY_SIZE];
+	if (dir_key(direcname, direckey) != 0)
 	{
-		return -EIO;
+		return -ENOENT;
 	}
-	return 0;
+	//STEP 2: CREATE IT
+	s3dirent_t dirent;
+	return node_mkdir(direcname, direckey, name, mode, &dirent);
 }
 
 /*
@@ -356,274 +1678,81 @@ int fs_mkdir(const char *path, mode_t mode)
 int fs_unlink(const char *path)
 {
 	fprintf(stderr, "fs_unlink(path=\"%s\")\n", path);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	//STEP 1: ENSURE THAT THE FILE TO BE UNLINKED EXISTS, AND RETRIEVE IT'S PARENT DIRECTORY
-	int opensuccess = fs_open(path, NULL);
-	if (opensuccess == 0)
-	{
-		return -EEXIST;
-	}
-	char *pathcpy = strdup(path);
-	char *direcname = dirname(pathcpy);
-	uint8_t *upardir = NULL;
-	ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), direcname, &upardir, 0, 0);
-	if ((int)getsuccess < 0)
+	//STEP 1: FIND THE PARENT DIRECTORY
+	char direcname[PATH_MAX];
+	char name[256];
+	char direckey[S3DIR_KEY_SIZE];
+	if (path_split(path, direcname, name) != 0 || dir_key(direcname, direckey) != 0)
 	{
 		return -ENOENT;
 	}
-	else if ((int)getsuccess == 0)
-	{
-		return -EIO;
-	}
-	s3dirent_t *pardir = NULL;
-	pardir = (s3dirent_t *)upardir;
-	//STEP 2: ITERATE THROUGH PARENT DIRECTORY, COPYING OVER TO A NEW 1 SMALLER ARRAY, AND NOT INCLUDING THE DIRENT OF THE FLE TO BE REMOVED
-	int numdirents = (int)getsuccess / sizeof(s3dirent_t); 
-	int i = 0;
-	int j = 0;
-	s3dirent_t *newpardir = malloc(sizeof(s3dirent_t) * (numdirents - 1));
-	for (; i < numdirents ; i++)
-	{
-		if(strcmp(pardir[i].name,path) != 0)
-		{
-			newpardir[i] = pardir[i];
-			j++;
-		}
-	}
-	if (j == (i - 1))
-	{
-		//STEP 3: PUT THE ALTERED PARENT DIRECTORY AND REMOVE THE FILE FROM S3
-		newpardir[0].st_size = newpardir[0].st_size - sizeof(s3dirent_t); //update size of parent directory
-		ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), direcname, (uint8_t*)newpardir, newpardir[0].st_size);
-		if ((int)putsuccess <= 0)
-		{
-			return -EIO;
-		}
-		int rmsuccess = s3fs_remove_object((const char*)(ctx->s3bucket), path);
-		if (rmsuccess < 0)
-		{
-			return -EIO;
-		}
-		return 0;
-	}
-	return -EIO;
+	//STEP 2: REMOVE THE FILE FROM IT, AND FROM S3
+	return node_unlink(direcname, direckey, name);
 }
 
 /*
- * Remove a directory. 
+ * Remove a directory.
  */
 int fs_rmdir(const char *path)
 {
 	fprintf(stderr, "fs_rmdir(path=\"%s\")\n", path);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	//STEP 1: ENSURE THAT DIR TO BE REMOVED EXISTS AND HAS ONLY IT'S SELF ENTRY
-	uint8_t *udirbuf = NULL;
-	ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), path, &udirbuf, 0, 0);
-	if ((int)getsuccess < 0)
-	{
-		return -ENOENT;
-	}
-	else if ((int)getsuccess == 0)
-	{
-		return -EIO;
-	}
-	s3dirent_t *dirbuf = NULL;
-	dirbuf = (s3dirent_t*)udirbuf;
-	int numdir = (int)getsuccess/sizeof(s3dirent_t);
-	if (numdir > 1)
+	//STEP 1: FIND THE PARENT DIRECTORY
+	char direcname[PATH_MAX];
+	char name[256];
+	char direckey[S3DIR_KEY_SIZE];
+	if (strcmp(path, "/") == 0)
 	{
-		return -ENOTEMPTY;
+		return -EBUSY;
 	}
-	else if (strcmp(".", dirbuf[0].name) != 0)
-	{
-		return -EIO;
-	}
-	//STEP 2: ENSURE THAT PARENT DIR EXISTS AND RETRIEVE IT
-	char *pathcpy = malloc(sizeof(path));
-	strcpy(pathcpy, path);
-	char *direcname = dirname(pathcpy); //uses a copy because dirname command alters input string
-	udirbuf = NULL;
-	getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), direcname, &udirbuf, 0, 0);
-	if ((int)getsuccess < 0)
+	if (path_split(path, direcname, name) != 0 || dir_key(direcname, direckey) != 0)
 	{
 		return -ENOENT;
 	}
-	else if ((int)getsuccess == 0)
-	{
-		return -EIO;
-	}
-	dirbuf = NULL; //holds parent directory stuff while we make a bigger directory and transfer it over
-	dirbuf = (s3dirent_t*)udirbuf;
-	//STEP 3: ITERATE THROUGH PARENT DIR TO COPY OVER ALL BUT THE DIRENT TO BE REMOVED
-	numdir = (int)getsuccess/sizeof(s3dirent_t);
-	s3dirent_t *newdir = malloc(sizeof(s3dirent_t) * (numdir - 1));
-	int i = 0;
-	int j = 0;
-	for (; i < numdir; i++)
-	{
-		if (strcmp(dirbuf[i].name, path) != 0)
-		{
-			newdir[j] = dirbuf[i];
-			j++;
-		}
-	}
-	if (j == (i - 1))
-	{
-		//STEP 4: PUT THE NEW PARENT AND REMOVE THE DIR
-		newdir[0].st_size = sizeof(s3dirent_t) * (numdir - 1); //change parent size
-		ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), path, (uint8_t*)newdir, sizeof(s3dirent_t) * (numdir - 1));
-		if ((int)putsuccess <= 0)
-		{
-			return -EIO;
-		}
-		int rmsuccess = s3fs_remove_object((const char*)(ctx->s3bucket), path);
-		if (rmsuccess < 0)
-		{
-			return -EIO;
-		}
-		return 0;
-	}
-	return -EIO;
+	//STEP 2: REMOVE THE DIR FROM IT, IF IT IS EMPTY, AND FROM S3
+	return node_rmdir(direcname, direckey, name);
 }
 
 /*
- * Rename a file.
+ * Rename a file or a directory.
  */
 int fs_rename(const char *path, const char *newpath)
 {
 	fprintf(stderr, "fs_rename(fpath=\"%s\", newpath=\"%s\")\n", path, newpath);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	//STEP 1: ENSURE THAT THE FILE TO BE RENAMED EXISTS AND THAT THE NEW FILENAME ISN'T TAKEN AS EITHER A FILE OR A DIRECTORY
-	int opensuccess = fs_open(path, NULL);
-	if (opensuccess != 0)
+	//STEP 1: FIND BOTH PARENT DIRECTORIES, AND REFUSE TO MOVE A DIRECTORY INTO ITSELF
+	char direcname[PATH_MAX];
+	char newdirecname[PATH_MAX];
+	char name[256];
+	char newname[256];
+	int splitsuccess = path_split(newpath, newdirecname, newname);
+	if (splitsuccess != 0)
 	{
-		return -ENOENT;
+		return splitsuccess;
 	}
-	opensuccess = fs_open(newpath, NULL); //this only works if fs_open only returns error if the file doesn't exist
-	int opensuccess2 = fs_opendir(newpath, NULL);
-	if (opensuccess == 0 || opensuccess2 == 0)
+	size_t len = strlen(path);
+	if (strncmp(path, newpath, len) == 0 && newpath[len] == '/')
 	{
-		return -EIO;
+		return -EINVAL;
 	}
-	//STEP 2: GET THE CURRENT PARENT DIRECTORY
-	char *pathcpy = strdup(path);
-	char *newpathcpy = strdup(newpath);
-	char *direcname = dirname(pathcpy);
-	char *newdirecname = dirname(newpathcpy);
-	uint8_t *upathparent = NULL;
-	ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), direcname, &upathparent, 0, 0);
-	if ((int)getsuccess <= 0)
+	char direckey[S3DIR_KEY_SIZE];
+	char newdireckey[S3DIR_KEY_SIZE];
+	if (path_split(path, direcname, name) != 0 || dir_key(direcname, direckey) != 0 || dir_key(newdirecname, newdireckey) != 0)
 	{
 		return -ENOENT;
 	}
-	s3dirent_t *pathparent = NULL; //holds parent directory stuff while we make a bigger directory and transfer it over
-	pathparent = (s3dirent_t*)upathparent;
-	//STEP 3: FIND THE DIRENT IN THE CURRENT PARENT
-	int numdirents = (int)getsuccess/sizeof(s3dirent_t);
-	int i = 0;
-	int fileindex = -1;
-	for (;i<numdirents;i++)
-	{
-		if (strcmp(pathparent[i].name,path) == 0)
-		{
-			fileindex = i;
-			i = numdirents;
-		}
-	}
-	if (fileindex <= 0)
-	{
-		return -EIO;
-	}
-	//STEP 4A: IF THE DIRECTORY OF THE NEW AND CURRENT ARE THE SAME, SIMPLY RENAME THE DIRENT AND STORE THE FILE IN THE NEW KEY
-	if (strcmp(direcname, newdirecname) == 0)
+	//STEP 2: MOVE ITS DIRENT
+	s3dirent_t dirent;
+	int movesuccess = node_rename(direcname, direckey, name, newdirecname, newdireckey, newname, &dirent);
+	if (movesuccess != 0)
 	{
-		strncpy(pathparent[fileindex].name, newpath, 256);
-		uint8_t *ufcontents = NULL;
-		getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), path, &ufcontents, 0, 0); //get the file contents from s3
-		if ((int)getsuccess < 0)
-		{
-			return -ENOENT;
-		}
-		ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), direcname, (uint8_t*)pathparent, (sizeof(s3dirent_t) * numdirents)); //put the parent dir with updated dirent in s3
-		if ((int)putsuccess <= 0)
-		{
-			return -EIO;
-		}
-		putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), newpath, ufcontents, getsuccess); //put the file contents in the new file location
-		if ((int)putsuccess < 0)
-		{
-			return -EIO;
-		}
-		int rmsuccess = s3fs_remove_object((const char*)(ctx->s3bucket), path); //remove the old file
-		if (rmsuccess < 0)
-		{
-			return -EIO;
-		}
-		return 0;
+		return movesuccess;
 	}
-	//STEP 4B: OTHERWISE ITERATE THROUGH NEW PARENT, COPYING OVER TO A +1 SIZED BUFFER, THEN PUT THE NEW BUFFER WITH NEW DIRENT IN S3
-	else
+	//STEP 3: EVERYTHING BELOW A MOVED DIRECTORY HAS A NEW PATH, SO DROP WHAT WAS CACHED UNDER THE OLD AND NEW ONES
+	if (dirent.type == 'D')
 	{
-		uint8_t *unewparent = NULL;
-		getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), newdirecname, &unewparent, 0, 0); //get the contents of the new directory
-		if ((int)getsuccess <= 0)
-		{
-			return -ENOENT;
-		}
-		s3dirent_t *newparent = NULL;
-		newparent = (s3dirent_t*)unewparent;
-		int newnumdirents = (int)getsuccess / sizeof(s3dirent_t);
-		//STEP 5: FIX THE NEW DIRECTORY'S SIZE AND CONTENTS TO REFLECT THE FILE YOU'VE ADDED
-		s3dirent_t *newnewparent = malloc(sizeof(s3dirent_t) * (newnumdirents + 1)); //allocate new array for new directory
-		int j = 0;
-		for (;j<newnumdirents;j++) //copy over new directory
-		{
-			newnewparent[j] = newparent[j];
-		}
-		newnewparent[newnumdirents] = pathparent[fileindex]; //add new dirent
-		newnewparent[0].st_size = newnewparent[0].st_size + sizeof(s3dirent_t); //update new parent size data
-		ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), newdirecname, (uint8_t*)newnewparent, ((newnumdirents + 1) * (sizeof(s3dirent_t)))); //put the new parent dirent in s3
-		if ((int)putsuccess <= 0)
-		{
-			return -EIO;
-		}
-		uint8_t *ufcontents = NULL;
-		getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), path, &ufcontents, 0, 0); //get file contents
-		if ((int)getsuccess < 0)
-		{
-			return -ENOENT;
-		}
-		putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), newpath, ufcontents, getsuccess); //put file contents in new key
-		if ((int)putsuccess < 0)
-		{
-			return -EIO;
-		}
-		//STEP 6: FIX THE OLD DIRECTORY'S SIZE AND CONTENTS TO REFLECT THE FILE YOU'VE REMOVED
-		s3dirent_t *newpathparent = malloc(sizeof(s3dirent_t) * (numdirents - 1)); //allocate new array for old directory
-		j = 0;
-		int k = 0;
-		for (;j<numdirents;j++) //copy over old directory
-		{
-			if (strcmp(path, pathparent[j].name) != 0); //removes dirent
-			{
-				newpathparent[k] = pathparent[j];
-				k++;
-			}
-		}
-		newpathparent[0].st_size = newpathparent[0].st_size - sizeof(s3dirent_t); //update old parent size
-		putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), direcname, (uint8_t*)pathparent, (sizeof(s3dirent_t) * newnumdirents)); //put the parent dir with removed dirent in s3
-		if ((int)putsuccess <= 0)
-		{
-			return -EIO;
-		}
-		int rmsuccess = s3fs_remove_object((const char*)(ctx->s3bucket), path); //remove the old file
-		if (rmsuccess < 0)
-		{
-			return -EIO;
-		}
-		return 0;
+		attrcache_remove_tree(path);
+		attrcache_remove_tree(newpath);
 	}
-	return -EIO;
+	return 0;
 }
 
 /*
@@ -652,39 +1781,30 @@ int fs_chown(const char *path, uid_t uid, gid_t gid)
 int fs_truncate(const char *path, off_t newsize)
 {
 	fprintf(stderr, "fs_truncate(path=\"%s\", newsize=%d)\n", path, (int)newsize);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	//STEP 1: FIND METADATA IN PARENT AND CHANGE SIZE TO 0
-	char *pathcpy = strdup(path);
-	char *direcname = dirname(pathcpy);
-	uint8_t *upardir = NULL;
-	ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), direcname, &upardir, 0, 0);
-	if ((int)getsuccess <= 0)
+	//STEP 1: FIND THE PARENT DIRECTORY
+	char direcname[PATH_MAX];
+	char name[256];
+	char direckey[S3DIR_KEY_SIZE];
+	if (path_split(path, direcname, name) != 0 || dir_key(direcname, direckey) != 0)
 	{
 		return -ENOENT;
 	}
-	s3dirent_t *pardir = NULL;
-	pardir = (s3dirent_t *)upardir;
-	int numdirents = (int)getsuccess / sizeof(s3dirent_t);
-	int i = 0;
-	for (;i<numdirents;i++)
+	//STEP 2: EMPTYING IT NEEDS NO CONTENTS, AND ONLY SETS ITS SIZE IN ITS DIRENT
+	s3dirent_t dirent;
+	if (newsize == 0)
 	{
-		if(strcmp(pardir[i].name,path) == 0)
-		{
-			pardir[i].st_size = 0;
-		}
+		return node_truncate(direcname, direckey, name, &dirent);
 	}
-	//STEP 2: PUT FIXED PARENT AND 0-LENGTH FILE IN S3
-	ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), direcname, (uint8_t*)pardir, getsuccess); //put parent directory with updated dirent in s3
-	if ((int)putsuccess <= 0)
+	//STEP 3: ANY OTHER SIZE GOES THROUGH A SHORT-LIVED OPEN-FILE STATE
+	if (dir_lookup(direckey, name, &dirent) != 0)
 	{
-		return -EIO;
+		return -ENOENT;
 	}
-	putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), path, NULL, 0); //change file to a zero length NULL
-	if ((int)putsuccess <= 0)
+	if (dirent.type != 'F')
 	{
-		return -EIO;
+		return -EISDIR;
 	}
-	return 0;
+	return file_resize(direcname, direckey, &dirent, newsize);
 }
 
 /*
@@ -710,22 +1830,34 @@ int fs_utime(const char *path, struct utimbuf *ubuf)
 int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
 {
 	fprintf(stderr, "fs_read(path=\"%s\", buf=%p, size=%d, offset=%d)\n", path, buf, (int)size, (int)offset);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	//STEP 1: GET THE FILE
-	//Do we need to get metadata and make sure that readsize is <= size of the file??
-	uint8_t *ubuf = NULL;
-	size_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), path, &ubuf, (ssize_t)offset, (ssize_t)size);
-	if ((int)getsuccess < 0)
+	//STEP 1: FIND THE FILE'S OBJECT, FROM ITS HANDLE IF IT HAS ONE
+	s3file_t *file = fi ? (s3file_t*)(uintptr_t)fi->fh : NULL;
+	char key[S3DIR_KEY_SIZE];
+	s3dirent_t dirent;
+	if (file != NULL)
 	{
-		return -EIO;
+		s3dir_object_key(key, sizeof(key), file->ino);
 	}
-	//STEP 2: COPY THE FILE INTO THE GIVEN BUFFER
-	else if((int)getsuccess == (int)size || (((int)size == 0) && ((int)offset == 0)))//Does the number of bytes written have to be == to the number of bytes requested???
-	{	
-		buf = (char*)ubuf;
-		return getsuccess;
-	}	
-    return -EIO;
+	else if (path_lookup(path, &dirent) == 0 && dirent.type == 'F')
+	{
+		s3dir_object_key(key, sizeof(key), dirent.st_ino);
+	}
+	else
+	{
+		return -ENOENT;
+	}
+	//STEP 2: READ IT, FROM THE HANDLE'S BUFFER OR THROUGH THE BLOCK CACHE (A CHUNKED FILE WITHOUT A HANDLE NEEDS A SHORT-LIVED ONE, FOR ITS MANIFEST)
+	if (file == NULL && dirent.st_chunk != 0)
+	{
+		int rv = file_open(&dirent, &file);
+		if (rv == 0)
+		{
+			rv = file_read(file, key, buf, size, offset);
+			file_close(file);
+		}
+		return rv;
+	}
+	return file_read(file, key, buf, size, offset);
 }
 
 /*
@@ -737,75 +1869,12 @@ int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_
 int fs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
 {
 	fprintf(stderr, "fs_write(path=\"%s\", buf=%p, size=%d, offset=%d)\n", path, buf, (int)size, (int)offset);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	//STEP 1: READ IN THE CONTENTS OF THE FILE TO WRITE TO
-	char *readbuf = NULL;
-	int readsuccess = fs_read(path, readbuf, 0, 0, NULL);
-	if (readsuccess != 0)
-	{
-		return -ENOENT;
-	}
-	int bufsize = strlen(readbuf);
-	if ((int)offset > bufsize)
-	{
-		return -EIO;
-	}
-	//STEP 2: DETERMINE THE SIZE THAT THE NEW FILE WILL BE
-	int newsize = 0;
-	if (bufsize >= ((int)offset + (int)size))
-	{
-		newsize = bufsize;
-	}
-	else
-	{
-		newsize = (int)offset + (int)size;
-	}
-	char *newbuff = malloc(sizeof(char) * (newsize));
-	//STEP 3: COPY THE OLD CONTENTS AND NEW INPUT INTO THE NEW FILE
-	int i = (int)offset;
-	int j = 0;
-	for (; i < newsize; i++)
-	{
-		if ((i >= (int)offset) && (i < (int)size)) //overwrite with new input
-		{
-			newbuff[i] = buf[j];
-			j++;
-		}
-		else //copy from the original file
-		{
-			newbuff[i] = readbuf[i];
-		}
-	}
-	//STEP 4: CHANGE THE SIZE IN METADATA IF NECESSARY
-	if (newsize > bufsize)
+	s3file_t *file = (s3file_t*)(uintptr_t)fi->fh;
+	if (file == NULL)
 	{
-		char *pathcpy = strdup(path);
-		char *direcname = dirname(pathcpy);
-		uint8_t *upardir = NULL;
-		ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), direcname, &upardir, 0, 0);
-		if ((int)getsuccess <= 0)
-		{
-			return -ENOENT;
-		}
-		s3dirent_t *pardir = NULL;
-		pardir = (s3dirent_t *)upardir;
-		int numdirents = (int)getsuccess / sizeof(s3dirent_t);
-		int i = 0;
-		for (; i < numdirents ; i++)
-		{
-			if(strcmp(pardir[i].name, path) == 0)
-			{
-				pardir[i].st_size = newsize;
-			}
-		}
-	}
-	//STEP 5: PUT THE NEW FILE INTO S3 AND ALTER THE METADATA OF THE FILE TO FIT THE NEW SIZE
-	ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), path, (uint8_t*)readbuf, sizeof(readbuf));
-	if ((int)putsuccess < 0)
-	{
-		return -EIO;
+		return -EBADF;
 	}
-    	return -EIO;
+	return file_write(file, buf, size, offset);
 }
 
 
@@ -820,9 +1889,16 @@ int fs_write(const char *path, const char *buf, size_t size, off_t offset, struc
  */
 int fs_flush(const char *path, struct fuse_file_info *fi)
 {
-    fprintf(stderr, "fs_flush(path=\"%s\", fi=%p)\n", path, fi);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    return -EIO;
+	fprintf(stderr, "fs_flush(path=\"%s\", fi=%p)\n", path, fi);
+	s3file_t *file = (s3file_t*)(uintptr_t)fi->fh;
+	if (file == NULL)
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&file->lock);
+	int rv = file_flush(file, path);
+	pthread_mutex_unlock(&file->lock);
+	return rv;
 }
 
 /*
@@ -841,7 +1917,21 @@ int fs_flush(const char *path, struct fuse_file_info *fi)
 int fs_release(const char *path, struct fuse_file_info *fi)
 {
 	fprintf(stderr, "fs_release(path=\"%s\")\n", path);
-	s3context_t *ctx = GET_PRIVATE_DATA;
+	s3file_t *file = (s3file_t*)(uintptr_t)fi->fh;
+	if (file == NULL)
+	{
+		return 0;
+	}
+	//STEP 1: UPLOAD ANY WRITES NOT FLUSHED YET (THERE IS NO ONE LEFT TO REPORT A FAILURE TO)
+	pthread_mutex_lock(&file->lock);
+	if (file_flush(file, path) != 0)
+	{
+		fprintf(stderr, "fs_release(path=\"%s\"): writes lost\n", path);
+	}
+	pthread_mutex_unlock(&file->lock);
+	//STEP 2: RELEASE THE HANDLE'S STATE
+	file_close(file);
+	fi->fh = 0;
 	return 0;
 }
 
@@ -852,7 +1942,7 @@ int fs_release(const char *path, struct fuse_file_info *fi)
 int fs_fsync(const char *path, int datasync, struct fuse_file_info *fi) 
 {
 	fprintf(stderr, "fs_fsync(path=\"%s\")\n", path);
-	return -EIO;
+	return fs_flush(path, fi);
 }
 
 /*
@@ -860,31 +1950,16 @@ int fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
  * function for filling in directory items.
  */
 int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
-{
-	fprintf(stderr, "fs_readdir(path=\"%s\", buf=%p, offset=%d)\n", path, buf, (int)offset);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	//STEP 1: GET THE CONTENTS OF THE DIRECTORY FROM S3
-	uint8_t *udirec = NULL;
-	size_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), path, &udirec, 0, 0);
-	if (getsuccess <= 0)
-	{
-		return -EIO;
-	}
-	s3dirent_t *direc = NULL;
-	direc = (s3dirent_t*)udirec;
-	//STEP 2: ITERATE THROUGH THE DIRECTORY AND USE FILLER TO FILL THE GIVEN BUFFER WITH THE CONTENTS
-	int numdirent = getsuccess / sizeof(s3dirent_t);
-	int i = 0;
-	for (; i < numdirent; i++) 
-	{
-		// call filler function to fill in directory name
-		// to the supplied buffer
-		if (filler(buf, direc[i].name, NULL, 0) != 0) 
-		{
-			return -ENOMEM;
-		}
+{
+	fprintf(stderr, "fs_readdir(path=\"%s\", buf=%p, offset=%lld)\n", path, buf, (long long)offset);
+	//STEP 1: FIND THE DIRECTORY'S OBJECT
+	char direckey[S3DIR_KEY_SIZE];
+	if (dir_key(path, direckey) != 0)
+	{
+		return -ENOENT;
 	}
-	return 0;
+	//STEP 2: LIST IT, A PAGE AT A TIME
+	return dir_list(path, direckey, buf, filler, offset);
 }
 
 /*
@@ -916,6 +1991,12 @@ void *fs_init(struct fuse_conn_info *conn)
 {
 	fprintf(stderr, "fs_init --- initializing file system.\n");
 	s3context_t *ctx = GET_PRIVATE_DATA;
+	dirops_init((const char*)(ctx->s3bucket));
+	//STEP 0: START THE WORKERS THAT MOVE SHARDS AND CHUNKS; HERE RATHER THAN IN main, SINCE THEY WOULDN'T SURVIVE FUSE FORKING INTO THE BACKGROUND
+	if (workpool_init(WORKPOOL_DEFAULT_THREADS) != 0)
+	{
+		fprintf(stderr, "fs_init: no worker threads, so shards and chunks are moved one at a time\n");
+	}
 	//STEP 1: CLEAR THE BUCKET
 	s3fs_clear_bucket((const char*)(ctx->s3bucket));
 	//STEP 2: CREATE A ROOT DIRECTORY AND FILL IT WITH IT'S SELF DIREC
@@ -931,9 +2012,13 @@ void *fs_init(struct fuse_conn_info *conn)
 	rself.st_gid = group;
 	rself.st_mode = mode;
 	rself.st_size = sizeof(s3dirent_t);
+	rself.st_ino = S3DIR_ROOT_INO;
 	root[0] = rself;
-	//STEP 3: PUT THE ROOT DIRECTORY INTO S3
-	s3fs_put_object((const char*)(ctx->s3bucket), "/", (uint8_t*)root, sizeof(s3dirent_t)); 
+	//STEP 3: PUT THE ROOT DIRECTORY INTO S3, UNDER THE ROOT'S INODE NUMBER
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), S3DIR_ROOT_INO);
+	dir_store(key, root, 1);
+	free(root);
 	return ctx;
 }
 
@@ -946,6 +2031,32 @@ void fs_destroy(void *userdata)
 	fprintf(stderr, "fs_destroy --- shutting down file system.\n");
 	s3context_t *ctx = GET_PRIVATE_DATA;
 	s3fs_clear_bucket((const char*)(ctx->s3bucket));
+	dircache_stats_t stats;
+	dircache_get_stats(&stats);
+	fprintf(stderr, "directory cache: %llu hits, %llu misses, %llu stale (%llu revalidated), %llu evictions\n",
+		(unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.stale,
+		(unsigned long long)stats.revalidations, (unsigned long long)stats.evictions);
+	dircache_destroy();
+	blockcache_stats_t bstats;
+	blockcache_get_stats(&bstats);
+	fprintf(stderr, "block cache: %llu hits, %llu misses, %llu prefetched, %llu evictions\n",
+		(unsigned long long)bstats.hits, (unsigned long long)bstats.misses,
+		(unsigned long long)bstats.prefetched, (unsigned long long)bstats.evictions);
+	blockcache_destroy();
+	diskcache_stats_t dstats;
+	diskcache_get_stats(&dstats);
+	fprintf(stderr, "disk cache: %llu hits, %llu misses, %llu writes, %llu evictions, %llu recovered\n",
+		(unsigned long long)dstats.hits, (unsigned long long)dstats.misses, (unsigned long long)dstats.writes,
+		(unsigned long long)dstats.evictions, (unsigned long long)dstats.recovered);
+	diskcache_destroy();
+	attrcache_stats_t astats;
+	attrcache_get_stats(&astats);
+	fprintf(stderr, "attribute cache: %llu hits, %llu negative hits, %llu misses, %llu evictions\n",
+		(unsigned long long)astats.hits, (unsigned long long)astats.negative, (unsigned long long)astats.misses,
+		(unsigned long long)astats.evictions);
+	attrcache_destroy();
+	workpool_destroy();
+	s3fs_deinitialize();
     	free(userdata);
 }
 
@@ -968,38 +2079,14 @@ int fs_access(const char *path, int mask)
 int fs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi) 
 {
 	fprintf(stderr, "fs_ftruncate(path=\"%s\", offset=%d)\n", path, (int)offset);
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	//STEP 1: FIND METADATA IN PARENT AND CHANGE SIZE TO 0
-	char *pathcpy = strdup(path);
-	char *direcname = dirname(pathcpy);
-	uint8_t *upardir = NULL;
-	ssize_t getsuccess = s3fs_get_object((const char*)(ctx->s3bucket), direcname, &upardir, 0, 0);
-	if ((int)getsuccess <= 0)
-	{
-		return -ENOENT;
-	}
-	s3dirent_t *pardir = (s3dirent_t *)upardir;
-	int numdirents = (int)getsuccess / sizeof(s3dirent_t);
-	int i = 0;
-	for (;i<numdirents;i++)
-	{
-		if(strcmp(pardir[i].name,path) == 0)
-		{
-			pardir[i].st_size = 0;
-		}
-	}
-	//STEP 2: PUT FIXED PARENT AND 0-LENGTH FILE IN S3
-	ssize_t putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), direcname, (uint8_t*)pardir, getsuccess); //put parent directory with updated dirent in s3
-	if ((int)putsuccess <= 0)
-	{
-		return -EIO;
-	}
-	putsuccess = s3fs_put_object((const char*)(ctx->s3bucket), path, NULL, 0); //change file to a zero length NULL
-	if ((int)putsuccess <= 0)
+	//STEP 0: AN OPEN FILE IS JUST RESIZED IN ITS BUFFER, AND UPLOADED WITH ITS OTHER WRITES
+	s3file_t *file = fi ? (s3file_t*)(uintptr_t)fi->fh : NULL;
+	if (file != NULL)
 	{
-		return -EIO;
+		return file_truncate(file, offset);
 	}
-	return 0;
+	//STEP 1: OTHERWISE IT IS THE SAME AS TRUNCATING IT BY PATH
+	return fs_truncate(path, offset);
 }
 
 /*
@@ -1040,12 +2127,599 @@ struct fuse_operations s3fs_ops = {
   .init        = fs_init,       // initialize filesystem
   .destroy     = fs_destroy,    // cleanup/destroy filesystem
   .access      = fs_access,     // check access permissions for a file
-  .create      = NULL,          // not implemented
+  .create      = fs_create,     // create and open a file
   .ftruncate   = fs_ftruncate,  // truncate the file
   .fgetattr    = NULL           // not implemented
 };
 
 
+/*
+ * The low-level backend.  With S3FS_LOWLEVEL set in the environment, s3fs
+ * runs on FUSE's low-level API instead of the one above (see ll_main).
+ * There the kernel resolves paths itself, one lookup of a name in a
+ * directory at a time, and names files and directories by node ID.  Each
+ * node ID is the inode number of what it names, so a directory's object
+ * key comes straight from its node ID, and a file's dirent is found
+ * through the inode table (inodetab.h).  The kernel caches each answer,
+ * and the attributes that come with it, for the attribute cache's TTL (a
+ * missing name for the negative TTL), so a path that has been used once
+ * costs nothing to resolve again until then: no copying or splitting of
+ * paths, and no lookups.
+ */
+
+#if FUSE_ROOT_ID != S3DIR_ROOT_INO
+#error "the root's node ID must be its inode number"
+#endif
+
+static double attrTimeoutG = ATTRCACHE_DEFAULT_TTL;             // seconds
+static double negativeTimeoutG = ATTRCACHE_DEFAULT_NEGATIVE_TTL; // seconds
+
+/*
+ * Fill *e with what the kernel is told of the entry dirent, in the
+ * directory with node ID parent, and count the kernel's new reference to
+ * it.  Returns 0, or an error from node_stat.
+ */
+static int ll_entry(fuse_ino_t parent, const s3dirent_t *dirent, struct fuse_entry_param *e)
+{
+	memset(e, 0, sizeof(struct fuse_entry_param));
+	int rv = node_stat(dirent, &e->attr);
+	if (rv != 0)
+	{
+		return rv;
+	}
+	e->ino = dirent->st_ino;
+	e->attr_timeout = attrTimeoutG;
+	e->entry_timeout = attrTimeoutG;
+	inodetab_node_t node;
+	node.ino = dirent->st_ino;
+	node.parent = parent;
+	node.dirent = *dirent;
+	inodetab_lookup(&node);
+	return 0;
+}
+
+/*
+ * Copy the dirent holding the attributes of node ino to *dirent: a
+ * directory's own "." dirent, or a file's dirent in its parent (and, if
+ * node isn't NULL, set *node to the file's node).  Returns 0 on success
+ * and -ENOENT if it is gone.
+ */
+static int ll_dirent(fuse_ino_t ino, s3dirent_t *dirent, inodetab_node_t *node)
+{
+	char key[S3DIR_KEY_SIZE];
+	inodetab_node_t current;
+	int known = inodetab_get(ino, &current) == 0;
+	if (ino == FUSE_ROOT_ID || (known && current.dirent.type == 'D'))
+	{
+		s3dir_object_key(key, sizeof(key), ino);
+		return dir_lookup(key, ".", dirent) == 0 ? 0 : -ENOENT;
+	}
+	if (!known)
+	{
+		return -ENOENT;
+	}
+	s3dir_object_key(key, sizeof(key), current.parent);
+	if (dir_lookup(key, current.dirent.name, dirent) != 0 || dirent->st_ino != ino)//unlinked, or replaced by another client
+	{
+		return -ENOENT;
+	}
+	current.dirent = *dirent;
+	inodetab_update(&current);
+	if (node != NULL)
+	{
+		*node = current;
+	}
+	return 0;
+}
+
+static void ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	fs_init(conn);
+}
+
+static void ll_destroy(void *userdata)
+{
+	inodetab_stats_t stats;
+	inodetab_get_stats(&stats);
+	fprintf(stderr, "inode table: %llu lookups, %llu forgets, %llu misses, %d nodes left\n",
+		(unsigned long long)stats.lookups, (unsigned long long)stats.forgets, (unsigned long long)stats.misses,
+		stats.entries);
+	inodetab_destroy();
+	fs_destroy(userdata);
+}
+
+/*
+ * Look up the entry called name in directory parent.
+ */
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	fprintf(stderr, "ll_lookup(parent=%llu, name=\"%s\")\n", (unsigned long long)parent, name);
+	if (strlen(name) > 255)
+	{
+		fuse_reply_err(req, ENAMETOOLONG);
+		return;
+	}
+	char direckey[S3DIR_KEY_SIZE];
+	s3dir_object_key(direckey, sizeof(direckey), parent);
+	s3dirent_t dirent;
+	struct fuse_entry_param e;
+	if (dir_lookup(direckey, name, &dirent) != 0)
+	{
+		//THE KERNEL CACHES A MISSING NAME TOO, GIVEN AN ENTRY WITH NO NODE
+		memset(&e, 0, sizeof(e));
+		e.entry_timeout = negativeTimeoutG;
+		if (negativeTimeoutG > 0)
+		{
+			fuse_reply_entry(req, &e);
+		}
+		else
+		{
+			fuse_reply_err(req, ENOENT);
+		}
+		return;
+	}
+	int rv = ll_entry(parent, &dirent, &e);
+	if (rv != 0)
+	{
+		fuse_reply_err(req, -rv);
+		return;
+	}
+	fuse_reply_entry(req, &e);
+}
+
+/*
+ * Drop nlookup of the kernel's references to node ino.
+ */
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	inodetab_forget(ino, nlookup);
+	fuse_reply_none(req);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	fprintf(stderr, "ll_getattr(ino=%llu)\n", (unsigned long long)ino);
+	s3dirent_t dirent;
+	struct stat st;
+	int rv = ll_dirent(ino, &dirent, NULL);
+	if (rv == 0)
+	{
+		rv = node_stat(&dirent, &st);
+	}
+	if (rv != 0)
+	{
+		fuse_reply_err(req, -rv);
+		return;
+	}
+	fuse_reply_attr(req, &st, attrTimeoutG);
+}
+
+/*
+ * Resize file ino, which has no handle to do it through, to size bytes.
+ */
+static int ll_truncate(fuse_ino_t ino, off_t size)
+{
+	//STEP 1: FIND THE FILE'S DIRENT, AND THE DIRECTORY IT IS IN
+	s3dirent_t dirent;
+	inodetab_node_t node;
+	int rv = ll_dirent(ino, &dirent, &node);
+	if (rv != 0)
+	{
+		return rv;
+	}
+	if (dirent.type != 'F')
+	{
+		return -EISDIR;
+	}
+	char direckey[S3DIR_KEY_SIZE];
+	s3dir_object_key(direckey, sizeof(direckey), node.parent);
+	//STEP 2: EMPTYING IT NEEDS NO CONTENTS; ANY OTHER SIZE GOES THROUGH A SHORT-LIVED OPEN-FILE STATE
+	if (size == 0)
+	{
+		return node_truncate(NULL, direckey, dirent.name, &dirent);
+	}
+	return file_resize(NULL, direckey, &dirent, size);
+}
+
+/*
+ * Change the attributes of node ino.  Only its size can be changed: the
+ * mode and owner can't (as in fs_chmod and fs_chown), and times aren't
+ * kept, so setting them does nothing.
+ */
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
+{
+	fprintf(stderr, "ll_setattr(ino=%llu, to_set=0x%x)\n", (unsigned long long)ino, to_set);
+	int rv = 0;
+	if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))
+	{
+		rv = -EIO;
+	}
+	//AN OPEN FILE IS JUST RESIZED IN ITS BUFFER, AND UPLOADED WITH ITS OTHER WRITES
+	s3file_t *file = fi ? (s3file_t*)(uintptr_t)fi->fh : NULL;
+	if (rv == 0 && (to_set & FUSE_SET_ATTR_SIZE))
+	{
+		rv = file != NULL ? file_truncate(file, attr->st_size) : ll_truncate(ino, attr->st_size);
+	}
+	s3dirent_t dirent;
+	struct stat st;
+	if (rv == 0)
+	{
+		rv = ll_dirent(ino, &dirent, NULL);
+	}
+	if (rv == 0)
+	{
+		rv = node_stat(&dirent, &st);
+	}
+	if (rv != 0)
+	{
+		fuse_reply_err(req, -rv);
+		return;
+	}
+	if (file != NULL)//its dirent doesn't have the new size until the file is flushed
+	{
+		pthread_mutex_lock(&file->lock);
+		st.st_size = file->size;
+		pthread_mutex_unlock(&file->lock);
+	}
+	fuse_reply_attr(req, &st, attrTimeoutG);
+}
+
+static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
+{
+	fprintf(stderr, "ll_mknod(parent=%llu, name=\"%s\", mode=0%3o)\n", (unsigned long long)parent, name, mode);
+	if (strlen(name) > 255)
+	{
+		fuse_reply_err(req, ENAMETOOLONG);
+		return;
+	}
+	char direckey[S3DIR_KEY_SIZE];
+	s3dir_object_key(direckey, sizeof(direckey), parent);
+	s3dirent_t dirent;
+	struct fuse_entry_param e;
+	int rv = node_mknod(NULL, direckey, name, mode, &dirent);
+	if (rv == 0)
+	{
+		rv = ll_entry(parent, &dirent, &e);
+	}
+	if (rv != 0)
+	{
+		fuse_reply_err(req, -rv);
+		return;
+	}
+	fuse_reply_entry(req, &e);
+}
+
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+	fprintf(stderr, "ll_mkdir(parent=%llu, name=\"%s\", mode=0%3o)\n", (unsigned long long)parent, name, mode);
+	if (strlen(name) > 255)
+	{
+		fuse_reply_err(req, ENAMETOOLONG);
+		return;
+	}
+	char direckey[S3DIR_KEY_SIZE];
+	s3dir_object_key(direckey, sizeof(direckey), parent);
+	s3dirent_t dirent;
+	struct fuse_entry_param e;
+	int rv = node_mkdir(NULL, direckey, name, mode | S_IFDIR, &dirent);
+	if (rv == 0)
+	{
+		rv = ll_entry(parent, &dirent, &e);
+	}
+	if (rv != 0)
+	{
+		fuse_reply_err(req, -rv);
+		return;
+	}
+	fuse_reply_entry(req, &e);
+}
+
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	fprintf(stderr, "ll_unlink(parent=%llu, name=\"%s\")\n", (unsigned long long)parent, name);
+	char direckey[S3DIR_KEY_SIZE];
+	s3dir_object_key(direckey, sizeof(direckey), parent);
+	fuse_reply_err(req, -node_unlink(NULL, direckey, name));
+}
+
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	fprintf(stderr, "ll_rmdir(parent=%llu, name=\"%s\")\n", (unsigned long long)parent, name);
+	char direckey[S3DIR_KEY_SIZE];
+	s3dir_object_key(direckey, sizeof(direckey), parent);
+	fuse_reply_err(req, -node_rmdir(NULL, direckey, name));
+}
+
+/*
+ * Rename the entry called name in directory parent.  The kernel has
+ * already refused to move a directory into itself.
+ */
+static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname)
+{
+	fprintf(stderr, "ll_rename(parent=%llu, name=\"%s\", newparent=%llu, newname=\"%s\")\n",
+		(unsigned long long)parent, name, (unsigned long long)newparent, newname);
+	if (strlen(newname) > 255)
+	{
+		fuse_reply_err(req, ENAMETOOLONG);
+		return;
+	}
+	char direckey[S3DIR_KEY_SIZE];
+	char newdireckey[S3DIR_KEY_SIZE];
+	s3dir_object_key(direckey, sizeof(direckey), parent);
+	s3dir_object_key(newdireckey, sizeof(newdireckey), newparent);
+	s3dirent_t dirent;
+	int rv = node_rename(NULL, direckey, name, NULL, newdireckey, newname, &dirent);
+	if (rv == 0)//the node keeps its ID, but its dirent has moved
+	{
+		inodetab_node_t node;
+		node.ino = dirent.st_ino;
+		node.parent = newparent;
+		node.dirent = dirent;
+		inodetab_update(&node);
+	}
+	fuse_reply_err(req, -rv);
+}
+
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	fprintf(stderr, "ll_open(ino=%llu)\n", (unsigned long long)ino);
+	s3dirent_t dirent;
+	s3file_t *file = NULL;
+	int rv = ll_dirent(ino, &dirent, NULL);
+	if (rv == 0 && dirent.type != 'F')
+	{
+		rv = -EISDIR;
+	}
+	if (rv == 0)
+	{
+		rv = file_open(&dirent, &file);
+	}
+	if (rv != 0)
+	{
+		fuse_reply_err(req, -rv);
+		return;
+	}
+	fi->fh = (uint64_t)(uintptr_t)file;
+	fuse_reply_open(req, fi);
+}
+
+static void ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+{
+	fprintf(stderr, "ll_create(parent=%llu, name=\"%s\", mode=0%3o)\n", (unsigned long long)parent, name, mode);
+	if (strlen(name) > 255)
+	{
+		fuse_reply_err(req, ENAMETOOLONG);
+		return;
+	}
+	//STEP 1: CREATE THE FILE
+	char direckey[S3DIR_KEY_SIZE];
+	s3dir_object_key(direckey, sizeof(direckey), parent);
+	s3dirent_t dirent;
+	struct fuse_entry_param e;
+	int rv = node_mknod(NULL, direckey, name, mode, &dirent);
+	//STEP 2: OPEN IT; IT IS EMPTY, SO THERE IS NOTHING TO CHECK OR LOAD
+	s3file_t *file = NULL;
+	if (rv == 0)
+	{
+		file = file_new(dirent.st_ino, 0, dirent.st_chunk);
+		rv = file == NULL ? -ENOMEM : 0;
+	}
+	if (rv == 0)
+	{
+		file = file_share(file);
+		rv = ll_entry(parent, &dirent, &e);
+	}
+	if (rv != 0)
+	{
+		if (file != NULL)
+		{
+			file_close(file);
+		}
+		fuse_reply_err(req, -rv);
+		return;
+	}
+	fi->fh = (uint64_t)(uintptr_t)file;
+	fuse_reply_create(req, &e, fi);
+}
+
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	fprintf(stderr, "ll_read(ino=%llu, size=%d, offset=%d)\n", (unsigned long long)ino, (int)size, (int)off);
+	char key[S3DIR_KEY_SIZE];
+	s3dir_object_key(key, sizeof(key), ino);
+	char *buf = malloc(size ? size : 1);
+	if (buf == NULL)
+	{
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	int rv = file_read((s3file_t*)(uintptr_t)fi->fh, key, buf, size, off);
+	if (rv < 0)
+	{
+		fuse_reply_err(req, -rv);
+	}
+	else
+	{
+		fuse_reply_buf(req, buf, rv);
+	}
+	free(buf);
+}
+
+static void ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	fprintf(stderr, "ll_write(ino=%llu, size=%d, offset=%d)\n", (unsigned long long)ino, (int)size, (int)off);
+	int rv = file_write((s3file_t*)(uintptr_t)fi->fh, buf, size, off);
+	if (rv < 0)
+	{
+		fuse_reply_err(req, -rv);
+		return;
+	}
+	fuse_reply_write(req, rv);
+}
+
+/*
+ * file_store, for open file ino; with file's lock held.
+ */
+static int ll_store(fuse_ino_t ino, s3file_t *file)
+{
+	if (!file->dirty)
+	{
+		return 0;
+	}
+	inodetab_node_t node;
+	if (inodetab_get(ino, &node) != 0)
+	{
+		return -EIO;
+	}
+	char direckey[S3DIR_KEY_SIZE];
+	s3dir_object_key(direckey, sizeof(direckey), node.parent);
+	return file_store(file, NULL, direckey, node.dirent.name);
+}
+
+static void ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	fprintf(stderr, "ll_flush(ino=%llu)\n", (unsigned long long)ino);
+	s3file_t *file = (s3file_t*)(uintptr_t)fi->fh;
+	int rv = 0;
+	if (file != NULL)
+	{
+		pthread_mutex_lock(&file->lock);
+		rv = ll_store(ino, file);
+		pthread_mutex_unlock(&file->lock);
+	}
+	fuse_reply_err(req, -rv);
+}
+
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+	ll_flush(req, ino, fi);
+}
+
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	fprintf(stderr, "ll_release(ino=%llu)\n", (unsigned long long)ino);
+	s3file_t *file = (s3file_t*)(uintptr_t)fi->fh;
+	if (file != NULL)
+	{
+		//STEP 1: UPLOAD ANY WRITES NOT FLUSHED YET (THERE IS NO ONE LEFT TO REPORT A FAILURE TO)
+		pthread_mutex_lock(&file->lock);
+		if (ll_store(ino, file) != 0)
+		{
+			fprintf(stderr, "ll_release(ino=%llu): writes lost\n", (unsigned long long)ino);
+		}
+		pthread_mutex_unlock(&file->lock);
+		//STEP 2: RELEASE THE HANDLE'S STATE
+		file_close(file);
+		fi->fh = 0;
+	}
+	fuse_reply_err(req, 0);
+}
+
+// the kernel's buffer for one ll_readdir reply, as dir_list's filler sees it
+typedef struct {
+	fuse_req_t req;
+	char *buf;
+	size_t size;
+	size_t used;
+} ll_dirbuf_t;
+
+static int ll_fill(void *buf, const char *name, const struct stat *st, off_t off)
+{
+	ll_dirbuf_t *dirbuf = buf;
+	size_t len = fuse_add_direntry(dirbuf->req, dirbuf->buf + dirbuf->used, dirbuf->size - dirbuf->used, name, st, off);
+	if (len > dirbuf->size - dirbuf->used)//the buffer is full
+	{
+		return 1;
+	}
+	dirbuf->used += len;
+	return 0;
+}
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	fprintf(stderr, "ll_readdir(ino=%llu, offset=%lld)\n", (unsigned long long)ino, (long long)off);
+	char direckey[S3DIR_KEY_SIZE];
+	s3dir_object_key(direckey, sizeof(direckey), ino);
+	ll_dirbuf_t dirbuf = { req, malloc(size ? size : 1), size, 0 };
+	if (dirbuf.buf == NULL)
+	{
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	int rv = dir_list(NULL, direckey, &dirbuf, ll_fill, off);
+	if (rv != 0)
+	{
+		fuse_reply_err(req, -rv);
+	}
+	else
+	{
+		fuse_reply_buf(req, dirbuf.buf, dirbuf.used);
+	}
+	free(dirbuf.buf);
+}
+
+struct fuse_lowlevel_ops s3fs_ll_ops = {
+  .init        = ll_init,       // initialize filesystem
+  .destroy     = ll_destroy,    // cleanup/destroy filesystem
+  .lookup      = ll_lookup,     // look up a name in a directory
+  .forget      = ll_forget,     // drop the kernel's references to a node
+  .getattr     = ll_getattr,    // get file attributes
+  .setattr     = ll_setattr,    // truncate a file's size
+  .mknod       = ll_mknod,      // create a file
+  .mkdir       = ll_mkdir,      // create a directory
+  .unlink      = ll_unlink,     // remove/unlink a file
+  .rmdir       = ll_rmdir,      // remove a directory
+  .rename      = ll_rename,     // rename a file or directory
+  .open        = ll_open,       // open a file
+  .read        = ll_read,       // read contents from an open file
+  .write       = ll_write,      // write contents to an open file
+  .flush       = ll_flush,      // flush file to stable storage
+  .release     = ll_release,    // release/close file
+  .fsync       = ll_fsync,      // sync file to disk
+  .readdir     = ll_readdir,    // read directory entry
+  .create      = ll_create,     // create and open a file
+};
+
+/*
+ * Mount and serve the filesystem on the low-level API, as fuse_main does
+ * on the high-level one, with ctx as its context.
+ */
+static int ll_main(int argc, char *argv[], s3context_t *ctx)
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	char *mountpoint = NULL;
+	int multithreaded = 0;
+	int foreground = 0;
+	int rv = -1;
+	if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) == -1)
+	{
+		return 1;
+	}
+	contextG = ctx;
+	struct fuse_chan *chan = fuse_mount(mountpoint, &args);
+	if (chan != NULL)
+	{
+		struct fuse_session *session = fuse_lowlevel_new(&args, &s3fs_ll_ops, sizeof(s3fs_ll_ops), ctx);
+		if (session != NULL)
+		{
+			if (fuse_set_signal_handlers(session) != -1)
+			{
+				fuse_session_add_chan(session, chan);
+				fuse_daemonize(foreground);
+				rv = multithreaded ? fuse_session_loop_mt(session) : fuse_session_loop(session);
+				fuse_remove_signal_handlers(session);
+				fuse_session_remove_chan(chan);
+			}
+			fuse_session_destroy(session);
+		}
+		fuse_unmount(mountpoint, chan);
+	}
+	free(mountpoint);
+	fuse_opt_free_args(&args);
+	return rv == 0 ? 0 : 1;
+}
+
+
 
 /* 
  * You shouldn't need to change anything here.  If you need to
@@ -1078,11 +2752,83 @@ int main(int argc, char *argv[]) {
 
     fprintf(stderr, "Initializing s3 credentials\n");
     s3fs_init_credentials(s3key, s3secret);
+    if (s3fs_initialize(S3FS_DEFAULT_MAX_REQUESTS) < 0) {
+        fprintf(stderr, "Failed to initialize libs3\n");
+        return -1;
+    }
+
+    // the directory cache can be tuned (or, with a size of 0, disabled)
+    // from the environment
+    int dircachettl = DIRCACHE_DEFAULT_TTL;
+    size_t dircachesize = DIRCACHE_DEFAULT_MAX_BYTES;
+    if (getenv(S3FS_DIRCACHE_TTL)) {
+        dircachettl = atoi(getenv(S3FS_DIRCACHE_TTL));
+    }
+    if (getenv(S3FS_DIRCACHE_SIZE)) {
+        dircachesize = strtoull(getenv(S3FS_DIRCACHE_SIZE), NULL, 10);
+    }
+    dircache_init(dircachettl, dircachesize);
+
+    // and so can the attribute cache
+    int attrcachettl = ATTRCACHE_DEFAULT_TTL;
+    int negativettl = ATTRCACHE_DEFAULT_NEGATIVE_TTL;
+    size_t attrcachesize = ATTRCACHE_DEFAULT_MAX_ENTRIES;
+    if (getenv(S3FS_ATTRCACHE_TTL)) {
+        attrcachettl = atoi(getenv(S3FS_ATTRCACHE_TTL));
+    }
+    if (getenv(S3FS_NEGATIVE_TTL)) {
+        negativettl = atoi(getenv(S3FS_NEGATIVE_TTL));
+    }
+    if (getenv(S3FS_ATTRCACHE_SIZE)) {
+        attrcachesize = strtoull(getenv(S3FS_ATTRCACHE_SIZE), NULL, 10);
+    }
+    attrcache_init(attrcachettl, negativettl, attrcachesize);
+    attrTimeoutG = attrcachettl;    // the kernel's caches, on the low-level API
+    negativeTimeoutG = negativettl;
+
+    // new files are stored in chunks only if given a chunk size
+    if (getenv(S3FS_CHUNK_SIZE)) {
+        chunkSizeG = strtoul(getenv(S3FS_CHUNK_SIZE), NULL, 10);
+    }
+
+    // and so can the block cache, and how far it reads ahead
+    size_t blockcachesize = BLOCKCACHE_DEFAULT_MAX_BYTES;
+    size_t blocksize = BLOCKCACHE_DEFAULT_BLOCK_SIZE;
+    size_t readahead = BLOCKCACHE_DEFAULT_READAHEAD;
+    if (getenv(S3FS_BLOCKCACHE_SIZE)) {
+        blockcachesize = strtoull(getenv(S3FS_BLOCKCACHE_SIZE), NULL, 10);
+    }
+    if (getenv(S3FS_BLOCKCACHE_BLOCK)) {
+        blocksize = strtoull(getenv(S3FS_BLOCKCACHE_BLOCK), NULL, 10);
+    }
+    if (getenv(S3FS_READAHEAD)) {
+        readahead = strtoull(getenv(S3FS_READAHEAD), NULL, 10);
+    }
+    blockcache_init(blocksize, blockcachesize, readahead);
+
+    // the persistent disk cache is only used if given a directory
+    if (getenv(S3FS_DISKCACHE_DIR)) {
+        uint64_t diskcachesize = DISKCACHE_DEFAULT_MAX_BYTES;
+        if (getenv(S3FS_DISKCACHE_SIZE)) {
+            diskcachesize = strtoull(getenv(S3FS_DISKCACHE_SIZE), NULL, 10);
+        }
+        if (diskcache_init(getenv(S3FS_DISKCACHE_DIR), diskcachesize) < 0) {
+            fprintf(stderr, "Failed to open disk cache %s\n", getenv(S3FS_DISKCACHE_DIR));
+        }
+    }
 
     fprintf(stderr, "Totally clearing s3 bucket\n");
     s3fs_clear_bucket(s3bucket);
 
+    // unless given -s, FUSE serves requests on many threads at once; the
+    // directory locks (dirlock.h) keep changes to a directory atomic
     fprintf(stderr, "Starting up FUSE file system.\n");
+    // S3FS_LOWLEVEL selects the low-level backend (see ll_main)
+    if (getenv(S3FS_LOWLEVEL)) {
+        int ll_stat = ll_main(argc, argv, stateinfo);
+        fprintf(stderr, "Startup function (ll_main) returned %d\n", ll_stat);
+        return ll_stat;
+    }
     int fuse_stat = fuse_main(argc, argv, &s3fs_ops, stateinfo);
     fprintf(stderr, "Startup function (fuse_main) returned %d\n", fuse_stat);
     
@@ -1,9 +1,13 @@
 #ifndef __USERSPACEFS_H__
 #define __USERSPACEFS_H__
 
+#include <pthread.h>
 #include <sys/stat.h>
 #include <stdint.h>   // for uint32_t, etc.
 #include <sys/time.h> // for struct timeval
+#include "blockcache.h"
+#include "s3chunk.h"
+#include "libs3_wrapper.h" // for S3FS_ETAG_SIZE
 
 
 
@@ -16,6 +20,18 @@
 #define S3ACCESSKEY "S3_ACCESS_KEY_ID"
 #define S3SECRETKEY "S3_SECRET_ACCESS_KEY"
 #define S3BUCKET "S3_BUCKET"
+#define S3FS_DIRCACHE_TTL "S3FS_DIRCACHE_TTL"   // seconds
+#define S3FS_DIRCACHE_SIZE "S3FS_DIRCACHE_SIZE" // bytes
+#define S3FS_ATTRCACHE_TTL "S3FS_ATTRCACHE_TTL"   // seconds
+#define S3FS_ATTRCACHE_SIZE "S3FS_ATTRCACHE_SIZE" // paths
+#define S3FS_NEGATIVE_TTL "S3FS_NEGATIVE_TTL"     // seconds
+#define S3FS_BLOCKCACHE_SIZE "S3FS_BLOCKCACHE_SIZE"   // bytes
+#define S3FS_BLOCKCACHE_BLOCK "S3FS_BLOCKCACHE_BLOCK" // bytes
+#define S3FS_READAHEAD "S3FS_READAHEAD"               // bytes
+#define S3FS_DISKCACHE_DIR "S3FS_DISKCACHE_DIR"
+#define S3FS_DISKCACHE_SIZE "S3FS_DISKCACHE_SIZE"     // bytes
+#define S3FS_LOWLEVEL "S3FS_LOWLEVEL"                 // any value
+#define S3FS_CHUNK_SIZE "S3FS_CHUNK_SIZE"             // bytes
 
 #define BUFFERSIZE 1024
 
@@ -31,13 +47,41 @@ typedef struct {
 
 typedef struct {
 unsigned char type; // file, directory, or unused
-char name[256]; // reasonable upper-bound on a name
+char name[256]; // the entry's name within its directory (not its path)
 // metadata items would go here, too
 mode_t    st_mode;		//Mode (Permissions)
 uid_t     st_uid;		//User
 gid_t     st_gid; 		//Group
 off_t     st_size; 		//Size
+uint64_t  st_ino;		//Inode number, naming the object holding the contents
+uint32_t  st_chunk;		//Chunk size, if the file is stored in chunks (see s3chunk.h), or 0
 } s3dirent_t;
 
+// state of an open file, kept in its fuse_file_info's fh.  Writes go to
+// data (or, for a chunked file, to the chunks they touch), and are only
+// uploaded when the file is flushed or released.  All the handles of a
+// chunked file share one state; a file stored whole has one per handle.
+typedef struct s3file {
+pthread_mutex_t lock;
+uint64_t ino;		// the file's inode number, naming its object on s3
+char *data;		// the file's contents, if loaded
+size_t size;		// length of the file
+size_t capacity;	// bytes allocated at data
+int loaded;		// data holds the whole file
+int dirty;		// data has changes not yet stored in s3
+blockcache_stream_t stream;	// for read-ahead, while not loaded
+char etag[S3FS_ETAG_SIZE];	// the file's ETag on s3, or "" if unknown
+uint32_t chunk;		// the file's chunk size, or 0 if it is stored whole
+s3chunk_manifest_t manifest;	// a chunked file's size and chunks (their ids as last stored)
+char **chunks;		// its chunks being changed, by number, or NULL for the rest
+uint64_t *dropped;	// ids of chunks cut off by truncation, removed once stored
+size_t ndropped;	// and their number
+uint64_t *stale;	// ids of chunks no stored manifest names, kept while reads may be using them
+size_t nstale;		// and their number
+int reading;		// chunk reads in flight with the lock dropped
+int refs;		// handles sharing this state
+struct s3file *next;	// the next chunked file open
+} s3file_t;
+
 
 #endif // __USERSPACEFS_H__
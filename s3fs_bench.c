@@ -0,0 +1,575 @@
+/*
+ * Benchmarks for the libs3 wrapper functions used by the s3fs project.
+ *
+ * By default the benchmarks run against the in-process mock S3 endpoint
+ * in mock_s3.c, which adds a fixed latency to every response to stand in
+ * for the network.  Set S3_HOSTNAME (and the usual S3_ACCESS_KEY_ID,
+ * S3_SECRET_ACCESS_KEY and S3_BUCKET) to run against a real endpoint
+ * instead.
+ *
+ * usage: s3fs_bench [-t max_threads] [-s seconds] [-l latency_us]
+ *                   [-c concurrency] <bench>
+ *
+ *  threads    small-object GETs/sec with 1, 2, 4, ... max_threads threads
+ *  get        single-stream GET throughput against object size
+ *  multipart  upload throughput against part count, with up to
+ *             concurrency parts in flight
+ *  lookup     directory lookup latency against directory size, for a
+ *             linear scan, the hash index and the directory cache
+ *  stream     sequential read throughput in FUSE-sized reads, straight
+ *             from s3 and through the block cache with read-ahead
+ *  create     file creates/sec with 1, 2, 4, ... max_threads threads, each
+ *             in a directory of its own and all in the same directory
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "blockcache.h"
+#include "dircache.h"
+#include "dirops.h"
+#include "libs3_wrapper.h"
+#include "mock_s3.h"
+#include "s3dir.h"
+#include "s3fs.h" // for environment strings to look for
+#include "workpool.h"
+
+static const char *bucketG = "bench";
+static int maxThreadsG = 16;
+static int secondsG = 3;
+static int latencyG = 2000;
+static int concurrencyG = S3FS_DEFAULT_MULTIPART_CONCURRENCY;
+static int mockG = 1;
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Create an object of the given size, on the mock or the real endpoint.
+static int make_object(const char *key, size_t size)
+{
+    if (mockG) {
+        mock_s3_set_object(key, size);
+        return 0;
+    }
+    uint8_t *buf = calloc(1, size ? size : 1);
+    ssize_t rv = s3fs_put_object(bucketG, key, buf, size);
+    free(buf);
+    return rv < 0 ? -1 : 0;
+}
+
+// threads -------------------------------------------------------------------
+
+#define SMALL_OBJECT_KEY "bench-small"
+#define SMALL_OBJECT_SIZE 1024
+
+struct thread_arg {
+    double deadline;
+    long ops;
+    long errors;
+};
+
+static void *get_loop(void *arg)
+{
+    struct thread_arg *targ = arg;
+    while (now() < targ->deadline) {
+        uint8_t *buf = NULL;
+        if (s3fs_get_object(bucketG, SMALL_OBJECT_KEY, &buf, 0, 0) < 0) {
+            targ->errors++;
+        }
+        else {
+            targ->ops++;
+        }
+        free(buf);
+    }
+    return NULL;
+}
+
+static int bench_threads()
+{
+    if (make_object(SMALL_OBJECT_KEY, SMALL_OBJECT_SIZE) < 0) {
+        return -1;
+    }
+
+    printf("%8s %12s %12s\n", "threads", "ops/sec", "errors");
+    int nthreads;
+    for (nthreads = 1; nthreads <= maxThreadsG; nthreads *= 2) {
+        pthread_t threads[nthreads];
+        struct thread_arg args[nthreads];
+        double start = now();
+        int i;
+        for (i = 0; i < nthreads; i++) {
+            args[i].deadline = start + secondsG;
+            args[i].ops = args[i].errors = 0;
+            pthread_create(&threads[i], NULL, get_loop, &args[i]);
+        }
+        long ops = 0, errors = 0;
+        for (i = 0; i < nthreads; i++) {
+            pthread_join(threads[i], NULL);
+            ops += args[i].ops;
+            errors += args[i].errors;
+        }
+        printf("%8d %12.1f %12ld\n", nthreads, ops / (now() - start),
+               errors);
+    }
+    return 0;
+}
+
+// get -----------------------------------------------------------------------
+
+#define GET_MIN_SIZE (4 * 1024)
+#define GET_MAX_SIZE (256 * 1024 * 1024)
+
+static int bench_get()
+{
+    printf("%12s %10s %12s\n", "size", "GETs", "MB/sec");
+    size_t size;
+    for (size = GET_MIN_SIZE; size <= GET_MAX_SIZE; size *= 4) {
+        char key[64];
+        snprintf(key, sizeof(key), "bench-get-%zu", size);
+        if (make_object(key, size) < 0) {
+            return -1;
+        }
+
+        // run for secondsG, but always finish at least one GET
+        long gets = 0;
+        uint64_t bytes = 0;
+        double start = now(), elapsed;
+        do {
+            uint8_t *buf = NULL;
+            ssize_t rv = s3fs_get_object(bucketG, key, &buf, 0, 0);
+            free(buf);
+            if (rv != (ssize_t) size) {
+                fprintf(stderr, "GET of %s returned %zd\n", key, rv);
+                return -1;
+            }
+            gets++;
+            bytes += rv;
+            elapsed = now() - start;
+        } while (elapsed < secondsG);
+        printf("%12zu %10ld %12.1f\n", size, gets,
+               bytes / elapsed / (1024 * 1024));
+    }
+    return 0;
+}
+
+// multipart -----------------------------------------------------------------
+
+#define MULTIPART_OBJECT_SIZE ((uint64_t) 320 * 1024 * 1024)
+#define MULTIPART_MAX_PARTS 64
+
+// Generates the upload's data, so no object-sized buffer is needed
+static ssize_t pattern_producer(void *arg, uint64_t offset, uint8_t *buf,
+                                size_t len)
+{
+    (void) arg;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        buf[i] = mock_s3_byte(offset + i);
+    }
+    return len;
+}
+
+static int bench_multipart()
+{
+    printf("%8s %12s %12s\n", "parts", "part size", "MB/sec");
+    int parts;
+    // parts == 0 is a plain single PUT, for comparison
+    for (parts = 0; parts <= MULTIPART_MAX_PARTS;
+         parts = parts ? parts * 2 : 1) {
+        uint64_t partSize = parts ? MULTIPART_OBJECT_SIZE / parts : 0;
+        s3fs_set_multipart(parts ? 1 : 0, partSize, concurrencyG,
+                           S3FS_DEFAULT_MULTIPART_RETRIES);
+
+        double start = now();
+        ssize_t rv = s3fs_put_object_stream(bucketG, "bench-multipart",
+                                            MULTIPART_OBJECT_SIZE,
+                                            pattern_producer, NULL);
+        double elapsed = now() - start;
+        if (rv != (ssize_t) MULTIPART_OBJECT_SIZE) {
+            fprintf(stderr, "upload with %d parts returned %zd\n", parts, rv);
+            return -1;
+        }
+        printf("%8d %12llu %12.1f\n", parts ? parts : 1,
+               (unsigned long long) (parts ? partSize : MULTIPART_OBJECT_SIZE),
+               MULTIPART_OBJECT_SIZE / elapsed / (1024 * 1024));
+    }
+    return 0;
+}
+
+// lookup --------------------------------------------------------------------
+
+#define LOOKUP_MIN_ENTRIES 16
+#define LOOKUP_MAX_ENTRIES (256 * 1024)
+#define LOOKUP_NAMES 1024
+
+static int linear_find(const s3dirent_t *dir, int count, const char *name)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        if (!strcmp(dir[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns ns per lookup of names[], cycling through them for secondsG / 3.
+// method 0 is a linear scan, 1 the hash index, and 2 the directory cache.
+static double time_lookups(int method, const s3dirent_t *dir, int count,
+                           const s3dir_index_t *index, char **names)
+{
+    long lookups = 0, found = 0;
+    double start = now(), elapsed;
+    do {
+        int i;
+        for (i = 0; i < LOOKUP_NAMES; i++) {
+            s3dirent_t dirent;
+            if (method == 0) {
+                found += linear_find(dir, count, names[i]) >= 0;
+            }
+            else if (method == 1) {
+                found += s3dir_index_find(index, dir, names[i]) >= 0;
+            }
+            else {
+                found += dircache_lookup("/bench", names[i], &dirent) ==
+                    DIRCACHE_HIT;
+            }
+        }
+        lookups += LOOKUP_NAMES;
+        elapsed = now() - start;
+    } while (elapsed < secondsG / 3.0);
+    if (found != lookups) {
+        fprintf(stderr, "lookup method %d missed %ld names\n", method,
+                lookups - found);
+        return -1;
+    }
+    return elapsed * 1e9 / lookups;
+}
+
+static int bench_lookup()
+{
+    s3dirent_t *dir = calloc(LOOKUP_MAX_ENTRIES, sizeof(s3dirent_t));
+    char *names[LOOKUP_NAMES];
+    if (!dir) {
+        return -1;
+    }
+    dircache_init(3600, (size_t) -1);
+
+    printf("%10s %12s %12s %12s\n", "entries", "linear ns", "index ns",
+           "cache ns");
+    int count, rv = 0;
+    for (count = LOOKUP_MIN_ENTRIES; count <= LOOKUP_MAX_ENTRIES && !rv;
+         count *= 4) {
+        int i;
+        for (i = 0; i < count; i++) {
+            dir[i].type = 'F';
+            snprintf(dir[i].name, sizeof(dir[i].name), "file-%08d", i);
+        }
+        // look up names spread evenly through the directory
+        for (i = 0; i < LOOKUP_NAMES; i++) {
+            names[i] = dir[(long) i * 7919 % count].name;
+        }
+        s3dir_index_t index;
+        if (s3dir_index_build(&index, dir, count) < 0) {
+            rv = -1;
+            break;
+        }
+        dircache_put("/bench", dir, count, "", NULL);
+
+        double ns[3];
+        int method;
+        for (method = 0; method < 3; method++) {
+            ns[method] = time_lookups(method, dir, count, &index, names);
+            if (ns[method] < 0) {
+                rv = -1;
+            }
+        }
+        printf("%10d %12.1f %12.1f %12.1f\n", count, ns[0], ns[1], ns[2]);
+        s3dir_index_free(&index);
+    }
+    dircache_destroy();
+    free(dir);
+    return rv;
+}
+
+// stream --------------------------------------------------------------------
+
+#define STREAM_OBJECT_KEY "bench-stream"
+#define STREAM_OBJECT_SIZE (64 * 1024 * 1024)
+#define STREAM_MIN_READ (16 * 1024)
+#define STREAM_MAX_READ (128 * 1024)
+
+// Read the stream object from start to end in reads of read_size bytes,
+// through the block cache if cached is set.  Returns MB/sec, or -1.
+static double stream_object(size_t read_size, int cached)
+{
+    uint8_t *buf = malloc(read_size);
+    blockcache_stream_t stream;
+    memset(&stream, 0, sizeof(stream));
+    blockcache_invalidate(STREAM_OBJECT_KEY, NULL);
+
+    uint64_t offset = 0;
+    double start = now();
+    while (offset < STREAM_OBJECT_SIZE) {
+        ssize_t rv = cached ?
+            blockcache_read(bucketG, STREAM_OBJECT_KEY, buf, read_size,
+                            offset, STREAM_OBJECT_SIZE, NULL, &stream) :
+            s3fs_get_object_into(bucketG, STREAM_OBJECT_KEY, buf, read_size,
+                                 offset);
+        if (rv <= 0) {
+            fprintf(stderr, "read at %llu returned %zd\n",
+                    (unsigned long long) offset, rv);
+            free(buf);
+            return -1;
+        }
+        offset += rv;
+    }
+    double elapsed = now() - start;
+    free(buf);
+    return STREAM_OBJECT_SIZE / elapsed / (1024 * 1024);
+}
+
+static int bench_stream()
+{
+    if (make_object(STREAM_OBJECT_KEY, STREAM_OBJECT_SIZE) < 0) {
+        return -1;
+    }
+    blockcache_init(BLOCKCACHE_DEFAULT_BLOCK_SIZE,
+                    BLOCKCACHE_DEFAULT_MAX_BYTES,
+                    BLOCKCACHE_DEFAULT_READAHEAD);
+
+    printf("%10s %14s %14s\n", "read size", "direct MB/s", "cached MB/s");
+    size_t readSize;
+    for (readSize = STREAM_MIN_READ; readSize <= STREAM_MAX_READ;
+         readSize *= 2) {
+        double direct = stream_object(readSize, 0);
+        double cached = stream_object(readSize, 1);
+        if (direct < 0 || cached < 0) {
+            return -1;
+        }
+        printf("%10zu %14.1f %14.1f\n", readSize, direct, cached);
+    }
+    blockcache_destroy();
+    return 0;
+}
+
+// create --------------------------------------------------------------------
+
+// Creates go through the filesystem's own directory code (dirops.h), as
+// fs_mknod does: a new inode number, an empty object under it, and a dirent
+// holding just the file's name, added to the shard of its directory that
+// holds it.  The mock keeps no object bodies, so a directory can't be read
+// back from it; like s3fs with the directory cached, creates read it from
+// the cache and write it through to both.
+
+struct create_arg {
+    char dirkey[S3DIR_KEY_SIZE];
+    double deadline;
+    long ops;
+    long errors;
+};
+
+// Create an empty file called name in the directory whose object is at
+// dirkey, as node_mknod does.
+static int create_file(const char *dirkey, const char *name)
+{
+    uint64_t ino = new_ino();
+    char key[S3DIR_KEY_SIZE];
+    s3dir_object_key(key, sizeof(key), ino);
+    if (s3fs_put_object(bucketG, key, NULL, 0) < 0) {
+        return -1;
+    }
+    s3dirent_t dirent;
+    memset(&dirent, 0, sizeof(dirent));
+    dirent.type = 'F';
+    snprintf(dirent.name, sizeof(dirent.name), "%s", name);
+    dirent.st_mode = S_IFREG | 0644;
+    dirent.st_ino = ino;
+    return dir_add(NULL, dirkey, &dirent) == 0 ? 0 : -1;
+}
+
+static void *create_loop(void *p)
+{
+    struct create_arg *arg = p;
+    while (now() < arg->deadline) {
+        char name[64];
+        snprintf(name, sizeof(name), "f%ld-%p", arg->ops, (void *) arg);
+        if (create_file(arg->dirkey, name) < 0) {
+            arg->errors++;
+        }
+        else {
+            arg->ops++;
+        }
+    }
+    return NULL;
+}
+
+// Create a directory holding just its "." dirent, under a new inode
+// number, and write its object key to dirkey.
+static int make_dir(char *dirkey)
+{
+    s3dirent_t self;
+    memset(&self, 0, sizeof(self));
+    self.type = 'D';
+    strcpy(self.name, ".");
+    self.st_mode = S_IFDIR | 0755;
+    self.st_ino = new_ino();
+    s3dir_object_key(dirkey, S3DIR_KEY_SIZE, self.st_ino);
+    return dir_store(dirkey, &self, 1);
+}
+
+// Run nthreads creating threads, in a directory each if distinct is set.
+// Returns creates/sec, or -1 if any failed.
+static double time_creates(int nthreads, int distinct)
+{
+    pthread_t threads[nthreads];
+    struct create_arg args[nthreads];
+    double start = now();
+    int i;
+    for (i = 0; i < nthreads; i++) {
+        if (!distinct && i > 0) {
+            strcpy(args[i].dirkey, args[0].dirkey);
+        }
+        else if (make_dir(args[i].dirkey) != 0) {
+            return -1;
+        }
+        args[i].deadline = start + secondsG;
+        args[i].ops = args[i].errors = 0;
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&threads[i], NULL, create_loop, &args[i]);
+    }
+    long ops = 0, errors = 0;
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        ops += args[i].ops;
+        errors += args[i].errors;
+    }
+    if (errors) {
+        fprintf(stderr, "%ld creates failed\n", errors);
+        return -1;
+    }
+    return ops / (now() - start);
+}
+
+static int bench_create()
+{
+    dircache_init(3600, (size_t) -1);
+    dirops_init(bucketG);
+    workpool_init(WORKPOOL_DEFAULT_THREADS);
+    printf("%8s %16s %16s\n", "threads", "distinct dirs/s", "same dir/s");
+    int nthreads, rv = 0;
+    for (nthreads = 1; nthreads <= maxThreadsG && !rv; nthreads *= 2) {
+        double distinct = time_creates(nthreads, 1);
+        double same = time_creates(nthreads, 0);
+        if (distinct < 0 || same < 0) {
+            rv = -1;
+            break;
+        }
+        printf("%8d %16.1f %16.1f\n", nthreads, distinct, same);
+    }
+    workpool_destroy();
+    dircache_destroy();
+    return rv;
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t max_threads] [-s seconds] "
+            "[-l latency_us] [-c concurrency] "
+            "threads|get|multipart|lookup|stream|create\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:l:c:")) != -1) {
+        switch (opt) {
+        case 't':
+            maxThreadsG = atoi(optarg);
+            break;
+        case 's':
+            secondsG = atoi(optarg);
+            break;
+        case 'l':
+            latencyG = atoi(optarg);
+            break;
+        case 'c':
+            concurrencyG = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return -1;
+    }
+    const char *bench = argv[optind];
+
+    if (getenv("S3_HOSTNAME")) {
+        mockG = 0;
+        bucketG = getenv(S3BUCKET);
+        if (!bucketG) {
+            fprintf(stderr, "%s environment variable must be defined\n",
+                    S3BUCKET);
+            return -1;
+        }
+    }
+    else {
+        int port = mock_s3_start(latencyG);
+        if (port < 0) {
+            fprintf(stderr, "Failed to start mock S3 endpoint\n");
+            return -1;
+        }
+        char hostname[64];
+        snprintf(hostname, sizeof(hostname), "127.0.0.1:%d", port);
+        setenv("S3_HOSTNAME", hostname, 1);
+        setenv("S3_PROTOCOL", "http", 1);
+        setenv(S3ACCESSKEY, "mock", 0);
+        setenv(S3SECRETKEY, "mock", 0);
+        printf("Using mock S3 endpoint %s (%d us latency)\n", hostname,
+               latencyG);
+    }
+
+    if (s3fs_init_credentials() < 0 || s3fs_initialize(maxThreadsG) < 0) {
+        fprintf(stderr, "Failed to initialize libs3\n");
+        return -1;
+    }
+
+    int rv;
+    if (!strcmp(bench, "threads")) {
+        rv = bench_threads();
+    }
+    else if (!strcmp(bench, "get")) {
+        rv = bench_get();
+    }
+    else if (!strcmp(bench, "multipart")) {
+        rv = bench_multipart();
+    }
+    else if (!strcmp(bench, "lookup")) {
+        rv = bench_lookup();
+    }
+    else if (!strcmp(bench, "stream")) {
+        rv = bench_stream();
+    }
+    else if (!strcmp(bench, "create")) {
+        rv = bench_create();
+    }
+    else {
+        usage(argv[0]);
+        rv = -1;
+    }
+
+    s3fs_deinitialize();
+    return rv;
+}
@@ -0,0 +1,165 @@
+/*
+ * workpool.c, the persistent worker threads for the s3fs project.  See
+ * workpool.h.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "workpool.h"
+
+// A batch queued by workpool_run, which lives on the stack of the thread
+// that queued it
+typedef struct workpool_batch
+{
+    workpool_fn_t fn;
+    void *arg;
+    int count;
+    int next;                     // next item to hand out
+    int running;                  // items handed out but not yet done
+    pthread_cond_t done;          // signalled when the last item is done
+    struct workpool_batch *queueNext;
+} workpool_batch;
+
+static pthread_t *threadsG = NULL;
+static int nthreadsG = 0;
+static int stopG = 0;
+static workpool_batch *queueHeadG = NULL; // oldest batch with items left
+static workpool_batch *queueTailG = NULL;
+static pthread_mutex_t workpool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workpool_work = PTHREAD_COND_INITIALIZER;
+
+
+// Unlink a batch whose items have all been handed out; with the lock held.
+static void dequeue(workpool_batch *batch)
+{
+    workpool_batch **slot = &queueHeadG;
+    workpool_batch *prev = NULL;
+    while (*slot && *slot != batch) {
+        prev = *slot;
+        slot = &(*slot)->queueNext;
+    }
+    if (!*slot) {
+        return;
+    }
+    *slot = batch->queueNext;
+    if (queueTailG == batch) {
+        queueTailG = prev;
+    }
+    batch->queueNext = NULL;
+}
+
+// Do the next item of batch, which has one left; with the lock held, which
+// is dropped for the call.
+static void run_item(workpool_batch *batch)
+{
+    int item = batch->next++;
+    if (batch->next == batch->count) {
+        dequeue(batch);
+    }
+    batch->running++;
+    pthread_mutex_unlock(&workpool_lock);
+
+    batch->fn(batch->arg, item);
+
+    pthread_mutex_lock(&workpool_lock);
+    if (--batch->running == 0 && batch->next == batch->count) {
+        pthread_cond_signal(&batch->done);
+    }
+}
+
+static void *worker(void *arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&workpool_lock);
+    for (;;) {
+        while (!queueHeadG && !stopG) {
+            pthread_cond_wait(&workpool_work, &workpool_lock);
+        }
+        if (!queueHeadG) {
+            break;
+        }
+        run_item(queueHeadG);
+    }
+    pthread_mutex_unlock(&workpool_lock);
+    return NULL;
+}
+
+
+int workpool_init(int threads)
+{
+    pthread_t *started = calloc(threads > 0 ? threads : 1, sizeof(pthread_t));
+    if (!started) {
+        return -1;
+    }
+    pthread_mutex_lock(&workpool_lock);
+    stopG = 0;
+    int n;
+    for (n = 0; n < threads; n++) {
+        if (pthread_create(&started[n], NULL, worker, NULL) != 0) {
+            break;
+        }
+    }
+    threadsG = started;
+    nthreadsG = n;
+    pthread_mutex_unlock(&workpool_lock);
+    return n > 0 ? 0 : -1;
+}
+
+void workpool_destroy()
+{
+    pthread_mutex_lock(&workpool_lock);
+    stopG = 1;
+    pthread_cond_broadcast(&workpool_work);
+    pthread_t *threads = threadsG;
+    int n = nthreadsG;
+    threadsG = NULL;
+    nthreadsG = 0;
+    pthread_mutex_unlock(&workpool_lock);
+
+    int i;
+    for (i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+void workpool_run(workpool_fn_t fn, void *arg, int count)
+{
+    if (count <= 0) {
+        return;
+    }
+    workpool_batch batch;
+    batch.fn = fn;
+    batch.arg = arg;
+    batch.count = count;
+    batch.next = 0;
+    batch.running = 0;
+    batch.queueNext = NULL;
+    pthread_cond_init(&batch.done, NULL);
+
+    pthread_mutex_lock(&workpool_lock);
+    if (count > 1 && nthreadsG > 0) {
+        if (queueTailG) {
+            queueTailG->queueNext = &batch;
+        }
+        else {
+            queueHeadG = &batch;
+        }
+        queueTailG = &batch;
+        if (count > 2) {
+            pthread_cond_broadcast(&workpool_work);
+        }
+        else {
+            pthread_cond_signal(&workpool_work);
+        }
+    }
+    // work on it here too, rather than just wait
+    while (batch.next < batch.count) {
+        run_item(&batch);
+    }
+    while (batch.running > 0) {
+        pthread_cond_wait(&batch.done, &workpool_lock);
+    }
+    pthread_mutex_unlock(&workpool_lock);
+    pthread_cond_destroy(&batch.done);
+}
@@ -0,0 +1,45 @@
+/*
+ * Persistent worker threads for the s3fs project.
+ *
+ * Some operations fan a batch of independent requests out over many
+ * threads at once: loading or storing all the shards of a directory, or
+ * all the changed chunks of a file.  Rather than start and join threads
+ * for every batch, they hand the batch to a fixed set of workers started
+ * once, along with the filesystem.
+ *
+ * A batch is count items, numbered 0 to count - 1, each done by one call
+ * of the batch's function.  Batches are served in the order they were
+ * queued, and the thread that queued one works on its items too, so a
+ * batch always finishes even if every worker is busy with others (or the
+ * pool was never started).  The function must be safe to call from
+ * several threads at once.
+ *
+ * All functions are thread-safe.
+ */
+#ifndef __WORKPOOL_H__
+#define __WORKPOOL_H__
+
+#define WORKPOOL_DEFAULT_THREADS 16
+
+typedef void (*workpool_fn_t)(void *arg, int item);
+
+/*
+ * Start threads workers.  Call it after any fork (as FUSE does to run in
+ * the background), since the workers don't survive one.  Returns 0 on
+ * success and -1 if no worker could be started; with fewer workers than
+ * asked for, the pool runs with those it got.
+ */
+int workpool_init(int threads);
+
+/*
+ * Stop the workers, once they finish the batches queued.
+ */
+void workpool_destroy();
+
+/*
+ * Call fn(arg, item) for every item from 0 to count - 1, on the workers
+ * and the calling thread, and return once all the calls have returned.
+ */
+void workpool_run(workpool_fn_t fn, void *arg, int count);
+
+#endif // __WORKPOOL_H__